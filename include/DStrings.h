@@ -32,13 +32,76 @@
 extern "C" {
 #endif
 
+#include <stddef.h> /* size_t */
+#include <stdio.h> /* FILE */
+#include <stdint.h> /* uint64_t, uint16_t */
 #include <string.h> /* strlen */
+#include <stdarg.h> /* va_list */
+#include <sys/uio.h> /* struct iovec, ssize_t */
+#include <limits.h> /* UINT_MAX */
+
+/**
+ * @brief type of lengths, offsets and sizes.
+ * @details Strings are limited to 4 GiB unless the library, and whatever
+ * includes this header, is built with DSTRINGS_SIZE_T defined.
+ */
+#ifdef DSTRINGS_SIZE_T
+typedef size_t String_len;
+#define STRING_LEN_MAX SIZE_MAX
+#else
+typedef unsigned String_len;
+#define STRING_LEN_MAX UINT_MAX
+#endif
+
+/**
+ * @brief returned by the search functions when there's no match.
+ */
+#define STRING_NOT_FOUND STRING_LEN_MAX
 
 /**
  * @brief opaque data type
  */
 typedef struct string *String;
 
+/**
+ * @brief non owning reference to a sequence of chars.
+ * @details a view doesn't allocate nor copy anything, it's just a pointer
+ * and a length. It's valid as long as the memory it points to is. A view
+ * of a String is invalidated by any modification of the String.
+ */
+typedef struct StringView {
+	const char *ptr; /**< first char, not necessarily NUL terminated */
+	String_len len;  /**< number of chars */
+} StringView;
+
+/**
+ * @brief memory allocator hooks.
+ * @details every allocation a String makes, its handle included, goes
+ * through the allocator it was created with. ctx is passed as the first
+ * argument to every hook.
+ */
+typedef struct String_allocator {
+	/** allocates n bytes, NULL on failure. */
+	void *(*alloc)(void *ctx, size_t n);
+	/** realloc-like. p, of old_size bytes, may be NULL. */
+	void *(*resize)(void *ctx, void *p, size_t old_size, size_t n);
+	/** releases p, which is size bytes long. */
+	void (*release)(void *ctx, void *p, size_t size);
+	void *ctx;
+} String_allocator;
+
+/**
+ * @brief growth policy, picks the capacity a String grows to.
+ * @details called whenever a String has to grow to hold needed chars,
+ * '\0' included. Returning less than needed is taken as needed.
+ *
+ * @param size current capacity.
+ * @param needed minimum new capacity.
+ *
+ * @return the new capacity.
+ */
+typedef String_len (*String_growth)(String_len size, String_len needed);
+
 /**
  * @brief copies n bytes to dest from src.
  * @details if dest_offset > String_length(dest), dest's gap will be padded
@@ -51,8 +114,8 @@ typedef struct string *String;
  *
  * @return 0 on success, -1 if a reallocation error occurred.
  */
-int String_ncpy_at(String dest, unsigned dest_offset,
-                   const void *src, unsigned n);
+int String_ncpy_at(String dest, String_len dest_offset,
+                   const void *src, String_len n);
 
 /**
  * @brief convenience macro.
@@ -69,7 +132,7 @@ int String_ncpy_at(String dest, unsigned dest_offset,
  * @param dest String.
  * @param src String.
  */
-#define String_cpy(dest, src) String_ncpy_at(dest, 0, src, String_length(src))
+#define String_cpy(dest, src) String_cpy_view_at(dest, 0, String_view(src))
 
 /**
  * @brief convenience macro.
@@ -100,7 +163,7 @@ int String_ncpy_at(String dest, unsigned dest_offset,
  * @return -1 if dest has to be reallocated in order to succeed but failed.
  */
 int String_ncat(String dest,
-                const void *src, unsigned n);
+                const void *src, String_len n);
 
 /**
  * @brief convenience macro.
@@ -108,7 +171,7 @@ int String_ncat(String dest,
  * @param dest String.
  * @param src String.
  */
-#define String_cat(dest, src) String_ncat(dest, src, String_length(src))
+#define String_cat(dest, src) String_cat_view(dest, String_view(src))
 
 /**
  * @brief convenience macro.
@@ -118,6 +181,48 @@ int String_ncat(String dest,
  */
 #define String_cat_str(dest, src) String_ncat(dest, src, strlen(src))
 
+/**
+ * @brief appends count buffers to dest.
+ * @details the total length is computed first, so dest is grown at most
+ * once. Buffers may point inside dest.
+ *
+ * @param dest String.
+ * @param iov buffers.
+ * @param count number of buffers.
+ *
+ * @return 0 on success.
+ * @return -1 if dest has to be reallocated in order to succeed but failed.
+ */
+int String_catv(String dest, const struct iovec *iov, unsigned count);
+
+/**
+ * @brief appends every raw string given to dest, upto the first NULL.
+ * @details same as String_catv, dest is grown at most once.
+ *
+ * @param dest String.
+ * @param ... raw strings, followed by NULL.
+ *
+ * @return 0 on success.
+ * @return -1 if dest has to be reallocated in order to succeed but failed.
+ */
+int String_cat_strs(String dest, ...);
+
+/**
+ * @brief appends count Strings to dest, with sep between each other.
+ * @details dest is grown at most once, and may be one of parts.
+ *
+ * @param dest String.
+ * @param parts Strings.
+ * @param count number of Strings.
+ * @param sep separator.
+ * @param sep_len sep's length.
+ *
+ * @return 0 on success.
+ * @return -1 if dest has to be reallocated in order to succeed but failed.
+ */
+int String_join(String dest, const String *parts, unsigned count,
+                const void *sep, String_len sep_len);
+
 /**
  * @brief returns the number of chars that s has, including a the
  * terminating '\0' char.
@@ -126,7 +231,7 @@ int String_ncat(String dest,
  *
  * @return the number of chars s has.
  */
-unsigned String_length(String s);
+String_len String_length(String s);
 
 /**
  * @brief returns s's allocated space, which should be always greater or
@@ -136,7 +241,7 @@ unsigned String_length(String s);
  *
  * @return String's size.
  */
-unsigned String_size(String s);
+String_len String_size(String s);
 
 /**
  * @brief reallocates s so it can hold at least size chars.
@@ -149,7 +254,7 @@ unsigned String_size(String s);
  * @return -1 if reallocation failed or the string is non resizable.
  * @return 0 otherwise.
  */
-int String_set_size(String s, unsigned newsize);
+int String_set_size(String s, String_len newsize);
 
 /**
  * @brief convenience macro. Shrinks s to a size that can still hold its
@@ -159,6 +264,20 @@ int String_set_size(String s, unsigned newsize);
  */
 #define String_shrink(s) String_set_size(s, String_length(s))
 
+/**
+ * @brief makes s able to hold size chars, '\0' included, without being
+ * reallocated again.
+ * @details unlike String_set_size it never shrinks s, and unlike growing
+ * by appending it allocates exactly size chars, whatever s' growth policy.
+ *
+ * @param s String.
+ * @param size minimum capacity.
+ *
+ * @return -1 if reallocation failed or s can't be resized.
+ * @return 0 otherwise.
+ */
+int String_reserve(String s, String_len size);
+
 /**
  * @brief returns the underlaying raw string.
  *
@@ -170,6 +289,12 @@ int String_set_size(String s, unsigned newsize);
 
 /**
  * @brief creates a new String from a copy of a slice of s.
+ * @details the slice is clamped to s' contents. Duplicating all of a heap
+ * allocated String is O(1): both Strings share the raw string, which is
+ * reference counted, until one of them is modified and gets its own copy.
+ * Writing through String_raw doesn't trigger that copy. Shared Strings
+ * can be used and freed from different threads, and several threads can
+ * duplicate the same String at once.
  *
  * @param s src
  * @param from first char to copy.
@@ -177,7 +302,7 @@ int String_set_size(String s, unsigned newsize);
  *
  * @return a new String.
  */
-String String_dup_slice(String s, unsigned from, unsigned to);
+String String_dup_slice(String s, String_len from, String_len to);
 
 /**
  * @brief convenience macro.
@@ -204,7 +329,9 @@ String String_dup_slice(String s, unsigned from, unsigned to);
 
 /**
  * @brief compares s1 and s2.
- * @details upto n bytes of s1 and s2 are compared.
+ * @details upto n bytes of s1 and s2 are compared. Comparison is
+ * length-aware: '\0' chars are compared like any other byte and, if one
+ * String is a prefix of the other, the shorter one is the lesser.
  *
  * @param s1 String.
  * @param s2 String.
@@ -214,7 +341,19 @@ String String_dup_slice(String s, unsigned from, unsigned to);
  * @return  0 if s1 == s2
  * @return  1 if s1 > s2
  */
-int String_ncmp(String s1, String s2, unsigned n);
+int String_ncmp(String s1, String s2, String_len n);
+
+/**
+ * @brief compares s1 and s2 in full, like String_ncmp with no limit.
+ *
+ * @param s1 String.
+ * @param s2 String.
+ *
+ * @return -1 if s1 < s2
+ * @return  0 if s1 == s2
+ * @return  1 if s1 > s2
+ */
+int String_compare(String s1, String s2);
 
 /**
  * @brief convenience macro.
@@ -222,7 +361,20 @@ int String_ncmp(String s1, String s2, unsigned n);
  * @param s1 string.
  * @param s2 string.
  */
-#define String_cmp(s1, s2) String_ncmp(s1, s2, (unsigned)-1)
+#define String_cmp(s1, s2) String_compare(s1, s2)
+
+/**
+ * @brief tests if s1 is equal to s2.
+ * @details cheaper than String_compare: Strings of different lengths are
+ * rejected without looking at their contents.
+ *
+ * @param s1 String.
+ * @param s2 String.
+ *
+ * @return 0 if they're not equal.
+ * @return != 0 if they are equal.
+ */
+int String_equal(String s1, String s2);
 
 /**
  * @brief convenience macro that tests if upto n chars, of s1 are equal
@@ -246,79 +398,1750 @@ int String_ncmp(String s1, String s2, unsigned n);
  * @return 0 if they're not equal.
  * @return != 0 if they are equal.
  */
-#define String_equals(s1, s2) String_nequals(s1, s2, (unsigned)-1)
+#define String_equals(s1, s2) String_equal(s1, s2)
 
+/**
+ * @brief returns s' hash.
+ * @details a fast non-cryptographic hash (wyhash) of s' contents. It's
+ * computed once and cached until s is modified through the library, so
+ * don't write through String_raw after hashing s. String_equal uses the
+ * cached hashes to reject different Strings early.
+ *
+ * @param s String.
+ *
+ * @return s' hash.
+ */
+uint64_t String_hash(String s);
 
-#if _BSD_SOURCE || _XOPEN_SOURCE >= 500 || _ISOC99_SOURCE || _POSIX_C_SOURCE >= 200112L
+/**
+ * @brief tests if s starts with the n bytes of prefix.
+ *
+ * @param s String.
+ * @param prefix buffer.
+ * @param n prefix's length.
+ *
+ * @return 0 if it doesn't.
+ * @return != 0 if it does.
+ */
+int String_nstarts_with(String s, const void *prefix, String_len n);
 
 /**
- * @brief write the conversion output of fmt in s.
- * @details if offset > s' length, the gap will be filled with zeros.
+ * @brief tests if s ends with the n bytes of suffix.
  *
- * @param s String
- * @param offset first byte of s to be overwritten.
- * @param fmt printf-like format string.
- * @param ... additional arguments
+ * @param s String.
+ * @param suffix buffer.
+ * @param n suffix's length.
  *
- * @return -1 if an error occurred. The content of s' raw string will be
- * undefined.
- * @return 0, everything went ok.
+ * @return 0 if it doesn't.
+ * @return != 0 if it does.
+ */
+int String_nends_with(String s, const void *suffix, String_len n);
+
+/**
+ * @brief tests if s starts with prefix.
+ *
+ * @param s String.
+ * @param prefix String.
+ *
+ * @return 0 if it doesn't.
+ * @return != 0 if it does.
+ */
+int String_starts_with(String s, String prefix);
+
+/**
+ * @brief tests if s ends with suffix.
+ *
+ * @param s String.
+ * @param suffix String.
+ *
+ * @return 0 if it doesn't.
+ * @return != 0 if it does.
  */
-int String_format_at(String s, unsigned offset, const char *fmt, ...);
+int String_ends_with(String s, String suffix);
 
 /**
  * @brief convenience macro.
  *
- * @param s String
- * @param fmt printf-like format string.
- * @param ... additional arguments
+ * @param s String.
+ * @param prefix raw string.
  */
-#define String_format(s, fmt, ...) String_format_at(s, 0, fmt, __VA_ARGS__)
+#define String_starts_with_str(s, prefix) \
+	String_nstarts_with(s, prefix, strlen(prefix))
+
+/**
+ * @brief convenience macro.
+ *
+ * @param s String.
+ * @param suffix raw string.
+ */
+#define String_ends_with_str(s, suffix) \
+	String_nends_with(s, suffix, strlen(suffix))
 
-#endif
 
 /**
- * @brief allocates a new String and copies upto n chars of src.
+ * @brief returns a view of s' contents, trailing '\0' excluded.
  *
- * @param src source. Can be NULL.
- * @param n maximum number of chars to be copied.
+ * @param s String.
+ *
+ * @return a view of s.
+ */
+StringView String_view(String s);
+
+/**
+ * @brief returns a view of a slice of s.
+ * @details the slice is clamped to s' contents, like in String_dup_slice,
+ * but nothing is copied.
+ *
+ * @param s String.
+ * @param from first char.
+ * @param to last char.
+ *
+ * @return a view of the slice.
+ */
+StringView String_view_slice(String s, String_len from, String_len to);
+
+/**
+ * @brief returns a view of n bytes of src.
+ *
+ * @param src buffer. Can be NULL if n is 0.
+ * @param n number of bytes.
+ *
+ * @return a view of src.
+ */
+StringView StringView_new(const void *src, String_len n);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param src raw string.
+ */
+#define StringView_str(src) StringView_new(src, strlen(src))
+
+/**
+ * @brief returns a view of a slice of v.
+ * @details the slice is clamped to v.
+ *
+ * @param v view.
+ * @param from first char.
+ * @param to last char.
+ *
+ * @return a view of the slice.
+ */
+StringView StringView_slice(StringView v, String_len from, String_len to);
+
+/**
+ * @brief compares v1 and v2, like String_compare.
+ *
+ * @param v1 view.
+ * @param v2 view.
+ *
+ * @return -1 if v1 < v2
+ * @return  0 if v1 == v2
+ * @return  1 if v1 > v2
+ */
+int StringView_compare(StringView v1, StringView v2);
+
+/**
+ * @brief tests if v1 is equal to v2, like String_equal.
+ *
+ * @param v1 view.
+ * @param v2 view.
+ *
+ * @return 0 if they're not equal.
+ * @return != 0 if they are equal.
+ */
+int StringView_equal(StringView v1, StringView v2);
+
+/**
+ * @brief tests if v starts with prefix.
+ *
+ * @param v view.
+ * @param prefix view.
+ *
+ * @return 0 if it doesn't.
+ * @return != 0 if it does.
+ */
+int StringView_starts_with(StringView v, StringView prefix);
+
+/**
+ * @brief tests if v ends with suffix.
+ *
+ * @param v view.
+ * @param suffix view.
+ *
+ * @return 0 if it doesn't.
+ * @return != 0 if it does.
+ */
+int StringView_ends_with(StringView v, StringView suffix);
+
+/**
+ * @brief returns v's hash.
+ * @details the same String_hash returns for a String with v's contents,
+ * so views can be used to look up String keys.
+ *
+ * @param v view.
+ *
+ * @return v's hash.
+ */
+uint64_t StringView_hash(StringView v);
+
+/**
+ * @brief allocates a new String with a copy of v's contents.
+ * @details unlike String_new, '\0' chars in v are copied too.
+ *
+ * @param v view.
  *
  * @return a new String.
  * @return NULL if allocation failed.
  */
-String String_new(const char *src, unsigned n);
+String String_new_view(StringView v);
 
 /**
  * @brief convenience macro.
  *
- * @param src raw string.
+ * @param dest String.
+ * @param dest_offset first char to be overwritten.
+ * @param v view.
  */
-#define String_new_str(src) String_new(src, strlen(src))
+#define String_cpy_view_at(dest, dest_offset, v) \
+	String_ncpy_at(dest, dest_offset, (v).ptr, (v).len)
 
 /**
  * @brief convenience macro.
+ *
+ * @param dest String.
+ * @param v view.
  */
-#define String_new_empty() String_new((void *)0x0, 0)
+#define String_cat_view(dest, v) String_ncat(dest, (v).ptr, (v).len)
+
 
 /**
- * @brief allocates a new String using src as its raw string.
- * @details if size < strlen(src) then src will be treated as a non resizable
- * raw string. Operations that need resizing it to succeed will fail.
+ * @brief returns the offset of the first occurrence of needle in v.
+ * @details lengths are used, so both can contain '\0' chars. To search
+ * only part of a String, search a slice from String_view_slice; offsets
+ * are relative to the slice.
  *
- * @param src raw string. Can be NULL. Has to be NUL terminated.
- * @param size src's allocatd memory.
+ * @param v view.
+ * @param needle view.
  *
- * @return a new String
- * @return NULL if allocation failed.
+ * @return the offset of the match, 0 if needle is empty.
+ * @return STRING_NOT_FOUND if there's none.
  */
-String String_new_steal(char *src, unsigned size);
+String_len StringView_find(StringView v, StringView needle);
 
 /**
- * @brief frees a String.
+ * @brief returns the offset of the last occurrence of needle in v.
  *
- * @param s String to be freed.
+ * @param v view.
+ * @param needle view.
+ *
+ * @return the offset of the match, v's length if needle is empty.
+ * @return STRING_NOT_FOUND if there's none.
  */
-void String_free(String *s);
+String_len StringView_rfind(StringView v, StringView needle);
+
+/**
+ * @brief returns the offset of the first c in v.
+ *
+ * @param v view.
+ * @param c char.
+ *
+ * @return the offset of the match.
+ * @return STRING_NOT_FOUND if there's none.
+ */
+String_len StringView_find_char(StringView v, char c);
+
+/**
+ * @brief returns the offset of the last c in v.
+ *
+ * @param v view.
+ * @param c char.
+ *
+ * @return the offset of the match.
+ * @return STRING_NOT_FOUND if there's none.
+ */
+String_len StringView_rfind_char(StringView v, char c);
+
+/**
+ * @brief counts the non overlapping occurrences of needle in v.
+ *
+ * @param v view.
+ * @param needle view.
+ *
+ * @return the number of occurrences, 0 if needle is empty.
+ */
+String_len StringView_count(StringView v, StringView needle);
+
+/**
+ * @brief returns the offset of the first occurrence of needle in s.
+ *
+ * @param s String.
+ * @param needle buffer.
+ * @param n needle's length.
+ *
+ * @return the offset of the match, 0 if n is 0.
+ * @return STRING_NOT_FOUND if there's none.
+ */
+String_len String_find(String s, const void *needle, String_len n);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param s String.
+ * @param needle raw string.
+ */
+#define String_find_str(s, needle) String_find(s, needle, strlen(needle))
+
+/**
+ * @brief returns the offset of the last occurrence of needle in s.
+ *
+ * @param s String.
+ * @param needle buffer.
+ * @param n needle's length.
+ *
+ * @return the offset of the match, s' length if n is 0.
+ * @return STRING_NOT_FOUND if there's none.
+ */
+String_len String_rfind(String s, const void *needle, String_len n);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param s String.
+ * @param needle raw string.
+ */
+#define String_rfind_str(s, needle) String_rfind(s, needle, strlen(needle))
+
+/**
+ * @brief returns the offset of the first c in s.
+ *
+ * @param s String.
+ * @param c char.
+ *
+ * @return the offset of the match.
+ * @return STRING_NOT_FOUND if there's none.
+ */
+String_len String_find_char(String s, char c);
+
+/**
+ * @brief returns the offset of the last c in s.
+ *
+ * @param s String.
+ * @param c char.
+ *
+ * @return the offset of the match.
+ * @return STRING_NOT_FOUND if there's none.
+ */
+String_len String_rfind_char(String s, char c);
+
+/**
+ * @brief counts the non overlapping occurrences of needle in s.
+ *
+ * @param s String.
+ * @param needle buffer.
+ * @param n needle's length.
+ *
+ * @return the number of occurrences, 0 if n is 0.
+ */
+String_len String_count(String s, const void *needle, String_len n);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param s String.
+ * @param needle raw string.
+ */
+#define String_count_str(s, needle) String_count(s, needle, strlen(needle))
+
+/**
+ * @brief replaces the first occurrence of needle in s with rep.
+ * @details needle and rep can point into s.
+ *
+ * @param s String.
+ * @param needle buffer.
+ * @param n needle's length. Nothing is replaced if it's 0.
+ * @param rep replacement. Can be NULL if rep_len is 0.
+ * @param rep_len rep's length.
+ *
+ * @return -1 if s can't be modified or reallocation failed.
+ * @return 0 otherwise, whether needle was found or not.
+ */
+int String_replace(String s, const void *needle, String_len n,
+                   const void *rep, String_len rep_len);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param s String.
+ * @param needle raw string.
+ * @param rep raw string.
+ */
+#define String_replace_str(s, needle, rep) \
+	String_replace(s, needle, strlen(needle), rep, strlen(rep))
+
+/**
+ * @brief replaces every non overlapping occurrence of needle in s with rep,
+ * left to right.
+ * @details if rep is not longer than needle, s is rewritten in place in a
+ * single pass. Otherwise the matches are counted first and s is grown,
+ * once, to its exact final size. needle and rep can point into s.
+ *
+ * @param s String.
+ * @param needle buffer.
+ * @param n needle's length. Nothing is replaced if it's 0.
+ * @param rep replacement. Can be NULL if rep_len is 0.
+ * @param rep_len rep's length.
+ *
+ * @return -1 if s can't be modified or reallocation failed, s is left
+ * unchanged.
+ * @return 0 otherwise.
+ */
+int String_replace_all(String s, const void *needle, String_len n,
+                       const void *rep, String_len rep_len);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param s String.
+ * @param needle raw string.
+ * @param rep raw string.
+ */
+#define String_replace_all_str(s, needle, rep) \
+	String_replace_all(s, needle, strlen(needle), rep, strlen(rep))
+
+/**
+ * @brief a token's position, relative to the text that was split.
+ */
+typedef struct String_span {
+	String_len offset; /**< first char */
+	String_len len;    /**< number of chars */
+} String_span;
+
+/**
+ * @brief iterator over the tokens of a text.
+ * @details it lives wherever the caller puts it and allocates nothing.
+ * Tokens are views of the text, which has to outlive the iterator. Its
+ * fields are private, use StringView_split, StringView_tokenize and
+ * String_splitter_next.
+ */
+typedef struct String_splitter {
+	const char *ptr;       /**< text */
+	String_len len;        /**< text's length */
+	String_len pos;        /**< where the next token is looked for */
+	String_len block;      /**< offset of the block mask describes */
+	uint64_t mask;         /**< delimiters in that block */
+	unsigned char lo[16];  /**< SIMD lookup table */
+	unsigned char set[32]; /**< delimiters bitmap */
+	char simd;             /**< delimiters are ASCII */
+	char skip_empty;       /**< tokenizing, not splitting */
+	char done;
+} String_splitter;
+
+/**
+ * @brief starts splitting v at every sep.
+ * @details every field is produced, empty ones too: "a,,b," gives "a",
+ * "", "b" and "". An empty text is a single empty field.
+ *
+ * @param it splitter.
+ * @param v text.
+ * @param sep separator.
+ */
+void StringView_split(String_splitter *it, StringView v, char sep);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param it splitter.
+ * @param s String.
+ * @param sep separator.
+ */
+#define String_split(it, s, sep) StringView_split(it, String_view(s), sep)
+
+/**
+ * @brief starts splitting v into tokens separated by runs of any of the
+ * chars in delims.
+ * @details empty tokens are skipped: "  a \tb " gives "a" and "b" for
+ * delims " \t".
+ *
+ * @param it splitter.
+ * @param v text.
+ * @param delims delimiters.
+ */
+void StringView_tokenize(String_splitter *it, StringView v, const char *delims);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param it splitter.
+ * @param s String.
+ * @param delims delimiters.
+ */
+#define String_tokenize(it, s, delims) \
+	StringView_tokenize(it, String_view(s), delims)
+
+/**
+ * @brief produces the next token.
+ * @details delimiters are found a 64 byte block at a time, with SIMD if
+ * the delimiters are ASCII and the CPU has SSSE3. token.ptr minus the
+ * text's start is the token's offset.
+ *
+ * @param it splitter.
+ * @param token where the token is stored.
+ *
+ * @return 0 if there are no more tokens.
+ * @return != 0 otherwise.
+ */
+int String_splitter_next(String_splitter *it, StringView *token);
+
+/**
+ * @brief splits v at every sep, like StringView_split, all at once.
+ * @details only the first max spans are stored, but all of them are
+ * counted.
+ *
+ * @param v text.
+ * @param sep separator.
+ * @param spans array. Can be NULL if max is 0.
+ * @param max spans' size.
+ *
+ * @return the number of fields.
+ */
+String_len StringView_split_spans(StringView v, char sep,
+                                  String_span *spans, String_len max);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param s String.
+ * @param sep separator.
+ * @param spans array.
+ * @param max spans' size.
+ */
+#define String_split_spans(s, sep, spans, max) \
+	StringView_split_spans(String_view(s), sep, spans, max)
+
+/**
+ * @brief tokenizes v, like StringView_tokenize, all at once.
+ * @details only the first max spans are stored, but all of them are
+ * counted.
+ *
+ * @param v text.
+ * @param delims delimiters.
+ * @param spans array. Can be NULL if max is 0.
+ * @param max spans' size.
+ *
+ * @return the number of tokens.
+ */
+String_len StringView_tokenize_spans(StringView v, const char *delims,
+                                     String_span *spans, String_len max);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param s String.
+ * @param delims delimiters.
+ * @param spans array.
+ * @param max spans' size.
+ */
+#define String_tokenize_spans(s, delims, spans, max) \
+	StringView_tokenize_spans(String_view(s), delims, spans, max)
+
+/**
+ * @brief a set of patterns compiled to be searched for at once.
+ * @details it's read only once compiled, so threads can share it.
+ */
+typedef struct string_patterns *String_patterns;
+
+/**
+ * @brief an occurrence of a pattern.
+ * @details the matched chars are [offset, offset + len - 1], so
+ * String_dup_slice(s, offset, offset + len - 1) copies them.
+ */
+typedef struct String_match {
+	String_len offset; /**< first char */
+	String_len len;    /**< number of chars */
+	unsigned pattern;  /**< index of the pattern in the set */
+} String_match;
+
+/**
+ * @brief compiles a set of patterns.
+ * @details sets of upto 32 patterns are matched with Teddy, a SIMD filter,
+ * on CPUs that have SSSE3. The rest, and bigger sets, use an Aho-Corasick
+ * automaton. Either way the whole text is scanned once, whatever the
+ * number of patterns. The patterns are copied, they can be freed.
+ *
+ * @param patterns Strings, none of them empty.
+ * @param count number of patterns.
+ *
+ * @return a new pattern set.
+ * @return NULL if allocation failed or a pattern is empty.
+ */
+String_patterns String_patterns_new(const String *patterns, unsigned count);
+
+/**
+ * @brief frees a pattern set and sets it to NULL.
+ *
+ * @param p pattern set.
+ */
+void String_patterns_free(String_patterns *p);
+
+/**
+ * @brief returns the number of patterns in p.
+ *
+ * @param p pattern set.
+ *
+ * @return the number of patterns.
+ */
+unsigned String_patterns_count(String_patterns p);
+
+/**
+ * @brief finds every occurrence of p's patterns in v, overlapping ones too.
+ * @details matches are sorted by the offset they end at, then by pattern.
+ * Only the first max of them are stored, but all of them are counted, so
+ * the call can be repeated with a big enough array.
+ *
+ * @param p pattern set.
+ * @param v view, String_view or a slice of a String.
+ * @param matches array. Can be NULL if max is 0.
+ * @param max matches' size.
+ *
+ * @return the number of matches.
+ */
+String_len String_patterns_match(String_patterns p, StringView v,
+                                 String_match *matches, String_len max);
+
+/**
+ * @brief checks whether v is well formed UTF-8.
+ * @details overlong forms, surrogates and codepoints past U+10FFFF are
+ * rejected, like RFC 3629 says.
+ *
+ * @param v view.
+ *
+ * @return != 0 if v is valid UTF-8.
+ * @return 0 otherwise.
+ */
+int StringView_utf8_validate(StringView v);
+
+/**
+ * @brief checks whether s is well formed UTF-8.
+ * @details the answer is cached in s, along with whether s is ASCII, and
+ * repeating the check is free until s is modified. Writing through
+ * String_raw doesn't forget it.
+ *
+ * @param s String.
+ *
+ * @return != 0 if s is valid UTF-8.
+ * @return 0 otherwise.
+ */
+int String_utf8_validate(String s);
+
+/**
+ * @brief checks whether every char of v is 7 bit ASCII.
+ *
+ * @param v view.
+ *
+ * @return != 0 if v is ASCII.
+ * @return 0 otherwise.
+ */
+int StringView_is_ascii(StringView v);
+
+/**
+ * @brief checks whether every char of s is 7 bit ASCII.
+ * @details cached like String_utf8_validate.
+ *
+ * @param s String.
+ *
+ * @return != 0 if s is ASCII.
+ * @return 0 otherwise.
+ */
+int String_is_ascii(String s);
+
+/**
+ * @brief returns the number of codepoints in v.
+ * @details v isn't validated: the chars that aren't continuation bytes are
+ * counted.
+ *
+ * @param v view, valid UTF-8.
+ *
+ * @return the number of codepoints.
+ */
+String_len StringView_utf8_length(StringView v);
+
+/**
+ * @brief returns the number of codepoints in s.
+ * @details it's s' length if s is known to be ASCII.
+ *
+ * @param s String, valid UTF-8.
+ *
+ * @return the number of codepoints.
+ */
+String_len String_utf8_length(String s);
+
+/**
+ * @brief shortens s to at most max chars, without splitting a codepoint.
+ * @details a codepoint that doesn't fit is dropped whole.
+ *
+ * @param s String, valid UTF-8.
+ * @param max maximum length, in chars, '\0' excluded.
+ *
+ * @return -1 if s had to be shortened and can't be modified.
+ * @return 0 otherwise.
+ */
+int String_utf8_truncate(String s, String_len max);
+
+/**
+ * @brief converts v to UTF-16, in the CPU's byte order.
+ * @details works like snprintf: only the codepoints that fit whole in max
+ * code units are stored, no terminator is added, and the length of the
+ * full conversion is returned.
+ *
+ * @param v view.
+ * @param dest array. Can be NULL if max is 0.
+ * @param max dest's size, in code units.
+ *
+ * @return the number of code units v needs.
+ * @return STRING_NOT_FOUND if v isn't valid UTF-8.
+ */
+String_len StringView_utf8_to_utf16(StringView v, uint16_t *dest, String_len max);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param s String.
+ * @param dest array.
+ * @param max dest's size.
+ */
+#define String_utf8_to_utf16(s, dest, max) \
+	StringView_utf8_to_utf16(String_view(s), dest, max)
+
+/**
+ * @brief appends n UTF-16 code units, in the CPU's byte order, to dest
+ * as UTF-8.
+ * @details dest is grown once, to the exact size of the result.
+ *
+ * @param dest String.
+ * @param src code units. Can be NULL if n is 0.
+ * @param n number of code units.
+ *
+ * @return -1 if src has unpaired surrogates, dest can't be modified or
+ * reallocation failed. dest is left unchanged.
+ * @return 0 otherwise.
+ */
+int String_cat_utf16(String dest, const uint16_t *src, String_len n);
+
+/**
+ * @brief converts v to Latin-1 (ISO-8859-1).
+ * @details works like StringView_utf8_to_utf16.
+ *
+ * @param v view.
+ * @param dest buffer. Can be NULL if max is 0.
+ * @param max dest's size.
+ *
+ * @return the number of chars v needs.
+ * @return STRING_NOT_FOUND if v isn't valid UTF-8 or has codepoints past
+ * U+00FF.
+ */
+String_len StringView_utf8_to_latin1(StringView v, char *dest, String_len max);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param s String.
+ * @param dest buffer.
+ * @param max dest's size.
+ */
+#define String_utf8_to_latin1(s, dest, max) \
+	StringView_utf8_to_latin1(String_view(s), dest, max)
+
+/**
+ * @brief appends n Latin-1 (ISO-8859-1) chars to dest as UTF-8.
+ * @details dest is grown once, to the exact size of the result.
+ *
+ * @param dest String.
+ * @param src buffer. Can be NULL if n is 0.
+ * @param n number of chars.
+ *
+ * @return -1 if dest can't be modified or reallocation failed.
+ * @return 0 otherwise.
+ */
+int String_cat_latin1(String dest, const char *src, String_len n);
+
+/**
+ * @brief converts s' ASCII letters to lower case, in place.
+ * @details other chars, UTF-8 sequences included, are left alone.
+ *
+ * @param s String.
+ *
+ * @return -1 if s can't be modified.
+ * @return 0 otherwise.
+ */
+int String_tolower(String s);
+
+/**
+ * @brief converts s' ASCII letters to upper case, in place.
+ * @details other chars, UTF-8 sequences included, are left alone.
+ *
+ * @param s String.
+ *
+ * @return -1 if s can't be modified.
+ * @return 0 otherwise.
+ */
+int String_toupper(String s);
+
+/**
+ * @brief copies src to dest with its ASCII letters in lower case.
+ * @details a single pass, that reads src and writes dest.
+ *
+ * @param dest String.
+ * @param src view, it can't point into dest.
+ *
+ * @return -1 if dest can't be modified or reallocation failed.
+ * @return 0 otherwise.
+ */
+int String_cpy_lower(String dest, StringView src);
+
+/**
+ * @brief copies src to dest with its ASCII letters in upper case.
+ *
+ * @param dest String.
+ * @param src view, it can't point into dest.
+ *
+ * @return -1 if dest can't be modified or reallocation failed.
+ * @return 0 otherwise.
+ */
+int String_cpy_upper(String dest, StringView src);
+
+/**
+ * @brief returns v without its leading and trailing whitespace.
+ * @details whitespace is what isspace says in the "C" locale: ' ', '\t',
+ * '\n', '\v', '\f' and '\r'. Nothing is copied, String_new_view makes a
+ * trimmed copy.
+ *
+ * @param v view.
+ *
+ * @return a view of v's trimmed slice.
+ */
+StringView StringView_trim(StringView v);
+
+/**
+ * @brief returns v without its leading whitespace.
+ *
+ * @param v view.
+ *
+ * @return a view of v's trimmed slice.
+ */
+StringView StringView_ltrim(StringView v);
+
+/**
+ * @brief returns v without its trailing whitespace.
+ *
+ * @param v view.
+ *
+ * @return a view of v's trimmed slice.
+ */
+StringView StringView_rtrim(StringView v);
+
+/**
+ * @brief removes s' leading and trailing whitespace, in place.
+ *
+ * @param s String.
+ *
+ * @return -1 if there was whitespace to remove and s can't be modified.
+ * @return 0 otherwise.
+ */
+int String_trim(String s);
+
+/**
+ * @brief removes s' leading whitespace, in place.
+ *
+ * @param s String.
+ *
+ * @return -1 if there was whitespace to remove and s can't be modified.
+ * @return 0 otherwise.
+ */
+int String_ltrim(String s);
+
+/**
+ * @brief removes s' trailing whitespace, in place.
+ *
+ * @param s String.
+ *
+ * @return -1 if there was whitespace to remove and s can't be modified.
+ * @return 0 otherwise.
+ */
+int String_rtrim(String s);
+
+/**
+ * @brief compares v1 and v2 like StringView_compare, ignoring the case of
+ * ASCII letters.
+ * @details letters are compared in lower case, like strcasecmp does in
+ * the "C" locale.
+ *
+ * @param v1 view.
+ * @param v2 view.
+ *
+ * @return -1 if v1 < v2
+ * @return  0 if v1 == v2
+ * @return  1 if v1 > v2
+ */
+int StringView_casecmp(StringView v1, StringView v2);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param s1 String.
+ * @param s2 String.
+ */
+#define String_casecmp(s1, s2) StringView_casecmp(String_view(s1), String_view(s2))
+
+/**
+ * @brief tests if v1 is equal to v2, ignoring the case of ASCII letters.
+ * @details views of different lengths are rejected without looking at
+ * their contents.
+ *
+ * @param v1 view.
+ * @param v2 view.
+ *
+ * @return 0 if they're not equal.
+ * @return != 0 if they are equal.
+ */
+int StringView_case_equal(StringView v1, StringView v2);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param s1 String.
+ * @param s2 String.
+ */
+#define String_case_equal(s1, s2) StringView_case_equal(String_view(s1), String_view(s2))
+
+/**
+ * @brief returns v's hash, ignoring the case of ASCII letters.
+ * @details it's StringView_hash of v in lower case, so views that are
+ * StringView_case_equal hash the same, and a table of lower case keys can
+ * be looked up with any case.
+ *
+ * @param v view.
+ *
+ * @return v's hash.
+ */
+uint64_t StringView_case_hash(StringView v);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param s String.
+ */
+#define String_case_hash(s) StringView_case_hash(String_view(s))
+
+/**
+ * @brief writes the base64 encoding of n bytes from src to dest.
+ * @details same as String_ncpy_at with the encoded bytes: dest is grown
+ * once, to the exact size of the result, and if dest_offset >
+ * String_length(dest), dest's gap will be padded with 0's. The encoding
+ * is padded with '=' and has no line breaks (RFC 4648).
+ *
+ * @param dest String.
+ * @param dest_offset first char to be overwritten.
+ * @param src buffer, may point inside dest. Can be NULL if n is 0.
+ * @param n number of bytes.
+ *
+ * @return -1 if dest can't be modified or reallocation failed.
+ * @return 0 otherwise.
+ */
+int String_base64_encode_at(String dest, String_len dest_offset,
+                            const void *src, String_len n);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param dest String.
+ * @param src buffer.
+ * @param n number of bytes.
+ */
+#define String_base64_encode(dest, src, n) String_base64_encode_at(dest, 0, src, n)
+
+/**
+ * @brief convenience macro.
+ *
+ * @param dest String.
+ * @param src buffer.
+ * @param n number of bytes.
+ */
+#define String_append_base64(dest, src, n) \
+	String_base64_encode_at(dest, String_length(dest) - 1, src, n)
+
+/**
+ * @brief writes the bytes n base64 digits from src stand for to dest.
+ * @details same as String_ncpy_at with the decoded bytes. The padding is
+ * optional, whitespace isn't allowed.
+ *
+ * @param dest String.
+ * @param dest_offset first char to be overwritten.
+ * @param src digits, may point inside dest. Can be NULL if n is 0.
+ * @param n number of digits.
+ *
+ * @return -1 if dest can't be modified, reallocation failed or src isn't
+ * valid base64, dest then ends at dest_offset.
+ * @return 0 otherwise.
+ */
+int String_base64_decode_at(String dest, String_len dest_offset,
+                            const void *src, String_len n);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param dest String.
+ * @param src digits.
+ * @param n number of digits.
+ */
+#define String_base64_decode(dest, src, n) String_base64_decode_at(dest, 0, src, n)
+
+/**
+ * @brief writes n bytes from src to dest as lower case hex digits.
+ * @details same as String_ncpy_at with the 2 * n digits.
+ *
+ * @param dest String.
+ * @param dest_offset first char to be overwritten.
+ * @param src buffer, may point inside dest. Can be NULL if n is 0.
+ * @param n number of bytes.
+ *
+ * @return -1 if dest can't be modified or reallocation failed.
+ * @return 0 otherwise.
+ */
+int String_hex_encode_at(String dest, String_len dest_offset,
+                         const void *src, String_len n);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param dest String.
+ * @param src buffer.
+ * @param n number of bytes.
+ */
+#define String_hex_encode(dest, src, n) String_hex_encode_at(dest, 0, src, n)
+
+/**
+ * @brief convenience macro.
+ *
+ * @param dest String.
+ * @param src buffer.
+ * @param n number of bytes.
+ */
+#define String_append_hex_bytes(dest, src, n) \
+	String_hex_encode_at(dest, String_length(dest) - 1, src, n)
+
+/**
+ * @brief writes the bytes n hex digits from src stand for to dest.
+ * @details same as String_ncpy_at with the n / 2 bytes. Digits can be
+ * upper or lower case.
+ *
+ * @param dest String.
+ * @param dest_offset first char to be overwritten.
+ * @param src digits, may point inside dest. Can be NULL if n is 0.
+ * @param n number of digits.
+ *
+ * @return -1 if dest can't be modified, reallocation failed or src isn't
+ * an even number of hex digits, dest then ends at dest_offset.
+ * @return 0 otherwise.
+ */
+int String_hex_decode_at(String dest, String_len dest_offset,
+                         const void *src, String_len n);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param dest String.
+ * @param src digits.
+ * @param n number of digits.
+ */
+#define String_hex_decode(dest, src, n) String_hex_decode_at(dest, 0, src, n)
+
+/**
+ * @brief writes n bytes from src to dest percent-encoded.
+ * @details same as String_ncpy_at with the encoded bytes. Everything but
+ * RFC 3986's unreserved chars, letters, digits and "-._~", is escaped, so
+ * the result fits anywhere in a URL.
+ *
+ * @param dest String.
+ * @param dest_offset first char to be overwritten.
+ * @param src buffer, may point inside dest. Can be NULL if n is 0.
+ * @param n number of bytes.
+ *
+ * @return -1 if dest can't be modified or reallocation failed.
+ * @return 0 otherwise.
+ */
+int String_url_encode_at(String dest, String_len dest_offset,
+                         const void *src, String_len n);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param dest String.
+ * @param src buffer.
+ * @param n number of bytes.
+ */
+#define String_url_encode(dest, src, n) String_url_encode_at(dest, 0, src, n)
+
+/**
+ * @brief convenience macro.
+ *
+ * @param dest String.
+ * @param src buffer.
+ * @param n number of bytes.
+ */
+#define String_append_url_encoded(dest, src, n) \
+	String_url_encode_at(dest, String_length(dest) - 1, src, n)
+
+/**
+ * @brief writes n percent-encoded chars from src to dest decoded.
+ * @details same as String_ncpy_at with the decoded bytes. '+' is left as
+ * is, it's only a space in form data.
+ *
+ * @param dest String.
+ * @param dest_offset first char to be overwritten.
+ * @param src chars, may point inside dest. Can be NULL if n is 0.
+ * @param n number of chars.
+ *
+ * @return -1 if dest can't be modified, reallocation failed or a '%'
+ * isn't followed by 2 hex digits, dest then ends at dest_offset.
+ * @return 0 otherwise.
+ */
+int String_url_decode_at(String dest, String_len dest_offset,
+                         const void *src, String_len n);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param dest String.
+ * @param src chars.
+ * @param n number of chars.
+ */
+#define String_url_decode(dest, src, n) String_url_decode_at(dest, 0, src, n)
+
+/**
+ * @brief writes n chars from src to dest escaped for a JSON string.
+ * @details same as String_ncpy_at with the escaped chars. '"', '\\' and
+ * control chars are escaped, the rest, UTF-8 sequences included, is
+ * copied as is. The quotes around the string aren't written.
+ *
+ * @param dest String.
+ * @param dest_offset first char to be overwritten.
+ * @param src chars, may point inside dest. Can be NULL if n is 0.
+ * @param n number of chars.
+ *
+ * @return -1 if dest can't be modified or reallocation failed.
+ * @return 0 otherwise.
+ */
+int String_json_escape_at(String dest, String_len dest_offset,
+                          const void *src, String_len n);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param dest String.
+ * @param src chars.
+ * @param n number of chars.
+ */
+#define String_json_escape(dest, src, n) String_json_escape_at(dest, 0, src, n)
+
+/**
+ * @brief convenience macro.
+ *
+ * @param dest String.
+ * @param src chars.
+ * @param n number of chars.
+ */
+#define String_append_json_escaped(dest, src, n) \
+	String_json_escape_at(dest, String_length(dest) - 1, src, n)
+
+/**
+ * @brief writes the contents of a JSON string, n chars from src, to dest
+ * with its escape sequences replaced.
+ * @details same as String_ncpy_at with the unescaped chars. "\\u"
+ * escapes are written as UTF-8, surrogates have to come in pairs.
+ *
+ * @param dest String.
+ * @param dest_offset first char to be overwritten.
+ * @param src chars, without the quotes around them, may point inside
+ * dest. Can be NULL if n is 0.
+ * @param n number of chars.
+ *
+ * @return -1 if dest can't be modified, reallocation failed or src has a
+ * bad escape sequence, dest then ends at dest_offset.
+ * @return 0 otherwise.
+ */
+int String_json_unescape_at(String dest, String_len dest_offset,
+                            const void *src, String_len n);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param dest String.
+ * @param src chars.
+ * @param n number of chars.
+ */
+#define String_json_unescape(dest, src, n) String_json_unescape_at(dest, 0, src, n)
+
+
+#if _BSD_SOURCE || _XOPEN_SOURCE >= 500 || _ISOC99_SOURCE || _POSIX_C_SOURCE >= 200112L
+
+/**
+ * @brief write the conversion output of fmt in s.
+ * @details if offset > s' length, the gap will be filled with zeros.
+ *
+ * @param s String
+ * @param offset first byte of s to be overwritten.
+ * @param fmt printf-like format string.
+ * @param ... additional arguments
+ *
+ * @return -1 if an error occurred. The content of s' raw string will be
+ * undefined.
+ * @return 0, everything went ok.
+ */
+int String_format_at(String s, String_len offset, const char *fmt, ...);
+
+/**
+ * @brief same as String_format_at, with a va_list instead of variable
+ * arguments.
+ *
+ * @param s String
+ * @param offset first byte of s to be overwritten.
+ * @param fmt printf-like format string.
+ * @param ap additional arguments
+ *
+ * @return -1 if an error occurred. The content of s' raw string will be
+ * undefined.
+ * @return 0, everything went ok.
+ */
+int String_vformat_at(String s, String_len offset, const char *fmt, va_list ap);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param s String
+ * @param fmt printf-like format string.
+ * @param ... additional arguments
+ */
+#define String_format(s, fmt, ...) String_format_at(s, 0, fmt, __VA_ARGS__)
+
+/**
+ * @brief appends value to s, in the shortest "%g" form that reads back
+ * as the same double.
+ *
+ * @param s String.
+ * @param value number.
+ *
+ * @return -1 if an error occurred.
+ * @return 0, everything went ok.
+ */
+int String_append_double(String s, double value);
+
+#endif
+
+/**
+ * @brief appends value to s, in decimal.
+ * @details much cheaper than String_format_at(s, String_length(s) - 1,
+ * "%lld", value): no format string to parse and no varargs.
+ *
+ * @param s String.
+ * @param value number.
+ *
+ * @return -1 if an error occurred.
+ * @return 0, everything went ok.
+ */
+int String_append_i64(String s, int64_t value);
+
+/**
+ * @brief appends value to s, in decimal.
+ *
+ * @param s String.
+ * @param value number.
+ *
+ * @return -1 if an error occurred.
+ * @return 0, everything went ok.
+ */
+int String_append_u64(String s, uint64_t value);
+
+/**
+ * @brief appends value to s, in lowercase hexadecimal without any prefix.
+ *
+ * @param s String.
+ * @param value number.
+ *
+ * @return -1 if an error occurred.
+ * @return 0, everything went ok.
+ */
+int String_append_hex(String s, uint64_t value);
+
+/**
+ * @brief appends c to s.
+ *
+ * @param s String.
+ * @param c char, '\0' included.
+ *
+ * @return -1 if an error occurred.
+ * @return 0, everything went ok.
+ */
+int String_append_char(String s, char c);
+
+/**
+ * @brief allocates a new String and copies upto n chars of src.
+ *
+ * @param src source. Can be NULL.
+ * @param n maximum number of chars to be copied.
+ *
+ * @return a new String.
+ * @return NULL if allocation failed.
+ */
+String String_new(const char *src, String_len n);
+
+/**
+ * @brief allocates a new String with the given allocator and copies upto
+ * n chars of src.
+ * @details the String keeps using a for as long as it lives, Strings
+ * duplicated from it included.
+ *
+ * @param a allocator. If NULL, the default allocator is used.
+ * @param src source. Can be NULL.
+ * @param n maximum number of chars to be copied.
+ *
+ * @return a new String.
+ * @return NULL if allocation failed.
+ */
+String String_new_with(const String_allocator *a, const char *src, String_len n);
+
+/**
+ * @brief sets the allocator Strings are created with from now on.
+ * @details existing Strings keep the allocator they were created with.
+ * Not thread safe, meant to be called at start up.
+ *
+ * @param a allocator. If NULL, malloc, realloc and free are used.
+ */
+void String_set_allocator(const String_allocator *a);
+
+/**
+ * @brief returns the allocator Strings are created with.
+ *
+ * @return the default allocator.
+ */
+const String_allocator *String_get_allocator(void);
+
+/**
+ * @brief doubles the capacity, rounding to a power of 2. The default.
+ */
+String_len String_growth_pow2(String_len size, String_len needed);
+
+/**
+ * @brief grows the capacity by half, in multiples of 16 bytes. Wastes at
+ * most a third of the memory, at the cost of growing more often.
+ */
+String_len String_growth_1_5x(String_len size, String_len needed);
+
+/**
+ * @brief power of 2 upto 64 KiB, from there on grows by half in whole
+ * 4 KiB pages.
+ */
+String_len String_growth_pages(String_len size, String_len needed);
+
+/**
+ * @brief power of 2 upto 2 MiB, from there on grows by half in whole
+ * 2 MiB pages, so big buffers can be backed by transparent hugepages.
+ */
+String_len String_growth_hugepages(String_len size, String_len needed);
+
+/**
+ * @brief sets the growth policy Strings are created with from now on.
+ * @details existing Strings keep their policy. Not thread safe, meant to
+ * be called at start up.
+ *
+ * @param g policy. If NULL, String_growth_pow2.
+ */
+void String_set_growth(String_growth g);
+
+/**
+ * @brief returns the growth policy Strings are created with.
+ *
+ * @return the default growth policy.
+ */
+String_growth String_get_growth(void);
+
+/**
+ * @brief sets s' growth policy.
+ *
+ * @param s String.
+ * @param g policy. If NULL, the current default one.
+ */
+void String_set_growth_of(String s, String_growth g);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param src raw string.
+ */
+#define String_new_str(src) String_new(src, strlen(src))
+
+/**
+ * @brief convenience macro.
+ */
+#define String_new_empty() String_new((void *)0x0, 0)
+
+/**
+ * @brief allocates a new String using src as its raw string.
+ * @details if size < strlen(src) then src will be treated as a non resizable
+ * raw string. Operations that need resizing it to succeed will fail.
+ *
+ * @param src raw string. Can be NULL. Has to be NUL terminated and, if
+ * resizable, allocated with malloc.
+ * @param size src's allocatd memory.
+ *
+ * @return a new String
+ * @return NULL if allocation failed.
+ */
+String String_new_steal(char *src, String_len size);
+
+/**
+ * @brief frees a String.
+ * @details Strings allocated from an arena only give their memory back
+ * when the arena is reset, unless they were its last allocation.
+ *
+ * @param s String to be freed.
+ */
+void String_free(String *s);
+
+/**
+ * @brief returns the canonical, interned, String with s' contents.
+ * @details there's a single interned String for each distinct contents,
+ * so two interned Strings are equal if and only if they're the same
+ * pointer. Interned Strings are immutable: every function that would
+ * modify them fails. They're owned by the intern table, String_free only
+ * clears the caller's handle. Thread safe.
+ *
+ * @param s String.
+ *
+ * @return the interned String.
+ * @return NULL if allocation failed.
+ */
+String String_intern(String s);
+
+/**
+ * @brief returns the interned String with n bytes of src as contents.
+ *
+ * @param src buffer. Can be NULL if n is 0.
+ * @param n number of bytes.
+ *
+ * @return the interned String.
+ * @return NULL if allocation failed.
+ */
+String String_intern_buf(const void *src, String_len n);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param src raw string.
+ */
+#define String_intern_str(src) String_intern_buf(src, strlen(src))
+
+/**
+ * @brief convenience macro.
+ *
+ * @param v view.
+ */
+#define String_intern_view(v) String_intern_buf((v).ptr, (v).len)
+
+/**
+ * @brief tests if s is an interned String.
+ *
+ * @param s String.
+ *
+ * @return 0 if it isn't.
+ * @return != 0 if it is.
+ */
+int String_is_interned(String s);
+
+/**
+ * @brief frees every interned String.
+ * @details handles to interned Strings must not be used afterwards.
+ */
+void String_intern_clear(void);
+
+/**
+ * @brief opaque data type. Region Strings can be allocated from.
+ */
+typedef struct String_arena *String_arena;
+
+/**
+ * @brief allocates a new arena.
+ *
+ * @param chunk_size size of the blocks the arena requests from malloc.
+ * If 0, a default size is used.
+ *
+ * @return a new arena.
+ * @return NULL if allocation failed.
+ */
+String_arena String_arena_new(unsigned chunk_size);
+
+/**
+ * @brief releases every String allocated from a at once.
+ * @details Strings allocated from a must not be used afterwards, not even
+ * to free them.
+ *
+ * @param a arena.
+ */
+void String_arena_reset(String_arena a);
+
+/**
+ * @brief frees an arena and every String allocated from it.
+ *
+ * @param a arena to be freed.
+ */
+void String_arena_free(String_arena *a);
+
+/**
+ * @brief returns the allocator hooks that allocate from a.
+ * @details Strings created with it live in a, and so does any buffer they
+ * grow into. Growing the arena's last allocation extends it in place.
+ *
+ * @param a arena. Can be NULL.
+ *
+ * @return a's allocator.
+ * @return NULL if a is NULL.
+ */
+const String_allocator *String_arena_allocator(String_arena a);
+
+/**
+ * @brief convenience macro. Allocates a new String from an arena.
+ *
+ * @param a arena. If NULL, the default allocator is used.
+ * @param src source. Can be NULL.
+ * @param n maximum number of chars to be copied.
+ */
+#define String_new_arena(a, src, n) \
+	String_new_with(String_arena_allocator(a), src, n)
+
+/**
+ * @brief convenience macro.
+ *
+ * @param a arena.
+ * @param src raw string.
+ */
+#define String_new_arena_str(a, src) String_new_arena(a, src, strlen(src))
+
+/**
+ * @brief convenience macro.
+ *
+ * @param a arena.
+ */
+#define String_new_arena_empty(a) String_new_arena(a, (void *)0x0, 0)
+
+/**
+ * @brief opaque data type. Lets several threads append to one String.
+ * @details producers reserve disjoint ranges and copy into them at the
+ * same time, nobody waits for anyone. The contents live in segments that
+ * are never moved, so growing the builder doesn't stop anyone either.
+ * Appends land in the order their ranges were reserved.
+ */
+typedef struct String_builder *String_builder;
+
+/**
+ * @brief allocates a new builder.
+ *
+ * @param segment_size size of the first segment, rounded up to a power
+ * of 2. Every segment is twice as big as the previous one. If 0, a
+ * default size is used.
+ *
+ * @return a new builder.
+ * @return NULL if allocation failed.
+ */
+String_builder String_builder_new(unsigned segment_size);
+
+/**
+ * @brief appends n chars of src to b.
+ * @details thread safe.
+ *
+ * @param b builder.
+ * @param src source. Can contain '\0'.
+ * @param n number of chars to be appended.
+ *
+ * @return -1 on error. The builder's String will be lost.
+ * @return 0 otherwise.
+ */
+int String_builder_append(String_builder b, const void *src, String_len n);
+
+/**
+ * @brief convenience macro.
+ *
+ * @param b builder.
+ * @param src raw string.
+ */
+#define String_builder_append_str(b, src) \
+	String_builder_append(b, src, strlen(src))
+
+/**
+ * @brief convenience macro.
+ *
+ * @param b builder.
+ * @param v StringView.
+ */
+#define String_builder_append_view(b, v) \
+	String_builder_append(b, (v).ptr, (v).len)
+
+/**
+ * @brief returns how many chars have been published.
+ * @details thread safe. Every char below it has been copied and can be
+ * read. While appends are running it can lag behind them, and it can end
+ * in the middle of an append that straddles two segments. Once they've
+ * returned it's b's whole length.
+ *
+ * @param b builder.
+ *
+ * @return number of chars, '\0' not included.
+ */
+String_len String_builder_length(String_builder b);
+
+/**
+ * @brief copies up to n published chars of b, starting at offset.
+ * @details thread safe.
+ *
+ * @param b builder.
+ * @param offset first char to be copied.
+ * @param dest destination. Isn't NUL terminated.
+ * @param n maximum number of chars to be copied.
+ *
+ * @return number of chars copied.
+ */
+String_len String_builder_read(String_builder b, String_len offset,
+                               void *dest, String_len n);
+
+/**
+ * @brief turns the builder's contents into a String and frees it.
+ * @details must not run at the same time as appends. The first segment
+ * becomes the String's buffer, the rest are copied after it.
+ *
+ * @param b builder. Is set to NULL.
+ *
+ * @return a new String.
+ * @return NULL if an append or allocation failed.
+ */
+String String_builder_finish(String_builder *b);
+
+/**
+ * @brief frees a builder and its contents.
+ *
+ * @param b builder to be freed.
+ */
+void String_builder_free(String_builder *b);
+
+/**
+ * @brief returns allocator hooks that map big buffers instead of
+ * malloc'ing them.
+ * @details buffers of 256 KiB or more are anonymous mappings, which are
+ * grown with mremap: the pages are remapped, not copied, so growing a
+ * huge String neither moves its bytes nor needs room for two copies.
+ * Smaller buffers, and the handles, come from malloc.
+ *
+ * @return the mmap allocator.
+ */
+const String_allocator *String_mmap_allocator(void);
+
+/**
+ * @brief convenience macro. Allocates a new String whose buffer will be
+ * mapped once it gets big.
+ *
+ * @param src source. Can be NULL.
+ * @param n maximum number of chars to be copied.
+ */
+#define String_new_mmap(src, n) String_new_with(String_mmap_allocator(), src, n)
+
+/**
+ * @brief maps a file's contents as a String's raw string.
+ * @details nothing is read nor copied until it's used. Like the Strings
+ * made by String_new_steal that can't grow, the String isn't resizable,
+ * and on top of that it's read only: every mutator fails. Later changes
+ * to the file may or may not be seen through it. The file is unmapped by
+ * String_free.
+ *
+ * @param path file's path.
+ *
+ * @return a new String.
+ * @return NULL if the file couldn't be opened or mapped.
+ */
+String String_new_mmap_file(const char *path);
+
+/**
+ * @brief appends everything that can be read from fd, upto EOF, to s.
+ * @details data is read straight into s' buffer. If fd is a regular file,
+ * s is grown once to the size fstat says is left.
+ *
+ * @param s String.
+ * @param fd file descriptor.
+ *
+ * @return -1 on error, whatever was read before it is kept.
+ * @return 0 otherwise.
+ */
+int String_read_fd(String s, int fd);
+
+/**
+ * @brief appends the contents of the file at path to s.
+ * @details see String_read_fd.
+ *
+ * @param s String.
+ * @param path file's path.
+ *
+ * @return -1 if the file couldn't be opened or read.
+ * @return 0 otherwise.
+ */
+int String_read_file(String s, const char *path);
+
+/**
+ * @brief reads once from fd into the spare capacity of upto 1024 Strings,
+ * filling them in order.
+ * @details the Strings aren't grown, use String_reserve first. What's read
+ * is appended to each of them.
+ *
+ * @param fd file descriptor.
+ * @param strings Strings.
+ * @param count number of Strings.
+ *
+ * @return the number of bytes read, 0 on EOF.
+ * @return -1 on error.
+ */
+ssize_t String_readv_fd(int fd, String *strings, unsigned count);
+
+/**
+ * @brief writes s' contents to fd.
+ *
+ * @param s String.
+ * @param fd file descriptor.
+ *
+ * @return -1 on error.
+ * @return 0 otherwise.
+ */
+int String_write_fd(String s, int fd);
+
+/**
+ * @brief writes the contents of count Strings to fd, one after the other.
+ * @details they are gathered with writev, upto 1024 Strings per call.
+ *
+ * @param fd file descriptor.
+ * @param strings Strings.
+ * @param count number of Strings.
+ *
+ * @return -1 on error.
+ * @return 0 otherwise.
+ */
+int String_writev_fd(int fd, const String *strings, unsigned count);
+
+/**
+ * @brief reads the next line of f into s, replacing its contents.
+ * @details the '\n', if any, is kept, like getline does.
+ *
+ * @param s String.
+ * @param f stream.
+ *
+ * @return -1 on EOF, if nothing was read, or on error.
+ * @return 0 otherwise.
+ */
+int String_getline(String s, FILE *f);
 
 #ifdef  __cplusplus
 }
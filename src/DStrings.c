@@ -24,65 +24,142 @@
  */
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdarg.h>
 #include <assert.h>
 
 #include "DStrings.h"
+#include "DStrings_internal.h"
 
-enum {NO = 0, YES};
+static void *stdlib_alloc(void *ctx, size_t n);
+static void *stdlib_resize(void *ctx, void *p, size_t old_size, size_t n);
+static void stdlib_release(void *ctx, void *p, size_t size);
 
-struct string {
-	char *raw;     /**< raw string */
-	unsigned len;  /**< includes trailing \0 */
-	unsigned size; /**< allocated space */
-	char resizable;
+const String_allocator string_stdlib_allocator = {
+	stdlib_alloc, stdlib_resize, stdlib_release, NULL
 };
 
-#define resizable(s) ((s)->resizable)
+/**
+ * @brief allocator new Strings are given unless told otherwise.
+ */
+static const String_allocator *default_allocator = &string_stdlib_allocator;
+
+/**
+ * @brief growth policy new Strings are given unless told otherwise.
+ */
+static String_growth default_growth = String_growth_pow2;
 
 /**
  * @brief allocates an empty string.
+ * @details in the DSTRINGS_FAM layout the handle is allocated together
+ * with room for at least capacity chars, otherwise capacity is ignored.
+ *
+ * @param a allocator the String will be allocated from.
+ * @param capacity expected size, '\0' included.
  *
  * @return a String.
  */
-static String String_alloc(void);
+static String String_alloc(const String_allocator *a, String_len capacity);
 
 /**
- * @brief resizes s so it can hold at least n chars.
- * @detail swaps s' old raw string for the new one, and updates its size
- * variable.
+ * @brief resizes s so it can hold at least size chars, as its growth
+ * policy says.
  *
  * @param s String.
  * @param size new minimum capacity.
+ * @param keep number of leading bytes that must be preserved.
  *
- * @return NULL on error or if s is not resizable.
- * @return if s' old raw string was NULL, the newly allocated buffer.
- * @return the old raw string otherwise.
+ * @return -1 on error or if s is not resizable.
+ * @return 0 otherwise.
  */
-static char *resize(String s, unsigned n);
+static int resize(String s, String_len size, String_len keep);
 
 /**
- * @brief resizes s so it can hold at least n chars and copies upto offset
- * bytes from old to new, depending on s->len.
+ * @brief resizes s so it can hold exactly size chars.
+ * @details the first keep bytes of s' raw string (or its whole length, if
+ * it's shorter) survive the resize. If anything has to be kept the buffer
+ * is grown with realloc, so it can be extended in place, otherwise a fresh
+ * buffer is allocated and the old one released without copying anything.
  *
  * @param s String.
- * @param size new minimum capacity.
- * @param offset of the first byte that should be left uninitialized.
+ * @param size new capacity.
+ * @param keep number of leading bytes that must be preserved.
+ *
+ * @return -1 on error or if s is not resizable.
+ * @return 0 otherwise.
+ */
+static int reallocate(String s, String_len size, String_len keep);
+
+/**
+ * @brief creates a new String that shares s' raw string.
+ * @details s' raw string must be a resizable, heap, one. Whichever String
+ * is modified first gets a copy of its own.
+ *
+ * @param s String.
+ *
+ * @return a new String.
+ * @return NULL if allocation failed.
+ */
+static String share(String s);
+
+/**
+ * @brief gives s a private copy of its shared raw string.
+ * @details if s turns out to be its only user, it just takes ownership.
+ *
+ * @param s String.
+ *
+ * @return -1 if the copy couldn't be allocated.
+ * @return 0 otherwise.
+ */
+static int unshare(String s);
+
+/**
+ * @brief drops s' reference to its shared raw string.
  *
- * @return NULL on error or if s is not resizable.
- * @return if s' old raw string was NULL, the newly allocated buffer.
- * @return the old raw string otherwise.
+ * @param s String.
+ *
+ * @return YES if s was its last user, so it's up to s to release it.
+ * @return NO otherwise.
+ */
+static int release_share(String s);
+
+/**
+ * @brief makes room for n more chars after s' content.
+ * @details s' buffer may move. Use string_rebase for any source that pointed
+ * into it.
+ *
+ * @param s String.
+ * @param n number of chars that are going to be appended.
+ * @param offset where s' content ends, the first char to be written.
+ *
+ * @return -1 if s can't be written or grown.
+ * @return 0 otherwise.
+ */
+static int reserve_tail(String s, size_t n, String_len *offset);
+
+/**
+ * @brief pads with 0's the gap between s' length and offset, if any.
+ *
+ * @param s String.
+ * @param offset first byte that is going to be written.
  */
-static char *resize_and_cpy(String s, unsigned n, unsigned offset);
+static void fill_gap(String s, String_len offset);
 
 /**
- * @brief the name says exactly what it does.
+ * @brief compares two buffers of known length.
+ * @details memcmp is used on the common prefix: libc dispatches it to
+ * SSE2/AVX2 code at run time, which beats anything that has to look for
+ * '\0'.
  *
- * @param num
+ * @param p1 buffer.
+ * @param n1 p1's length.
+ * @param p2 buffer.
+ * @param n2 p2's length.
  *
- * @return num's next power of 2.
- * @return if num is a power of 2, it returns it.
+ * @return -1, 0 or 1 if p1 is less, equal or greater than p2.
  */
-static unsigned round_up_to_the_next_power_of_2(unsigned num);
+static int compare(const char *p1, String_len n1, const char *p2, String_len n2);
 
 #if !(_XOPEN_SOURCE >= 700 || _POSIX_C_SOURCE >= 200809L)
 /**
@@ -93,38 +170,53 @@ static unsigned round_up_to_the_next_power_of_2(unsigned num);
  *
  * @return min(n, strlen(s))
  */
-static unsigned strnlen(const char *s, unsigned n);
+static String_len strnlen(const char *s, String_len n);
 #endif
 
-int String_ncpy_at(String dest, unsigned dest_offset,
-                   const void *src, unsigned n)
+int String_ncpy_at(String dest, String_len dest_offset,
+                   const void *src, String_len n)
 {
-	void *old_raw = NULL;
+	String_len src_offset = 0;
+	int overlapping = NO;
 
 	assert(dest != NULL);
 	assert(src != NULL || n == 0);
 
-	if (dest->size < (dest_offset + n + 1)) {
-		old_raw = resize_and_cpy(dest, dest_offset + n + 1, dest_offset);
+	/* src may point inside dest's buffer, which may be about to move */
+	if ((const char *)src >= dest->raw &&
+	    (const char *)src < dest->raw + dest->size) {
+		src_offset = (const char *)src - dest->raw;
+		overlapping = YES;
+	}
+
+	if (!fits(dest_offset, n) || string_prepare_write(dest)) {
+		return -1;
+	}
 
-		if (NULL == old_raw) {
+	if (dest->size < (dest_offset + n + 1)) {
+		if (resize(dest, dest_offset + n + 1,
+		           overlapping ? dest->size : dest_offset)) {
 			return -1;
 		}
+	}
 
-		if (old_raw == dest->raw) {
-			old_raw = NULL;
-		}
+	if (overlapping) {
+		src = dest->raw + src_offset;
+	}
+
+	fill_gap(dest, dest_offset);
+
+	if (n > 0) {
+		memmove(dest->raw + dest_offset, src, n);
 	}
 
-	memmove(dest->raw + dest_offset, src, n);
 	dest->len = n + dest_offset + 1;
 	dest->raw[n + dest_offset] = '\0';
-	free(old_raw);
 	return 0;
 }
 
 int String_ncat(String dest,
-                const void *src, unsigned n)
+                const void *src, String_len n)
 {
 	assert(dest != NULL);
 	assert(src != NULL);
@@ -132,29 +224,158 @@ int String_ncat(String dest,
 	return String_ncpy_at(dest, dest->len - 1, src, n);
 }
 
-unsigned String_length(String s)
+int String_catv(String dest, const struct iovec *iov, unsigned count)
 {
-	assert(s != NULL);
+	const char *src;
+	uintptr_t old;
+	String_len offset;
+	unsigned i;
+	size_t total = 0;
+	char *p;
 
-	if (!resizable(s)) {
-		return s->len - 1;
+	assert(dest != NULL);
+	assert(iov != NULL || count == 0);
+
+	for (i = 0; i < count; i++) {
+		total += iov[i].iov_len;
+	}
+
+	old = (uintptr_t)dest->raw;
+
+	if (reserve_tail(dest, total, &offset)) {
+		return -1;
+	}
+
+	p = dest->raw + offset;
+
+	for (i = 0; i < count; i++) {
+		if (iov[i].iov_len > 0) {
+			src = string_rebase(dest, old, offset, iov[i].iov_base);
+			memmove(p, src, iov[i].iov_len);
+			p += iov[i].iov_len;
+		}
+	}
+
+	dest->len = offset + total + 1;
+	*p = '\0';
+	return 0;
+}
+
+int String_cat_strs(String dest, ...)
+{
+	va_list vargs;
+	const char *src;
+	uintptr_t old;
+	String_len offset;
+	size_t total = 0, n;
+	char *p;
+
+	assert(dest != NULL);
+
+	va_start(vargs, dest);
+
+	while ((src = va_arg(vargs, const char *)) != NULL) {
+		total += strlen(src);
+	}
+
+	va_end(vargs);
+	old = (uintptr_t)dest->raw;
+
+	if (reserve_tail(dest, total, &offset)) {
+		return -1;
+	}
+
+	p = dest->raw + offset;
+	va_start(vargs, dest);
+
+	while ((src = va_arg(vargs, const char *)) != NULL) {
+		if ((src = string_rebase(dest, old, offset, src)) >= dest->raw &&
+		    src < dest->raw + offset) {
+			/* dest's '\0' has already been overwritten */
+			n = strnlen(src, dest->raw + offset - src);
+
+		} else {
+			n = strlen(src);
+		}
+
+		memmove(p, src, n);
+		p += n;
+	}
+
+	va_end(vargs);
+	dest->len = offset + total + 1;
+	*p = '\0';
+	return 0;
+}
+
+int String_join(String dest, const String *parts, unsigned count,
+                const void *sep, String_len sep_len)
+{
+	uintptr_t old;
+	String_len offset;
+	unsigned i;
+	size_t total = 0;
+	char *p;
+
+	assert(dest != NULL);
+	assert(parts != NULL || count == 0);
+	assert(sep != NULL || sep_len == 0);
+
+	for (i = 0; i < count; i++) {
+		total += used(parts[i]);
+	}
+
+	if (count > 1) {
+		total += (size_t)sep_len * (count - 1);
+	}
+
+	old = (uintptr_t)dest->raw;
+
+	if (reserve_tail(dest, total, &offset)) {
+		return -1;
+	}
+
+	/* parts are read through their handles, sep is the only pointer that
+	 * may have been left behind */
+	sep = string_rebase(dest, old, offset, sep);
+	p = dest->raw + offset;
+
+	/* parts' raw strings are read now, after dest's buffer settled down.
+	 * dest's length isn't updated until the end, so if dest is one of
+	 * the parts only its original content is copied. */
+	for (i = 0; i < count; i++) {
+		if (i > 0 && sep_len > 0) {
+			memmove(p, sep, sep_len);
+			p += sep_len;
+		}
+
+		memmove(p, parts[i]->raw, used(parts[i]));
+		p += used(parts[i]);
 	}
 
+	dest->len = offset + total + 1;
+	*p = '\0';
+	return 0;
+}
+
+String_len String_length(String s)
+{
+	assert(s != NULL);
 	return s->len;
 }
 
-unsigned String_size(String s)
+String_len String_size(String s)
 {
 	assert(s != NULL);
 	return s->size;
 }
 
-int String_set_size(String s, unsigned size)
+int String_set_size(String s, String_len size)
 {
 	void *temp;
 	assert(s != NULL);
 
-	if (!resizable(s)) {
+	if (!resizable(s) || string_prepare_write(s)) {
 		return -1;
 	}
 
@@ -166,13 +387,27 @@ int String_set_size(String s, unsigned size)
 		size = 1;
 	}
 
-	if ((temp = realloc(s->raw, size)) == NULL) {
+	if (is_inline(s)) {
+		if (size <= buf_size(s)) {
+			/* the inline buffer can't shrink, just truncate */
+			goto truncate;
+		}
+
+		if ((temp = mem_alloc(s->allocator, size)) == NULL) {
+			return -1;
+		}
+
+		memcpy(temp, s->raw, s->len);
+
+	} else if ((temp = mem_resize(s->allocator, s->raw, s->size, size)) == NULL) {
 		return -1;
 	}
 
 	s->size = size;
 	s->raw = temp;
 
+truncate:
+
 	if (s->len > size) {
 		s->len = size;
 		s->raw[size - 1] = '\0';
@@ -181,40 +416,200 @@ int String_set_size(String s, unsigned size)
 	return 0;
 }
 
-String String_dup_slice(String s, unsigned from, unsigned to)
+String String_dup_slice(String s, String_len from, String_len to)
 {
 	String cpy;
+	String_len n = 0;
 
 	assert(s != NULL);
 	assert(from <= to);
 
-	if ((cpy = String_alloc()) == NULL) {
+	/* a slice can't go past s' contents */
+	if (from < used(s)) {
+		n = (to < used(s) ? to + 1 : used(s)) - from;
+	}
+
+	if (n == used(s) && resizable(s) && !is_inline(s)) {
+		/* the whole raw string, share it instead of copying it */
+		if ((cpy = share(s)) != NULL) {
+			return cpy;
+		}
+	}
+
+	if ((cpy = String_alloc(s->allocator, n + 1)) == NULL) {
 		return NULL;
 	}
 
-	if (String_ncpy_at(cpy, 0, s->raw + from, to - from + 1)) {
+	if (String_ncpy_at(cpy, 0, s->raw + from, n)) {
 		String_free(&cpy);
 	}
 
 	return cpy;
 }
 
-int String_ncmp(String s1, String s2, unsigned n)
+int String_ncmp(String s1, String s2, String_len n)
+{
+	String_len n1, n2;
+
+	assert(s1 != NULL);
+	assert(s2 != NULL);
+
+	n1 = used(s1) < n ? used(s1) : n;
+	n2 = used(s2) < n ? used(s2) : n;
+	return compare(s1->raw, n1, s2->raw, n2);
+}
+
+int String_compare(String s1, String s2)
+{
+	assert(s1 != NULL);
+	assert(s2 != NULL);
+
+	return compare(s1->raw, used(s1), s2->raw, used(s2));
+}
+
+int String_equal(String s1, String s2)
 {
 	assert(s1 != NULL);
 	assert(s2 != NULL);
 
-	return strncmp(String_raw(s1), String_raw(s2), n);
+	if (used(s1) != used(s2)) {
+		return NO;
+	}
+
+	if (s1->flags & s2->flags & INTERNED) {
+		return s1 == s2;
+	}
+
+	if ((s1->flags & s2->flags & HASHED) && s1->hash != s2->hash) {
+		return NO;
+	}
+
+	return s1 == s2 || memcmp(s1->raw, s2->raw, used(s1)) == 0;
+}
+
+uint64_t String_hash(String s)
+{
+	assert(s != NULL);
+
+	if (!(s->flags & HASHED)) {
+		s->hash = string_hash_bytes(s->raw, used(s));
+		s->flags |= HASHED;
+	}
+
+	return s->hash;
+}
+
+int String_nstarts_with(String s, const void *prefix, String_len n)
+{
+	assert(s != NULL);
+	assert(prefix != NULL || n == 0);
+
+	return used(s) >= n && memcmp(s->raw, prefix, n) == 0;
+}
+
+int String_nends_with(String s, const void *suffix, String_len n)
+{
+	assert(s != NULL);
+	assert(suffix != NULL || n == 0);
+
+	return used(s) >= n && memcmp(s->raw + used(s) - n, suffix, n) == 0;
+}
+
+int String_starts_with(String s, String prefix)
+{
+	assert(prefix != NULL);
+	return String_nstarts_with(s, prefix->raw, used(prefix));
+}
+
+int String_ends_with(String s, String suffix)
+{
+	assert(suffix != NULL);
+	return String_nends_with(s, suffix->raw, used(suffix));
+}
+
+StringView String_view(String s)
+{
+	assert(s != NULL);
+	return StringView_new(s->raw, used(s));
+}
+
+StringView String_view_slice(String s, String_len from, String_len to)
+{
+	return StringView_slice(String_view(s), from, to);
+}
+
+StringView StringView_new(const void *src, String_len n)
+{
+	StringView v;
+
+	assert(src != NULL || n == 0);
+
+	v.ptr = n ? src : "";
+	v.len = n;
+	return v;
+}
+
+StringView StringView_slice(StringView v, String_len from, String_len to)
+{
+	assert(from <= to);
+
+	if (from >= v.len) {
+		return StringView_new(NULL, 0);
+	}
+
+	return StringView_new(v.ptr + from, (to < v.len ? to + 1 : v.len) - from);
+}
+
+int StringView_compare(StringView v1, StringView v2)
+{
+	return compare(v1.ptr, v1.len, v2.ptr, v2.len);
+}
+
+int StringView_equal(StringView v1, StringView v2)
+{
+	return v1.len == v2.len && memcmp(v1.ptr, v2.ptr, v1.len) == 0;
+}
+
+int StringView_starts_with(StringView v, StringView prefix)
+{
+	return v.len >= prefix.len && memcmp(v.ptr, prefix.ptr, prefix.len) == 0;
+}
+
+int StringView_ends_with(StringView v, StringView suffix)
+{
+	return v.len >= suffix.len &&
+	       memcmp(v.ptr + v.len - suffix.len, suffix.ptr, suffix.len) == 0;
+}
+
+uint64_t StringView_hash(StringView v)
+{
+	return string_hash_bytes(v.ptr, v.len);
 }
 
-String String_new(const char *src, unsigned n)
+String String_new_view(StringView v)
 {
 	String s;
 
-	if ((s = String_alloc()) == NULL) {
+	if ((s = String_alloc(default_allocator, v.len + 1)) == NULL) {
 		return NULL;
 	}
 
+	if (String_ncpy_at(s, 0, v.ptr, v.len)) {
+		String_free(&s);
+	}
+
+	return s;
+}
+
+String String_new(const char *src, String_len n)
+{
+	return String_new_with(NULL, src, n);
+}
+
+String String_new_with(const String_allocator *a, const char *src, String_len n)
+{
+	String s;
+
 	if (src != NULL) {
 		n = strnlen(src, n);
 
@@ -222,6 +617,10 @@ String String_new(const char *src, unsigned n)
 		n = 0;
 	}
 
+	if ((s = String_alloc(a ? a : default_allocator, n + 1)) == NULL) {
+		return NULL;
+	}
+
 	if (String_ncpy_at(s, 0, src, n)) {
 		String_free(&s);
 	}
@@ -229,21 +628,21 @@ String String_new(const char *src, unsigned n)
 	return s;
 }
 
-String String_new_steal(char *src, unsigned size)
+String String_new_steal(char *src, String_len size)
 {
 	String s;
 
-	if ((s = String_alloc()) == NULL) {
+	/* src comes from malloc, so it has to go back to free */
+	if ((s = String_alloc(&string_stdlib_allocator, 1)) == NULL) {
 		return NULL;
 	}
 
-	if (src != NULL) {
-		s->len = strlen(src) + 1;
-
-	} else {
-		s->len = 0;
+	if (src == NULL) { /* nothing to steal, keep the inline buffer */
+		return s;
 	}
 
+	s->len = strlen(src) + 1;
+
 	if (size < s->len) {
 		size = s->len;
 		s->resizable = NO;
@@ -254,168 +653,461 @@ String String_new_steal(char *src, unsigned size)
 	return s;
 }
 
-void String_free(String *s)
+int string_prepare_write(String s)
 {
-	assert(s != NULL);
-
-	if (*s != NULL) {
-		if (resizable(*s)) {
-			free((*s)->raw);
-		}
+	if (!writable(s)) {
+		return -1;
+	}
 
-		free(*s);
-		*s = NULL; /* avoid YADF */
+	if (shared(s) && unshare(s)) {
+		return -1;
 	}
+
+	touch(s);
+	return 0;
 }
 
-#if _BSD_SOURCE || _XOPEN_SOURCE >= 500 || _ISOC99_SOURCE || _POSIX_C_SOURCE >= 200112L
+int string_reserve_at(String s, String_len offset, String_len n)
+{
+	if (!fits(offset, n)) {
+		return -1;
+	}
+
+	if (s->size < offset + n + 1 && resize(s, offset + n + 1, offset)) {
+		return -1;
+	}
 
-#include <stdio.h>
-#include <stdarg.h>
+	fill_gap(s, offset);
+	return 0;
+}
 
-int String_format_at(String s, unsigned offset, const char *fmt, ...)
+const char *string_rebase(String s, uintptr_t old, String_len n, const char *p)
 {
-	void *old_raw;
-	va_list vargs;
-	unsigned bytes_written;
+	/* unsigned arithmetic: old may be a released pointer, don't compare it */
+	if ((uintptr_t)p - old < n) {
+		return s->raw + ((uintptr_t)p - old);
+	}
+
+	return p;
+}
 
+int String_reserve(String s, String_len size)
+{
 	assert(s != NULL);
-	assert(fmt != NULL);
 
-	if (offset >= s->size) {
-		unsigned temp = round_up_to_the_next_power_of_2(offset);
+	if (s->size >= size) {
+		return 0;
+	}
 
-		if ((old_raw = resize_and_cpy(s, temp, offset)) == NULL) {
-			return -1;
-		}
+	/* s' contents don't change, leave whatever is cached alone */
+	if (!writable(s) || (shared(s) && unshare(s))) {
+		return -1;
+	}
 
-		free(old_raw);
+	if (s->size >= size) {
+		return 0;
 	}
 
-	/* let's see if we're lucky */
-	va_start(vargs, fmt);
-	bytes_written = vsnprintf(s->raw + offset, s->size - offset, fmt, vargs) + 1;
-	va_end(vargs);
+	return reallocate(s, size, s->len);
+}
 
-	if (bytes_written > s->size) {
-		/* ops */
-		old_raw = resize_and_cpy(s, offset + bytes_written + 1, offset);
+void String_set_growth(String_growth g)
+{
+	default_growth = g ? g : String_growth_pow2;
+}
 
-		if (NULL == old_raw) {
-			return -1;
-		}
+String_growth String_get_growth(void)
+{
+	return default_growth;
+}
 
-		free(old_raw);
+void String_set_growth_of(String s, String_growth g)
+{
+	assert(s != NULL);
+	s->growth = g ? g : default_growth;
+}
 
-		/* ok, second try... */
-		va_start(vargs, fmt);
-		bytes_written = vsnprintf(s->raw + offset, s->size - offset, fmt, vargs) + 1;
-		va_end(vargs);
+void String_set_allocator(const String_allocator *a)
+{
+	default_allocator = a ? a : &string_stdlib_allocator;
+}
 
-		if (bytes_written > s->size) {
-			/* uh!? */
-			return -1;
+const String_allocator *String_get_allocator(void)
+{
+	return default_allocator;
+}
+
+void String_free(String *s)
+{
+	assert(s != NULL);
+
+	if (*s != NULL) {
+		/* interned Strings belong to the intern table */
+		if (!((*s)->flags & INTERNED)) {
+			if (resizable(*s) && !is_inline(*s) &&
+			    (!shared(*s) || release_share(*s))) {
+				mem_release((*s)->allocator, (*s)->raw, (*s)->size);
+
+			} else if ((*s)->flags & MAPPED) {
+				string_unmap(*s);
+			}
+
+			mem_release((*s)->allocator, *s, handle_size(*s));
 		}
-	}
 
-	s->len = offset + bytes_written;
-	return 0;
+		*s = NULL; /* avoid YADF */
+	}
 }
 
-#endif
-
-static String String_alloc(void)
+static String String_alloc(const String_allocator *a, String_len capacity)
 {
 	String s;
 
-	if ((s = malloc(sizeof(*s))) == NULL) {
+#ifdef DSTRINGS_FAM
+	size_t block;
+
+	capacity = String_growth_pow2(0, capacity);
+	block = offsetof(struct string, buf) + capacity;
+
+	/* buf may start inside the struct's tail padding */
+	if (block < sizeof(*s)) {
+		capacity += sizeof(*s) - block;
+		block = sizeof(*s);
+	}
+
+	if ((s = mem_alloc(a, block)) == NULL) {
 		return NULL;
 	}
 
-	s->raw = NULL;
-	s->size = 0;
+	s->buf_size = capacity;
+#else
+	(void)capacity;
+
+	if ((s = mem_alloc(a, sizeof(*s))) == NULL) {
+		return NULL;
+	}
+#endif
+
+	s->allocator = a;
+	s->growth = default_growth;
+	atomic_init(&s->share, NULL);
+	s->raw = s->buf;
+	s->raw[0] = '\0';
+	s->size = buf_size(s);
 	s->len = 0;
 	s->resizable = YES;
+	s->flags = 0;
 	return s;
 }
 
-/* http://graphics.stanford.edu/~seander/bithacks.html#RoundUpPowerOf2 */
-static unsigned round_up_to_the_next_power_of_2(unsigned num)
+static int resize(String s, String_len size, String_len keep)
 {
-	num--;
-	num |= num >> 1;
-	num |= num >> 2;
-	num |= num >> 4;
-	num |= num >> 8;
-	num |= num >> 16;
-	num++;
-	return  num += (num == 0);
+	String_len grown = s->growth(s->size, size);
+
+	return reallocate(s, grown > size ? grown : size, keep);
 }
 
-static char *resize(String s, unsigned size)
+static int reallocate(String s, String_len size, String_len keep)
 {
-	char *old_raw;
+	char *new_raw;
 
 	if (!resizable(s)) {
-		return NULL;
+		return -1;
 	}
 
-	size = round_up_to_the_next_power_of_2(size);
-	old_raw = s->raw;
+	if (is_inline(s)) {
+		/* leaving the handle, copy what must survive to the heap */
+		if ((new_raw = mem_alloc(s->allocator, size)) == NULL) {
+			return -1;
+		}
+
+		memcpy(new_raw, s->raw, keep < s->len ? keep : s->len);
 
-	if ((s->raw = malloc(size)) == NULL) {
-		s->raw = old_raw;
-		return NULL;
+	} else if (keep == 0 || s->len == 0) {
+		/* nothing worth copying, don't let realloc move garbage around */
+		if ((new_raw = mem_alloc(s->allocator, size)) == NULL) {
+			return -1;
+		}
+
+		mem_release(s->allocator, s->raw, s->size);
+
+	} else if ((new_raw = mem_resize(s->allocator, s->raw, s->size, size)) == NULL) {
+		return -1;
 	}
 
+	s->raw = new_raw;
 	s->size = size;
+	return 0;
+}
+
+static void *stdlib_alloc(void *ctx, size_t n)
+{
+	(void)ctx;
+	return malloc(n);
+}
+
+static void *stdlib_resize(void *ctx, void *p, size_t old_size, size_t n)
+{
+	(void)ctx;
+	(void)old_size;
+	return realloc(p, n);
+}
+
+static void stdlib_release(void *ctx, void *p, size_t size)
+{
+	(void)ctx;
+	(void)size;
+	free(p);
+}
+
+static int compare(const char *p1, String_len n1, const char *p2, String_len n2)
+{
+	int r = memcmp(p1, p2, n1 < n2 ? n1 : n2);
 
-	if (old_raw == NULL) {
-		return s->raw;
+	if (r != 0) {
+		return r < 0 ? -1 : 1;
 	}
 
-	return old_raw;
+	return (n1 > n2) - (n1 < n2);
+}
+
+static const uint64_t wyp[4] = {
+	0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+	0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL
+};
+
+static void wymum(uint64_t *a, uint64_t *b)
+{
+#ifdef __SIZEOF_INT128__
+	__uint128_t r = (__uint128_t)*a * *b;
+
+	*a = (uint64_t)r;
+	*b = (uint64_t)(r >> 64);
+#else
+	uint64_t ha = *a >> 32, hb = *b >> 32;
+	uint64_t la = (uint32_t)*a, lb = (uint32_t)*b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32), c = t < rl;
+	uint64_t lo = t + (rm1 << 32);
+
+	c += lo < t;
+	*a = lo;
+	*b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static uint64_t wymix(uint64_t a, uint64_t b)
+{
+	wymum(&a, &b);
+	return a ^ b;
+}
+
+/* little endian loads, memcpy keeps them alignment safe */
+static uint64_t wyr8(const unsigned char *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+static uint64_t wyr4(const unsigned char *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap32(v);
+#endif
+	return v;
+}
+
+static uint64_t wyr3(const unsigned char *p, size_t n)
+{
+	return ((uint64_t)p[0] << 16) | ((uint64_t)p[n >> 1] << 8) | p[n - 1];
+}
+
+/* ASCII letters to lower case, a byte at a time in a word */
+static uint64_t fold8(uint64_t v)
+{
+	const uint64_t ones = 0x0101010101010101ull, high = 0x8080808080808080ull;
+	uint64_t low = v & ~high;
+
+	/* the high bit of 'A' <= c <= 'Z' goes to 0x20, ASCII only */
+	return v | ((low + (0x80 - 'A') * ones) & ~(low + (0x80 - 'Z' - 1) * ones) & ~v & high) >> 2;
+}
+
+#define fold_none(v) (v)
+
+/*
+ * One copy hashes the bytes as they are, the other one folds the words it
+ * reads to lower case, so it hashes like the first one would have hashed
+ * the lower case text.
+ */
+#define WYHASH(name, fold) \
+uint64_t name(const void *key, size_t n) \
+{ \
+	const unsigned char *p = key; \
+	uint64_t seed = wymix(wyp[0], wyp[1]); \
+	uint64_t a, b; \
+\
+	if (n <= 16) { \
+		if (n >= 4) { \
+			a = fold((wyr4(p) << 32) | wyr4(p + ((n >> 3) << 2))); \
+			b = fold((wyr4(p + n - 4) << 32) | wyr4(p + n - 4 - ((n >> 3) << 2))); \
+\
+		} else if (n > 0) { \
+			a = fold(wyr3(p, n)); \
+			b = 0; \
+\
+		} else { \
+			a = b = 0; \
+		} \
+\
+	} else { \
+		size_t i = n; \
+\
+		if (i > 48) { \
+			uint64_t see1 = seed, see2 = seed; \
+\
+			do { \
+				seed = wymix(fold(wyr8(p)) ^ wyp[1], fold(wyr8(p + 8)) ^ seed); \
+				see1 = wymix(fold(wyr8(p + 16)) ^ wyp[2], fold(wyr8(p + 24)) ^ see1); \
+				see2 = wymix(fold(wyr8(p + 32)) ^ wyp[3], fold(wyr8(p + 40)) ^ see2); \
+				p += 48; \
+				i -= 48; \
+			} while (i > 48); \
+\
+			seed ^= see1 ^ see2; \
+		} \
+\
+		while (i > 16) { \
+			seed = wymix(fold(wyr8(p)) ^ wyp[1], fold(wyr8(p + 8)) ^ seed); \
+			i -= 16; \
+			p += 16; \
+		} \
+\
+		a = fold(wyr8(p + i - 16)); \
+		b = fold(wyr8(p + i - 8)); \
+	} \
+\
+	a ^= wyp[1]; \
+	b ^= seed; \
+	wymum(&a, &b); \
+	return wymix(a ^ wyp[0] ^ n, b ^ wyp[1]); \
 }
 
-static char *resize_and_cpy(String s, unsigned size, unsigned offset)
+WYHASH(string_hash_bytes, fold_none)
+WYHASH(string_hash_bytes_nocase, fold8)
+
+#undef WYHASH
+#undef fold_none
+
+static String share(String s)
 {
-	char *old_raw;
+	struct share *sh, *fresh;
+	String cpy;
+
+	if ((sh = atomic_load_explicit(&s->share, memory_order_acquire)) == NULL) {
+		if ((fresh = mem_alloc(s->allocator, sizeof(*fresh))) == NULL) {
+			return NULL;
+		}
 
-	if ((old_raw = resize(s, size)) == NULL) {
+		atomic_init(&fresh->refs, 1);
+
+		/* dups only read s, another thread may be sharing it too */
+		if (atomic_compare_exchange_strong_explicit(&s->share, &sh, fresh,
+		                                            memory_order_acq_rel,
+		                                            memory_order_acquire)) {
+			sh = fresh;
+		} else {
+			mem_release(s->allocator, fresh, sizeof(*fresh));
+		}
+	}
+
+	if ((cpy = String_alloc(s->allocator, 1)) == NULL) {
 		return NULL;
 	}
 
-	/*
-	 * raw[len] is uninitialized because len == (strlen(raw) + 1), so
-	 *
-	 * if len == offset:
-	 *     means len bytes will be kept untouched.
-	 *
-	 * if len < offset:
-	 *     means len bytes will be kept untouched and (offset - len) bytes
-	 *     have to be zeroed.
-	 *
-	 * if len > offset:
-	 *     means that offset bytes will be kept untouched.
-	 */
-	if (s->len > offset) {
-		memmove(s->raw, old_raw, offset);
+	atomic_fetch_add_explicit(&sh->refs, 1, memory_order_relaxed);
+	cpy->raw = s->raw;
+	cpy->len = s->len;
+	cpy->size = s->size;
+	atomic_store_explicit(&cpy->share, sh, memory_order_relaxed);
+	cpy->hash = s->hash;
+	cpy->flags = s->flags & CACHED;
+	return cpy;
+}
+
+static int unshare(String s)
+{
+	struct share *sh = atomic_load_explicit(&s->share, memory_order_relaxed);
+	char *raw;
 
-	} else {
-		memmove(s->raw, old_raw, s->len);
+	if (atomic_load_explicit(&sh->refs, memory_order_acquire) > 1) {
+		if ((raw = mem_alloc(s->allocator, s->size)) == NULL) {
+			return -1;
+		}
+
+		memcpy(raw, s->raw, s->len);
 
-		if (s->len < offset) {
-			memset(s->raw + s->len, 0, offset - s->len);
+		if (release_share(s)) {
+			/* everybody else left in the meantime */
+			mem_release(s->allocator, s->raw, s->size);
 		}
+
+		s->raw = raw;
+		return 0;
+	}
+
+	release_share(s);
+	return 0;
+}
+
+static int release_share(String s)
+{
+	struct share *sh = atomic_load_explicit(&s->share, memory_order_relaxed);
+
+	atomic_store_explicit(&s->share, NULL, memory_order_relaxed);
+
+	if (atomic_fetch_sub_explicit(&sh->refs, 1, memory_order_acq_rel) == 1) {
+		mem_release(s->allocator, sh, sizeof(*sh));
+		return YES;
+	}
+
+	return NO;
+}
+
+static int reserve_tail(String s, size_t n, String_len *offset)
+{
+	if (string_prepare_write(s)) {
+		return -1;
+	}
+
+	*offset = used(s);
+
+	if (!fits(*offset, n)) {
+		return -1;
 	}
 
-	return old_raw;
+	/* a single resize, rounded up to a power of 2 by resize itself */
+	return string_reserve_at(s, *offset, n);
+}
+
+static void fill_gap(String s, String_len offset)
+{
+	if (s->len < offset) {
+		memset(s->raw + s->len, 0, offset - s->len);
+	}
 }
 
 #if !(_XOPEN_SOURCE >= 700 || _POSIX_C_SOURCE >= 200809L)
-static unsigned strnlen(const char *s, unsigned n)
+static String_len strnlen(const char *s, String_len n)
 {
-	unsigned i = 0;
+	String_len i = 0;
 
 	while (s[i] != '\0' && i < n) {
 		i++;
@@ -0,0 +1,246 @@
+/*
+ * File:    DStrings_arena.c
+ * Author:  Eduardo Miravalls Sierra          <edu.miravalls@hotmail.com>
+ *
+ * Date:    2014-08-30 09:47
+ */
+
+/*
+ * Dynamic C Strings library.
+ * Copyright (C) 2014 Eduardo Miravalls Sierra
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "DStrings.h"
+
+/**
+ * @brief alignment of every allocation, good enough for a struct string.
+ */
+#define ARENA_ALIGNMENT 16
+
+/**
+ * @brief default chunk size.
+ */
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+#define align_up(n) (((n) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+struct chunk {
+	struct chunk *next; /**< previously allocated chunk */
+	size_t size;        /**< usable bytes after the header */
+};
+
+/* keep the chunks' data aligned */
+#define CHUNK_HEADER align_up(sizeof(struct chunk))
+
+struct String_arena {
+	String_allocator allocator; /**< hooks Strings use to reach the arena */
+	struct chunk *chunks; /**< newest chunk first */
+	char *top;            /**< first free byte of the newest chunk */
+	char *end;            /**< end of the newest chunk */
+	char *last;           /**< last allocation, can be grown in place */
+	size_t chunk_size;    /**< minimum size of new chunks */
+};
+
+/**
+ * @brief adds a chunk to a that can hold at least n bytes.
+ *
+ * @param a arena.
+ * @param n minimum usable size.
+ *
+ * @return -1 if the chunk couldn't be allocated.
+ * @return 0 otherwise.
+ */
+static int add_chunk(String_arena a, size_t n);
+
+/**
+ * @brief allocates n bytes from arena.
+ *
+ * @param arena arena.
+ * @param n number of bytes.
+ *
+ * @return the allocated memory.
+ * @return NULL if a new chunk was needed and couldn't be allocated.
+ */
+static void *arena_alloc(void *arena, size_t n);
+
+/**
+ * @brief resizes p, previously allocated from arena, so it can hold n bytes.
+ * @details if p is the arena's last allocation and its chunk has room
+ * enough, p is extended in place. Otherwise new memory is allocated and
+ * upto old_size bytes are copied to it.
+ *
+ * @param arena arena.
+ * @param p memory allocated from arena.
+ * @param old_size p's size.
+ * @param n new size.
+ *
+ * @return the resized memory.
+ * @return NULL on error, p is left untouched.
+ */
+static void *arena_resize(void *arena, void *p, size_t old_size, size_t n);
+
+/**
+ * @brief gives p back to arena.
+ * @details memory is only reused if p is the arena's last allocation,
+ * anything else is reclaimed by String_arena_reset.
+ *
+ * @param arena arena.
+ * @param p memory allocated from arena.
+ * @param size p's size.
+ */
+static void arena_release(void *arena, void *p, size_t size);
+
+String_arena String_arena_new(unsigned chunk_size)
+{
+	String_arena a;
+
+	if ((a = malloc(sizeof(*a))) == NULL) {
+		return NULL;
+	}
+
+	a->allocator.alloc = arena_alloc;
+	a->allocator.resize = arena_resize;
+	a->allocator.release = arena_release;
+	a->allocator.ctx = a;
+	a->chunks = NULL;
+	a->top = a->end = a->last = NULL;
+	a->chunk_size = chunk_size ? align_up(chunk_size) : ARENA_CHUNK_SIZE;
+
+	if (add_chunk(a, a->chunk_size)) {
+		free(a);
+		return NULL;
+	}
+
+	return a;
+}
+
+void String_arena_reset(String_arena a)
+{
+	struct chunk *c;
+
+	assert(a != NULL);
+
+	/* keep the newest chunk, it's the one more likely to be big enough */
+	while ((c = a->chunks->next) != NULL) {
+		a->chunks->next = c->next;
+		free(c);
+	}
+
+	a->top = (char *)a->chunks + CHUNK_HEADER;
+	a->last = NULL;
+}
+
+void String_arena_free(String_arena *a)
+{
+	struct chunk *c;
+
+	assert(a != NULL);
+
+	if (*a != NULL) {
+		while ((c = (*a)->chunks) != NULL) {
+			(*a)->chunks = c->next;
+			free(c);
+		}
+
+		free(*a);
+		*a = NULL;
+	}
+}
+
+const String_allocator *String_arena_allocator(String_arena a)
+{
+	return a ? &a->allocator : NULL;
+}
+
+static void *arena_alloc(void *arena, size_t n)
+{
+	String_arena a = arena;
+	char *p;
+
+	assert(a != NULL);
+
+	n = align_up(n);
+
+	if ((size_t)(a->end - a->top) < n && add_chunk(a, n)) {
+		return NULL;
+	}
+
+	p = a->top;
+	a->top += n;
+	a->last = p;
+	return p;
+}
+
+static void *arena_resize(void *arena, void *p, size_t old_size, size_t n)
+{
+	String_arena a = arena;
+	void *q;
+
+	assert(a != NULL);
+
+	if (p == NULL) {
+		return arena_alloc(a, n);
+	}
+
+	if (p == a->last && (size_t)(a->end - a->last) >= align_up(n)) {
+		a->top = a->last + align_up(n);
+		return p;
+	}
+
+	if ((q = arena_alloc(a, n)) == NULL) {
+		return NULL;
+	}
+
+	memcpy(q, p, old_size < n ? old_size : n);
+	return q;
+}
+
+static void arena_release(void *arena, void *p, size_t size)
+{
+	String_arena a = arena;
+
+	assert(a != NULL);
+	(void)size;
+
+	if (p != NULL && p == a->last) {
+		a->top = a->last;
+		a->last = NULL;
+	}
+}
+
+static int add_chunk(String_arena a, size_t n)
+{
+	struct chunk *c;
+
+	if (n < a->chunk_size) {
+		n = a->chunk_size;
+	}
+
+	if ((c = malloc(CHUNK_HEADER + n)) == NULL) {
+		return -1;
+	}
+
+	c->next = a->chunks;
+	c->size = n;
+	a->chunks = c;
+	a->top = (char *)c + CHUNK_HEADER;
+	a->end = a->top + n;
+	a->last = NULL;
+	return 0;
+}
@@ -0,0 +1,1535 @@
+/*
+ * File:    DStrings_bench.c
+ * Author:  Eduardo Miravalls Sierra          <edu.miravalls@hotmail.com>
+ *
+ * Date:    2014-08-30 16:45
+ */
+
+/*
+ * Dynamic C Strings library.
+ * Copyright (C) 2014 Eduardo Miravalls Sierra
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "DStrings.h"
+
+/**
+ * @brief number of records each benchmark builds.
+ */
+#define RECORDS 200
+
+/**
+ * @brief number of fragments appended to each record.
+ */
+#define FRAGMENTS 20000
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char *name, double elapsed, unsigned long ops)
+{
+	printf("%-40s %8.2f ns/op\n", name, elapsed / ops);
+}
+
+/*
+ * Copy of the growth engine the library used to have: every resize
+ * allocates a brand new buffer and memmoves the old contents into it.
+ */
+struct copying_string {
+	char *raw;
+	unsigned len;
+	unsigned size;
+};
+
+static unsigned next_power_of_2(unsigned num)
+{
+	num--;
+	num |= num >> 1;
+	num |= num >> 2;
+	num |= num >> 4;
+	num |= num >> 8;
+	num |= num >> 16;
+	num++;
+	return num += (num == 0);
+}
+
+static int copying_ncat(struct copying_string *s, const void *src, unsigned n)
+{
+	unsigned offset = s->len ? s->len - 1 : 0;
+	char *old_raw;
+
+	if (s->size < offset + n + 1) {
+		unsigned size = next_power_of_2(offset + n + 1);
+
+		old_raw = s->raw;
+
+		if ((s->raw = malloc(size)) == NULL) {
+			s->raw = old_raw;
+			return -1;
+		}
+
+		memmove(s->raw, old_raw, offset);
+		free(old_raw);
+		s->size = size;
+	}
+
+	memmove(s->raw + offset, src, n);
+	s->len = offset + n + 1;
+	s->raw[offset + n] = '\0';
+	return 0;
+}
+
+void bench_append(void)
+{
+	const char *fragment = "key=value ";
+	unsigned n = strlen(fragment);
+	unsigned i, j;
+	double start;
+
+	start = now();
+
+	for (i = 0; i < RECORDS; i++) {
+		struct copying_string s = {NULL, 0, 0};
+
+		for (j = 0; j < FRAGMENTS; j++) {
+			copying_ncat(&s, fragment, n);
+		}
+
+		free(s.raw);
+	}
+
+	report("append (malloc + memmove growth)", now() - start,
+	       (unsigned long)RECORDS * FRAGMENTS);
+
+	start = now();
+
+	for (i = 0; i < RECORDS; i++) {
+		String s = String_new_empty();
+
+		for (j = 0; j < FRAGMENTS; j++) {
+			String_ncat(s, fragment, n);
+		}
+
+		String_free(&s);
+	}
+
+	report("append (String_ncat)", now() - start,
+	       (unsigned long)RECORDS * FRAGMENTS);
+}
+
+/*
+ * Copy of the formatting the library used to have: vsnprintf straight
+ * into the buffer and, if it didn't fit, grow and vsnprintf again.
+ */
+static int vsnprintf_format_at(struct copying_string *s, unsigned offset,
+                               const char *fmt, ...)
+{
+	va_list vargs;
+	unsigned written;
+	char *raw;
+
+	if (offset >= s->size) {
+		if ((raw = realloc(s->raw, next_power_of_2(offset + 1))) == NULL) {
+			return -1;
+		}
+
+		s->raw = raw;
+		s->size = next_power_of_2(offset + 1);
+	}
+
+	va_start(vargs, fmt);
+	written = vsnprintf(s->raw + offset, s->size - offset, fmt, vargs) + 1;
+	va_end(vargs);
+
+	if (offset + written > s->size) {
+		if ((raw = realloc(s->raw, next_power_of_2(offset + written))) == NULL) {
+			return -1;
+		}
+
+		s->raw = raw;
+		s->size = next_power_of_2(offset + written);
+		va_start(vargs, fmt);
+		written = vsnprintf(s->raw + offset, s->size - offset, fmt, vargs) + 1;
+		va_end(vargs);
+	}
+
+	s->len = offset + written;
+	return 0;
+}
+
+#define METRIC "%s{host=\"%s\",code=%d} %u %lld\n"
+#define LINES 2000
+
+void bench_format(void)
+{
+	const char *hosts[] = {"web-01", "web-02", "db-primary", "cache"};
+	unsigned i, j;
+	double start;
+
+	start = now();
+
+	for (i = 0; i < RECORDS; i++) {
+		struct copying_string s = {NULL, 0, 0};
+
+		for (j = 0; j < LINES; j++) {
+			vsnprintf_format_at(&s, s.len ? s.len - 1 : 0, METRIC,
+			                    "http_requests_total", hosts[j & 3],
+			                    200 + j % 5, j * 7919u,
+			                    1409390000000LL + j);
+		}
+
+		free(s.raw);
+	}
+
+	report("metric lines (two pass vsnprintf)", now() - start,
+	       (unsigned long)RECORDS * LINES);
+
+	start = now();
+
+	for (i = 0; i < RECORDS; i++) {
+		String s = String_new_empty();
+
+		for (j = 0; j < LINES; j++) {
+			String_format_at(s, String_length(s) - 1, METRIC,
+			                 "http_requests_total", hosts[j & 3],
+			                 200 + j % 5, j * 7919u,
+			                 1409390000000LL + j);
+		}
+
+		String_free(&s);
+	}
+
+	report("metric lines (String_format_at)", now() - start,
+	       (unsigned long)RECORDS * LINES);
+}
+
+#define NUMBERS 20000
+
+void bench_append_int(void)
+{
+	unsigned i, j;
+	double start;
+
+	start = now();
+
+	for (i = 0; i < RECORDS; i++) {
+		String s = String_new_empty();
+
+		for (j = 0; j < NUMBERS; j++) {
+			String_format_at(s, String_length(s) - 1, "%lld,",
+			                 (long long)j * 1000003 - 5000000);
+		}
+
+		String_free(&s);
+	}
+
+	report("integers (String_format_at)", now() - start,
+	       (unsigned long)RECORDS * NUMBERS);
+
+	start = now();
+
+	for (i = 0; i < RECORDS; i++) {
+		String s = String_new_empty();
+
+		for (j = 0; j < NUMBERS; j++) {
+			String_append_i64(s, (long long)j * 1000003 - 5000000);
+			String_append_char(s, ',');
+		}
+
+		String_free(&s);
+	}
+
+	report("integers (String_append_i64)", now() - start,
+	       (unsigned long)RECORDS * NUMBERS);
+}
+
+#define PIECES 8
+
+void bench_catv(void)
+{
+	const char *pieces[PIECES] = {
+		"GET ", "/api/v1/users/", "1234", " HTTP/1.1\r\n",
+		"Host: ", "example.com", "\r\n", "\r\n"
+	};
+	struct iovec iov[PIECES];
+	unsigned i, j, k;
+	double start;
+
+	for (k = 0; k < PIECES; k++) {
+		iov[k].iov_base = (void *)pieces[k];
+		iov[k].iov_len = strlen(pieces[k]);
+	}
+
+	start = now();
+
+	for (i = 0; i < RECORDS; i++) {
+		for (j = 0; j < FRAGMENTS / PIECES; j++) {
+			String s = String_new_empty();
+
+			for (k = 0; k < PIECES; k++) {
+				String_ncat(s, iov[k].iov_base, iov[k].iov_len);
+			}
+
+			String_free(&s);
+		}
+	}
+
+	report("request (String_ncat per piece)", now() - start,
+	       (unsigned long)RECORDS * (FRAGMENTS / PIECES));
+
+	start = now();
+
+	for (i = 0; i < RECORDS; i++) {
+		for (j = 0; j < FRAGMENTS / PIECES; j++) {
+			String s = String_new_empty();
+
+			String_catv(s, iov, PIECES);
+			String_free(&s);
+		}
+	}
+
+	report("request (String_catv)", now() - start,
+	       (unsigned long)RECORDS * (FRAGMENTS / PIECES));
+}
+
+/*
+ * Each policy runs in its own process, so its peak RSS isn't hidden by
+ * the policies that ran before.
+ */
+#define BUFFERS 24
+#define CHUNK 64
+
+static void grow_buffers(String_growth g)
+{
+	static const char chunk[CHUNK] = "0123456789abcdef0123456789abcdef"
+	                                 "0123456789abcdef0123456789abcde";
+	String s[BUFFERS];
+	unsigned long ops = 0, used = 0, allocated = 0;
+	unsigned i, j, target;
+	struct rusage ru;
+	double start;
+
+	start = now();
+
+	for (i = 0; i < BUFFERS; i++) {
+		s[i] = String_new_empty();
+		String_set_growth_of(s[i], g);
+	}
+
+	/* interleaved appends, upto 1.25 MiB .. 7 MiB per buffer */
+	for (j = 0; ; j++) {
+		unsigned active = 0;
+
+		for (i = 0; i < BUFFERS; i++) {
+			target = (5 + i) * 256 * 1024;
+
+			if (String_length(s[i]) < target) {
+				String_ncat(s[i], chunk, CHUNK);
+				active++;
+				ops++;
+			}
+		}
+
+		if (active == 0) {
+			break;
+		}
+	}
+
+	for (i = 0; i < BUFFERS; i++) {
+		used += String_length(s[i]);
+		allocated += String_size(s[i]);
+	}
+
+	getrusage(RUSAGE_SELF, &ru);
+	printf("%8.2f ns/op %8ld KiB peak RSS %6.1f%% slack\n",
+	       (now() - start) / ops, ru.ru_maxrss,
+	       100.0 * (allocated - used) / used);
+
+	for (i = 0; i < BUFFERS; i++) {
+		String_free(&s[i]);
+	}
+}
+
+void bench_growth(void)
+{
+	struct {
+		const char *name;
+		String_growth g;
+	} policies[] = {
+		{"growth (power of 2)", String_growth_pow2},
+		{"growth (1.5x)", String_growth_1_5x},
+		{"growth (pages above 64 KiB)", String_growth_pages},
+		{"growth (hugepages above 2 MiB)", String_growth_hugepages},
+	};
+	unsigned i;
+	pid_t pid;
+
+	for (i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+		printf("%-40s ", policies[i].name);
+		fflush(stdout);
+
+		if ((pid = fork()) == 0) {
+			grow_buffers(policies[i].g);
+			exit(0);
+		}
+
+		waitpid(pid, NULL, 0);
+	}
+}
+
+#define HUGE_SIZE (256u << 20)
+#define HUGE_CHUNK (64u << 10)
+
+static void grow_huge(const String_allocator *a)
+{
+	static char chunk[HUGE_CHUNK];
+	unsigned long ops = 0;
+	struct rusage ru;
+	double start;
+	String s;
+
+	start = now();
+	s = String_new_with(a, NULL, 0);
+
+	while (String_length(s) < HUGE_SIZE) {
+		String_ncat(s, chunk, HUGE_CHUNK);
+		ops++;
+	}
+
+	String_free(&s);
+	getrusage(RUSAGE_SELF, &ru);
+	printf("%8.2f us/op %8ld KiB peak RSS\n", (now() - start) / ops / 1e3,
+	       ru.ru_maxrss);
+}
+
+void bench_mmap(void)
+{
+	struct {
+		const char *name;
+		const String_allocator *a;
+	} allocators[] = {
+		{"256 MiB in 64 KiB appends (malloc)", NULL},
+		{"256 MiB in 64 KiB appends (mmap)", String_mmap_allocator()},
+	};
+	unsigned i;
+	pid_t pid;
+
+	for (i = 0; i < sizeof(allocators) / sizeof(allocators[0]); i++) {
+		printf("%-40s ", allocators[i].name);
+		fflush(stdout);
+
+		if ((pid = fork()) == 0) {
+			grow_huge(allocators[i].a);
+			exit(0);
+		}
+
+		waitpid(pid, NULL, 0);
+	}
+}
+
+#define IO_SIZE (8u << 20)
+#define IO_LINE "2014-08-30T16:45:00Z GET /index.html 200 1043\n"
+
+static void bench_io_read(const char *path)
+{
+	char chunk[4096];
+	unsigned i, kib = IO_SIZE / 1024;
+	double start;
+	size_t n;
+	FILE *f;
+
+	start = now();
+
+	for (i = 0; i < 4; i++) {
+		char *all = malloc(IO_SIZE + 1);
+
+		all[0] = '\0';
+		f = fopen(path, "r");
+
+		while ((n = fread(chunk, 1, sizeof(chunk) - 1, f)) > 0) {
+			chunk[n] = '\0';
+			strcat(all, chunk);
+		}
+
+		fclose(f);
+		free(all);
+	}
+
+	report("read file (fread + strcat, per KiB)", now() - start, 4ul * kib);
+
+	start = now();
+
+	for (i = 0; i < 4; i++) {
+		String s = String_new_empty();
+
+		f = fopen(path, "r");
+
+		while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+			String_ncat(s, chunk, n);
+		}
+
+		fclose(f);
+		String_free(&s);
+	}
+
+	report("read file (fread + String_ncat, per KiB)", now() - start, 4ul * kib);
+
+	start = now();
+
+	for (i = 0; i < 4; i++) {
+		String s = String_new_empty();
+
+		String_read_file(s, path);
+		String_free(&s);
+	}
+
+	report("read file (String_read_file, per KiB)", now() - start, 4ul * kib);
+}
+
+static void bench_io_lines(const char *path)
+{
+	unsigned long lines = 0;
+	char line[256];
+	double start;
+	String s;
+	FILE *f;
+
+	start = now();
+	s = String_new_empty();
+	f = fopen(path, "r");
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		String_cpy_str(s, line);
+		lines++;
+	}
+
+	fclose(f);
+	String_free(&s);
+	report("read lines (fgets + String_cpy_str)", now() - start, lines);
+
+	lines = 0;
+	start = now();
+	s = String_new_empty();
+	f = fopen(path, "r");
+
+	while (String_getline(s, f) == 0) {
+		lines++;
+	}
+
+	fclose(f);
+	String_free(&s);
+	report("read lines (String_getline)", now() - start, lines);
+}
+
+void bench_io(void)
+{
+	char path[] = "/tmp/DStrings_bench_XXXXXX";
+	String s = String_new_empty();
+	int fd;
+
+	if ((fd = mkstemp(path)) < 0) {
+		return;
+	}
+
+	while (String_length(s) < IO_SIZE - sizeof(IO_LINE)) {
+		String_cat_str(s, IO_LINE);
+	}
+
+	String_write_fd(s, fd);
+	close(fd);
+	String_free(&s);
+
+	bench_io_read(path);
+	bench_io_lines(path);
+	unlink(path);
+}
+
+#define SEARCH_SIZE (1u << 20)
+
+void bench_search(void)
+{
+	static const char *needles[] = {
+		"HTTP/1.1\" 503",
+		"GET /index.html HTTP/1.1\" 200 1043 \"-\" \"Mozilla/5.0 (X11; Linux x86_64)"
+		" AppleWebKit/537.36 (KHTML, like Gecko)\" 503",
+	};
+	String s = String_new_empty();
+	unsigned i, j, rounds = 200;
+	/* volatile, or strstr and strchr get hoisted out of the loops */
+	volatile unsigned long found = 0;
+	const char *p;
+	char name[64];
+	double start;
+
+	while (String_length(s) < SEARCH_SIZE) {
+		String_cat_str(s, "10.0.0.1 - - [30/Aug/2014:16:45:00] \"GET /index.html HTTP/1.1\""
+		                  " 200 1043 \"-\" \"Mozilla/5.0 (X11; Linux x86_64)"
+		                  " AppleWebKit/537.36 (KHTML, like Gecko)\" 200\n");
+	}
+
+	/* the only match is at the very end */
+	String_cat_str(s, "10.0.0.1 - - [30/Aug/2014:16:45:00] ");
+	String_cat_str(s, needles[1]);
+
+	for (j = 0; j < 2; j++) {
+		start = now();
+
+		for (i = 0; i < rounds; i++) {
+			found += strstr(String_raw(s), needles[j]) != NULL;
+		}
+
+		sprintf(name, "find %u B needle (strstr, per KiB)", (unsigned)strlen(needles[j]));
+		report(name, now() - start, rounds * (SEARCH_SIZE / 1024ul));
+
+		start = now();
+
+		for (i = 0; i < rounds; i++) {
+			found += String_find_str(s, needles[j]) != STRING_NOT_FOUND;
+		}
+
+		sprintf(name, "find %u B needle (String_find, per KiB)", (unsigned)strlen(needles[j]));
+		report(name, now() - start, rounds * (SEARCH_SIZE / 1024ul));
+	}
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		for (p = String_raw(s); (p = strchr(p, '\n')) != NULL; p++) {
+			found++;
+		}
+	}
+
+	report("count lines (strchr, per KiB)", now() - start, rounds * (SEARCH_SIZE / 1024ul));
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		found += String_count(s, "\n", 1);
+	}
+
+	report("count lines (String_count, per KiB)", now() - start, rounds * (SEARCH_SIZE / 1024ul));
+
+	if (found == 0) {
+		printf("unreachable\n");
+	}
+
+	String_free(&s);
+}
+
+static void bench_patterns_set(const char *name, String text, String *patterns,
+                               unsigned count)
+{
+	static String_match matches[1024];
+	String_patterns p = String_patterns_new(patterns, count);
+	unsigned i, j, rounds = 20;
+	volatile unsigned long found = 0;
+	char line[80];
+	const char *q;
+	double start;
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		for (j = 0; j < count; j++) {
+			for (q = String_raw(text); (q = strstr(q, String_raw(patterns[j]))) != NULL; q++) {
+				found++;
+			}
+		}
+	}
+
+	sprintf(line, "%s (strstr per pattern, per KiB)", name);
+	report(line, now() - start, rounds * (String_length(text) / 1024ul));
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		found += String_patterns_match(p, String_view(text), matches, 1024);
+	}
+
+	sprintf(line, "%s (String_patterns_match, per KiB)", name);
+	report(line, now() - start, rounds * (String_length(text) / 1024ul));
+
+	String_patterns_free(&p);
+}
+
+void bench_patterns(void)
+{
+	static const char *words[] = {
+		"error", "timeout", "denied", "panic", "refused", "overflow",
+		"segfault", "corrupt",
+	};
+	String text = String_new_empty(), patterns[200];
+	unsigned i = 0;
+
+	while (String_length(text) < (1u << 20)) {
+		String_format_at(text, String_length(text) - 1,
+		                 "10.0.0.%u - - [30/Aug/2014:16:45:00] \"GET /item/%u HTTP/1.1\" "
+		                 "200 %u \"-\" \"Mozilla/5.0 (X11; Linux x86_64)\"%s\n",
+		                 i % 256, i * 7919 % 100000, i * 31 % 5000,
+		                 i % 100 ? "" : " upstream timeout");
+		i++;
+	}
+
+	for (i = 0; i < 200; i++) {
+		patterns[i] = i < 8 ? String_new_str(words[i]) : String_new_empty();
+
+		if (i >= 8) {
+			String_format_at(patterns[i], 0, "keyword-%u", i);
+		}
+	}
+
+	bench_patterns_set("8 keywords", text, patterns, 8);
+	bench_patterns_set("200 keywords", text, patterns, 200);
+
+	for (i = 0; i < 200; i++) {
+		String_free(&patterns[i]);
+	}
+
+	String_free(&text);
+}
+
+/*
+ * What replacing took before String_replace_all: build a new String out
+ * of slices of the old one.
+ */
+static String slice_and_cat_replace(String s, const char *needle, const char *rep)
+{
+	String out = String_new_empty(), slice;
+	unsigned n = strlen(needle), from = 0;
+	const char *p;
+
+	while ((p = strstr(String_raw(s) + from, needle)) != NULL) {
+		if (p > String_raw(s) + from) {
+			slice = String_dup_slice(s, from, p - String_raw(s) - 1);
+			String_cat(out, slice);
+			String_free(&slice);
+		}
+
+		String_cat_str(out, rep);
+		from = p - String_raw(s) + n;
+	}
+
+	slice = String_dup_slice(s, from, String_length(s));
+	String_cat(out, slice);
+	String_free(&slice);
+	return out;
+}
+
+void bench_replace(void)
+{
+	static const struct {
+		const char *name, *needle, *rep;
+	} cases[] = {
+		{"shorter", "Mozilla/5.0 (X11; Linux x86_64)", "-"},
+		{"same length", "password=hunter2", "password=*******"},
+		{"longer", "GET", "METHOD=GET"},
+	};
+	String text = String_new_empty(), s;
+	unsigned i, j, rounds = 20;
+	char name[64];
+	double start;
+
+	while (String_length(text) < (1u << 20)) {
+		String_cat_str(text, "10.0.0.1 - - [30/Aug/2014:16:45:00] \"GET /login?user=bob&"
+		                     "password=hunter2 HTTP/1.1\" 200 1043 \"-\" "
+		                     "\"Mozilla/5.0 (X11; Linux x86_64)\"\n");
+	}
+
+	for (j = 0; j < sizeof(cases) / sizeof(cases[0]); j++) {
+		start = now();
+
+		for (i = 0; i < rounds; i++) {
+			s = slice_and_cat_replace(text, cases[j].needle, cases[j].rep);
+			String_free(&s);
+		}
+
+		sprintf(name, "replace %s (dup_slice + cat, per KiB)", cases[j].name);
+		report(name, now() - start, rounds * (String_length(text) / 1024ul));
+
+		start = now();
+
+		for (i = 0; i < rounds; i++) {
+			s = String_dup(text);
+			String_replace_all_str(s, cases[j].needle, cases[j].rep);
+			String_free(&s);
+		}
+
+		sprintf(name, "replace %s (String_replace_all, per KiB)", cases[j].name);
+		report(name, now() - start, rounds * (String_length(text) / 1024ul));
+	}
+
+	String_free(&text);
+}
+
+void bench_split(void)
+{
+	static String_span spans[1 << 18];
+	String text = String_new_empty(), field;
+	unsigned i, rounds = 20;
+	volatile unsigned long fields = 0;
+	String_splitter it;
+	StringView token;
+	unsigned from;
+	const char *p;
+	double start;
+
+	while (String_length(text) < (1u << 20)) {
+		String_cat_str(text, "2014-08-30,16:45:00,web-01,GET,/index.html,200,1043,0.012,"
+		                     "Mozilla/5.0,10.0.0.1\n");
+	}
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		for (from = 0; (p = strchr(String_raw(text) + from, ',')) != NULL; from = p - String_raw(text) + 1) {
+			field = String_dup_slice(text, from, p - String_raw(text) - 1);
+			fields += String_length(field);
+			String_free(&field);
+		}
+	}
+
+	report("split csv (strchr + dup_slice, per KiB)", now() - start,
+	       rounds * (String_length(text) / 1024ul));
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		for (String_split(&it, text, ','); String_splitter_next(&it, &token);) {
+			fields += token.len;
+		}
+	}
+
+	report("split csv (String_split, per KiB)", now() - start,
+	       rounds * (String_length(text) / 1024ul));
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		fields += String_split_spans(text, ',', spans, sizeof(spans) / sizeof(spans[0]));
+	}
+
+	report("split csv (String_split_spans, per KiB)", now() - start,
+	       rounds * (String_length(text) / 1024ul));
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		char *copy = strdup(String_raw(text)), *save;
+
+		for (p = strtok_r(copy, " ,\n", &save); p != NULL; p = strtok_r(NULL, " ,\n", &save)) {
+			fields++;
+		}
+
+		free(copy);
+	}
+
+	report("tokenize (strdup + strtok_r, per KiB)", now() - start,
+	       rounds * (String_length(text) / 1024ul));
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		for (String_tokenize(&it, text, " ,\n"); String_splitter_next(&it, &token);) {
+			fields += token.len;
+		}
+	}
+
+	report("tokenize (String_tokenize, per KiB)", now() - start,
+	       rounds * (String_length(text) / 1024ul));
+
+	String_free(&text);
+}
+
+/* byte at a time, the usual hand written validator */
+static int branchy_utf8_validate(const unsigned char *p, size_t n)
+{
+	size_t i = 0, k;
+
+	while (i < n) {
+		if (p[i] < 0x80) {
+			i++;
+			continue;
+		}
+
+		k = p[i] >= 0xf0 ? 3 : p[i] >= 0xe0 ? 2 : 1;
+
+		if (p[i] < 0xc2 || p[i] > 0xf4 || n - i <= k) {
+			return 0;
+		}
+
+		if ((p[i] == 0xe0 && p[i + 1] < 0xa0) || (p[i] == 0xed && p[i + 1] > 0x9f) ||
+		    (p[i] == 0xf0 && p[i + 1] < 0x90) || (p[i] == 0xf4 && p[i + 1] > 0x8f)) {
+			return 0;
+		}
+
+		for (i++; k > 0; k--, i++) {
+			if ((p[i] & 0xc0) != 0x80) {
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+void bench_utf8(void)
+{
+	static uint16_t units[1 << 20];
+	String ascii = String_new_empty(), mixed = String_new_empty(), out;
+	unsigned i, rounds = 50;
+	volatile unsigned long found = 0;
+	double start;
+
+	while (String_length(ascii) < (1u << 20)) {
+		String_cat_str(ascii, "GET /index.html HTTP/1.1 200 1043 Mozilla/5.0\n");
+		String_cat_str(mixed, "El ni\xc3\xb1o comi\xc3\xb3 \xe2\x82\xac 5, "
+		                      "\xe6\x9d\xb1\xe4\xba\xac \xf0\x9f\x98\x80\n");
+	}
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		found += branchy_utf8_validate((const unsigned char *)String_raw(mixed),
+		                               String_length(mixed) - 1);
+	}
+
+	report("validate mixed (byte at a time, per KiB)", now() - start,
+	       rounds * (String_length(mixed) / 1024ul));
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		found += StringView_utf8_validate(String_view(mixed));
+	}
+
+	report("validate mixed (StringView_utf8_validate, per KiB)", now() - start,
+	       rounds * (String_length(mixed) / 1024ul));
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		found += branchy_utf8_validate((const unsigned char *)String_raw(ascii),
+		                               String_length(ascii) - 1);
+	}
+
+	report("validate ASCII (byte at a time, per KiB)", now() - start,
+	       rounds * (String_length(ascii) / 1024ul));
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		found += StringView_utf8_validate(String_view(ascii));
+	}
+
+	report("validate ASCII (StringView_utf8_validate, per KiB)", now() - start,
+	       rounds * (String_length(ascii) / 1024ul));
+
+	/* the first call validates, the rest read the cached answer */
+	found += String_utf8_validate(mixed);
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		found += String_utf8_validate(mixed);
+	}
+
+	report("validate mixed (String_utf8_validate, cached, per call)", now() - start, rounds);
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		found += String_utf8_length(mixed);
+	}
+
+	report("codepoints mixed (String_utf8_length, per KiB)", now() - start,
+	       rounds * (String_length(mixed) / 1024ul));
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		found += String_utf8_to_utf16(mixed, units, sizeof(units) / sizeof(units[0]));
+	}
+
+	report("to UTF-16 mixed (String_utf8_to_utf16, per KiB)", now() - start,
+	       rounds * (String_length(mixed) / 1024ul));
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		found += String_utf8_to_utf16(ascii, units, sizeof(units) / sizeof(units[0]));
+	}
+
+	report("to UTF-16 ASCII (String_utf8_to_utf16, per KiB)", now() - start,
+	       rounds * (String_length(ascii) / 1024ul));
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		out = String_new_empty();
+		String_cat_utf16(out, units, String_utf8_to_utf16(ascii, NULL, 0));
+		found += String_length(out);
+		String_free(&out);
+	}
+
+	report("from UTF-16 ASCII (String_cat_utf16, per KiB)", now() - start,
+	       rounds * (String_length(ascii) / 1024ul));
+
+	String_free(&ascii);
+	String_free(&mixed);
+}
+
+static void bench_case_size(const char *size, unsigned len, unsigned rounds)
+{
+	String base = String_new_empty(), s, t, lower = String_new_empty();
+	volatile unsigned long found = 0;
+	char name[80];
+	unsigned i, j;
+	double start;
+
+	while (String_length(base) <= len) {
+		String_cat_str(base, "Content-Type: Text/HTML; Charset=UTF-8 ");
+	}
+
+	s = String_new_view(String_view_slice(base, 0, len - 1));
+	t = String_new_view(String_view(s));
+	String_cpy_lower(lower, String_view(s));
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		char *p = String_raw(t);
+
+		for (j = 0; j < len; j++) {
+			p[j] = tolower((unsigned char)p[j]);
+		}
+
+		found += p[0];
+	}
+
+	snprintf(name, sizeof(name), "tolower %s (byte at a time)", size);
+	report(name, now() - start, rounds);
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		String_tolower(t);
+		found += String_raw(t)[0];
+	}
+
+	snprintf(name, sizeof(name), "tolower %s (String_tolower)", size);
+	report(name, now() - start, rounds);
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		found += strncasecmp(String_raw(s), String_raw(lower), len);
+	}
+
+	snprintf(name, sizeof(name), "casecmp %s (strncasecmp)", size);
+	report(name, now() - start, rounds);
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		found += String_casecmp(s, lower);
+	}
+
+	snprintf(name, sizeof(name), "casecmp %s (String_casecmp)", size);
+	report(name, now() - start, rounds);
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		found += String_case_hash(s);
+	}
+
+	snprintf(name, sizeof(name), "case hash %s (String_case_hash)", size);
+	report(name, now() - start, rounds);
+
+	/* all whitespace but the middle char */
+	memset(String_raw(t), ' ', len);
+	String_raw(t)[len / 2] = 'x';
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		found += StringView_trim(String_view(t)).len;
+	}
+
+	snprintf(name, sizeof(name), "trim %s of spaces (StringView_trim)", size);
+	report(name, now() - start, rounds);
+
+	String_free(&base);
+	String_free(&s);
+	String_free(&t);
+	String_free(&lower);
+}
+
+void bench_case(void)
+{
+	bench_case_size("16 B", 16, 5000000);
+	bench_case_size("64 KiB", 64 * 1024, 5000);
+}
+
+/* what callers did before: encode to a temporary buffer, then copy it */
+static size_t buffer_base64(const unsigned char *p, size_t n, char *out)
+{
+	static const char digits[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	size_t i, o = 0;
+
+	for (i = 0; i + 3 <= n; i += 3) {
+		out[o++] = digits[p[i] >> 2];
+		out[o++] = digits[(p[i] & 3) << 4 | p[i + 1] >> 4];
+		out[o++] = digits[(p[i + 1] & 15) << 2 | p[i + 2] >> 6];
+		out[o++] = digits[p[i + 2] & 63];
+	}
+
+	if (i < n) {
+		out[o++] = digits[p[i] >> 2];
+		out[o++] = digits[(p[i] & 3) << 4 | (i + 1 < n ? p[i + 1] >> 4 : 0)];
+		out[o++] = i + 1 < n ? digits[(p[i + 1] & 15) << 2] : '=';
+		out[o++] = '=';
+	}
+
+	return o;
+}
+
+static size_t buffer_json(const unsigned char *p, size_t n, char *out)
+{
+	size_t i, o = 0;
+
+	for (i = 0; i < n; i++) {
+		if (p[i] == '"' || p[i] == '\\') {
+			out[o++] = '\\';
+			out[o++] = p[i];
+		} else if (p[i] < 0x20) {
+			o += sprintf(out + o, "\\u%04x", p[i]);
+		} else {
+			out[o++] = p[i];
+		}
+	}
+
+	return o;
+}
+
+static void bench_codec_size(const char *size, unsigned len, unsigned rounds)
+{
+	String d = String_new_empty(), e = String_new_empty();
+	volatile unsigned long found = 0;
+	unsigned char *bytes = malloc(len);
+	char *tmp = malloc(6 * len + 1), name[80];
+	const char *text = "{\"user\": \"jdoe\", \"note\": \"ok\"}\n";
+	unsigned i, j;
+	double start;
+	size_t m;
+
+	for (i = 0; i < len; i++) {
+		bytes[i] = i * 2654435761u >> 24;
+	}
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		m = buffer_base64(bytes, len, tmp);
+		String_ncpy(d, tmp, m);
+		found += String_length(d);
+	}
+
+	snprintf(name, sizeof(name), "base64 encode %s (buffer + String_ncpy)", size);
+	report(name, now() - start, rounds);
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		String_base64_encode(d, bytes, len);
+		found += String_length(d);
+	}
+
+	snprintf(name, sizeof(name), "base64 encode %s (String_base64_encode)", size);
+	report(name, now() - start, rounds);
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		String_base64_decode(e, String_raw(d), String_length(d) - 1);
+		found += String_length(e);
+	}
+
+	snprintf(name, sizeof(name), "base64 decode %s (String_base64_decode)", size);
+	report(name, now() - start, rounds);
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		for (j = 0; j < len; j++) {
+			tmp[2 * j] = "0123456789abcdef"[bytes[j] >> 4];
+			tmp[2 * j + 1] = "0123456789abcdef"[bytes[j] & 15];
+		}
+
+		String_ncpy(d, tmp, 2 * len);
+		found += String_length(d);
+	}
+
+	snprintf(name, sizeof(name), "hex encode %s (buffer + String_ncpy)", size);
+	report(name, now() - start, rounds);
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		String_hex_encode(d, bytes, len);
+		found += String_length(d);
+	}
+
+	snprintf(name, sizeof(name), "hex encode %s (String_hex_encode)", size);
+	report(name, now() - start, rounds);
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		String_hex_decode(e, String_raw(d), String_length(d) - 1);
+		found += String_length(e);
+	}
+
+	snprintf(name, sizeof(name), "hex decode %s (String_hex_decode)", size);
+	report(name, now() - start, rounds);
+
+	/* JSON documents: a few quotes and a newline every 32 chars */
+	for (i = 0; i < len; i++) {
+		bytes[i] = text[i % 32];
+	}
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		m = buffer_json(bytes, len, tmp);
+		String_ncpy(d, tmp, m);
+		found += String_length(d);
+	}
+
+	snprintf(name, sizeof(name), "json escape %s (buffer + String_ncpy)", size);
+	report(name, now() - start, rounds);
+
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		String_json_escape(d, bytes, len);
+		found += String_length(d);
+	}
+
+	snprintf(name, sizeof(name), "json escape %s (String_json_escape)", size);
+	report(name, now() - start, rounds);
+
+	/* and text with nothing to escape */
+	memset(bytes, 'x', len);
+	start = now();
+
+	for (i = 0; i < rounds; i++) {
+		String_json_escape(d, bytes, len);
+		found += String_length(d);
+	}
+
+	snprintf(name, sizeof(name), "json escape %s plain (String_json_escape)", size);
+	report(name, now() - start, rounds);
+
+	free(bytes);
+	free(tmp);
+	String_free(&d);
+	String_free(&e);
+}
+
+void bench_codec(void)
+{
+	bench_codec_size("16 B", 16, 5000000);
+	bench_codec_size("64 KiB", 64 * 1024, 5000);
+}
+
+/*
+ * Thread local pool: power of 2 size classes from 16 B to 64 KiB, each one
+ * with its own free list. Bigger blocks go straight to malloc.
+ */
+#define POOL_MIN_SHIFT 4
+#define POOL_MAX_SHIFT 16
+#define POOL_CLASSES (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+
+static __thread void *pool[POOL_CLASSES];
+
+static int pool_class(size_t n)
+{
+	int c = 0;
+
+	if (n > (1u << POOL_MAX_SHIFT)) {
+		return -1;
+	}
+
+	while (((size_t)1 << (c + POOL_MIN_SHIFT)) < n) {
+		c++;
+	}
+
+	return c;
+}
+
+static void *pool_alloc(void *ctx, size_t n)
+{
+	int c = pool_class(n);
+	void *p;
+
+	(void)ctx;
+
+	if (c < 0) {
+		return malloc(n);
+	}
+
+	if ((p = pool[c]) != NULL) {
+		pool[c] = *(void **)p;
+		return p;
+	}
+
+	return malloc((size_t)1 << (c + POOL_MIN_SHIFT));
+}
+
+static void pool_release(void *ctx, void *p, size_t size)
+{
+	int c = pool_class(size);
+
+	(void)ctx;
+
+	if (p == NULL) {
+		return;
+	}
+
+	if (c < 0) {
+		free(p);
+		return;
+	}
+
+	*(void **)p = pool[c];
+	pool[c] = p;
+}
+
+static void *pool_resize(void *ctx, void *p, size_t old_size, size_t n)
+{
+	void *q;
+
+	if (p == NULL) {
+		return pool_alloc(ctx, n);
+	}
+
+	if (pool_class(old_size) >= 0 && pool_class(old_size) == pool_class(n)) {
+		return p;
+	}
+
+	if (pool_class(old_size) < 0 && pool_class(n) < 0) {
+		return realloc(p, n);
+	}
+
+	if ((q = pool_alloc(ctx, n)) == NULL) {
+		return NULL;
+	}
+
+	memcpy(q, p, old_size < n ? old_size : n);
+	pool_release(ctx, p, old_size);
+	return q;
+}
+
+static void pool_drain(void)
+{
+	void *p;
+	int c;
+
+	for (c = 0; c < POOL_CLASSES; c++) {
+		while ((p = pool[c]) != NULL) {
+			pool[c] = *(void **)p;
+			free(p);
+		}
+	}
+}
+
+static const String_allocator pool_allocator = {
+	pool_alloc, pool_resize, pool_release, NULL
+};
+
+#define THREADS 4
+#define CHURN 200000
+
+static void *churn(void *arg)
+{
+	const String_allocator *a = arg;
+	const char *key = "service.request.latency";
+	String s[8];
+	unsigned i, j;
+
+	for (i = 0; i < CHURN; i++) {
+		for (j = 0; j < 8; j++) {
+			s[j] = String_new_with(a, key, j * 4);
+			String_ncat(s[j], key, (i + j) % 64);
+		}
+
+		for (j = 0; j < 8; j++) {
+			String_free(&s[j]);
+		}
+	}
+
+	pool_drain();
+	return NULL;
+}
+
+static void run_churn(const char *name, const String_allocator *a)
+{
+	pthread_t threads[THREADS];
+	double start;
+	unsigned i;
+
+	start = now();
+
+	for (i = 0; i < THREADS; i++) {
+		pthread_create(&threads[i], NULL, churn, (void *)a);
+	}
+
+	for (i = 0; i < THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	report(name, now() - start, (unsigned long)THREADS * CHURN * 8);
+}
+
+void bench_allocator(void)
+{
+	run_churn("new + ncat + free (malloc)", NULL);
+	run_churn("new + ncat + free (thread local pool)", &pool_allocator);
+}
+
+#define BUILDER_RECORDS 1000000
+
+static const char record[] = "ts=1408000000 level=info ok=1\n";
+static pthread_mutex_t locked_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *append_locked(void *arg)
+{
+	String s = arg;
+	unsigned i;
+
+	for (i = 0; i < BUILDER_RECORDS; i++) {
+		pthread_mutex_lock(&locked_lock);
+		String_ncat(s, record, sizeof(record) - 1);
+		pthread_mutex_unlock(&locked_lock);
+	}
+
+	return NULL;
+}
+
+static void *append_builder(void *arg)
+{
+	String_builder b = arg;
+	unsigned i;
+
+	for (i = 0; i < BUILDER_RECORDS; i++) {
+		String_builder_append(b, record, sizeof(record) - 1);
+	}
+
+	return NULL;
+}
+
+void bench_builder(void)
+{
+	pthread_t threads[THREADS];
+	String_builder b;
+	String s;
+	double start;
+	volatile unsigned long total = 0;
+	unsigned i;
+
+	s = String_new_empty();
+	start = now();
+
+	for (i = 0; i < THREADS; i++) {
+		pthread_create(&threads[i], NULL, append_locked, s);
+	}
+
+	for (i = 0; i < THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	report("mutex + ncat", now() - start, (unsigned long)THREADS * BUILDER_RECORDS);
+	total += String_length(s);
+	String_free(&s);
+
+	b = String_builder_new(0);
+	start = now();
+
+	for (i = 0; i < THREADS; i++) {
+		pthread_create(&threads[i], NULL, append_builder, b);
+	}
+
+	for (i = 0; i < THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	s = String_builder_finish(&b);
+	report("builder append + finish", now() - start, (unsigned long)THREADS * BUILDER_RECORDS);
+	total += String_length(s);
+	String_free(&s);
+}
+
+int main(int argc, char *argv[])
+{
+	struct {
+		const char *name;
+		void (*run)(void);
+	} benches[] = {
+		{"append", bench_append},
+		{"allocator", bench_allocator},
+		{"format", bench_format},
+		{"append_int", bench_append_int},
+		{"catv", bench_catv},
+		{"growth", bench_growth},
+		{"mmap", bench_mmap},
+		{"io", bench_io},
+		{"search", bench_search},
+		{"patterns", bench_patterns},
+		{"replace", bench_replace},
+		{"split", bench_split},
+		{"utf8", bench_utf8},
+		{"case", bench_case},
+		{"codec", bench_codec},
+		{"builder", bench_builder},
+	};
+	unsigned i;
+
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		if (argc < 2 || strcmp(argv[1], benches[i].name) == 0) {
+			benches[i].run();
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,345 @@
+/*
+ * File:    DStrings_builder.c
+ * Author:  Eduardo Miravalls Sierra          <edu.miravalls@hotmail.com>
+ *
+ * Date:    2014-08-30 09:47
+ */
+
+/*
+ * Dynamic C Strings library.
+ * Copyright (C) 2014 Eduardo Miravalls Sierra
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "DStrings_internal.h"
+
+/**
+ * @brief default size of the first segment, like the arena's chunks.
+ */
+#define BUILDER_SEGMENT_SIZE (64 * 1024)
+
+/**
+ * @brief one segment per bit of an offset is more than enough.
+ */
+#define SEGMENTS 64
+
+/**
+ * @brief keeps the counters producers hammer on different cache lines.
+ */
+#define CACHE_LINE 64
+
+/*
+ * The contents live in segments that double in size: segment k holds
+ * 1 << (shift + k) bytes, from offset ((1 << k) - 1) << shift on, so the
+ * segment of an offset is a count leading zeros away. Segments are never
+ * moved or resized, so a producer can copy into its range while others
+ * grow the builder. They're allocated by the first producer that needs
+ * them, and a producer that loses the race to install one frees its own.
+ *
+ * reserved hands out disjoint ranges, and each segment counts the bytes
+ * that have been copied into it. Producers never wait for each other:
+ * the watermark is worked out by readers, a segment is complete once
+ * every byte reserved in it has been copied. It can stop at a segment's
+ * end, halfway through an append. committed caches it, so it never goes
+ * back.
+ */
+struct String_builder {
+	atomic_ullong reserved;  /**< bytes handed out to producers */
+	char pad1[CACHE_LINE - sizeof(atomic_ullong)];
+	atomic_ullong committed; /**< every byte below it has been copied */
+	char pad2[CACHE_LINE - sizeof(atomic_ullong)];
+	atomic_int failed;       /**< an append couldn't be copied */
+	unsigned shift;          /**< log2 of the first segment's size */
+	_Atomic(char *) segments[SEGMENTS]; /**< allocated on demand */
+	atomic_ullong filled[SEGMENTS];     /**< bytes copied into each one */
+};
+
+/**
+ * @brief finds the segment an offset lies in.
+ *
+ * @param b builder.
+ * @param offset offset.
+ *
+ * @return its index.
+ */
+static unsigned segment_of(String_builder b, unsigned long long offset);
+
+/**
+ * @brief returns a segment, allocating it if it's not there yet.
+ *
+ * @param b builder.
+ * @param k segment's index.
+ *
+ * @return the segment.
+ * @return NULL if it couldn't be allocated.
+ */
+static char *segment(String_builder b, unsigned k);
+
+/**
+ * @brief advances the committed watermark as far as the copies allow.
+ *
+ * @param b builder.
+ *
+ * @return the watermark.
+ */
+static unsigned long long watermark(String_builder b);
+
+String_builder String_builder_new(unsigned segment_size)
+{
+	String_builder b;
+	unsigned k;
+
+	if ((b = malloc(sizeof(*b))) == NULL) {
+		return NULL;
+	}
+
+	atomic_init(&b->reserved, 0);
+	atomic_init(&b->committed, 0);
+	atomic_init(&b->failed, NO);
+
+	/* segments' sizes are powers of 2 */
+	segment_size = segment_size ? segment_size : BUILDER_SEGMENT_SIZE;
+
+	for (b->shift = 0; b->shift < 31 && (1u << b->shift) < segment_size; b->shift++) {
+	}
+
+	for (k = 0; k < SEGMENTS; k++) {
+		atomic_init(&b->segments[k], NULL);
+		atomic_init(&b->filled[k], 0);
+	}
+
+	return b;
+}
+
+int String_builder_append(String_builder b, const void *src, String_len n)
+{
+	unsigned long long start, end, offset, first, last;
+	const char *p = src;
+	char *seg;
+	unsigned k;
+	int ok = YES;
+
+	assert(b != NULL);
+	assert(src != NULL || n == 0);
+
+	if (n == 0) {
+		return 0;
+	}
+
+	start = atomic_fetch_add_explicit(&b->reserved, n, memory_order_relaxed);
+	end = start + n;
+
+	/* the finished String's length has to fit, '\0' included */
+	if (end > (unsigned long long)STRING_LEN_MAX - 1) {
+		ok = NO;
+	}
+
+	/* a range can straddle segments */
+	for (offset = start; ok && offset < end; offset = last) {
+		k = segment_of(b, offset);
+
+		if ((seg = segment(b, k)) == NULL) {
+			ok = NO;
+			break;
+		}
+
+		first = ((1ull << k) - 1) << b->shift;
+		last = first + (1ull << (k + b->shift));
+		last = last < end ? last : end;
+		memcpy(seg + (offset - first), p + (offset - start), last - offset);
+		atomic_fetch_add_explicit(&b->filled[k], last - offset, memory_order_release);
+	}
+
+	/* the watermark stops at a failed range, finishing gives up */
+	if (!ok) {
+		atomic_store_explicit(&b->failed, YES, memory_order_relaxed);
+		return -1;
+	}
+
+	return 0;
+}
+
+String_len String_builder_length(String_builder b)
+{
+	unsigned long long committed;
+
+	assert(b != NULL);
+
+	committed = watermark(b);
+	return committed < STRING_LEN_MAX ? (String_len)committed : STRING_LEN_MAX;
+}
+
+String_len String_builder_read(String_builder b, String_len offset,
+                               void *dest, String_len n)
+{
+	unsigned long long committed, first, last, at, end;
+	char *d = dest;
+	unsigned k;
+
+	assert(b != NULL);
+	assert(dest != NULL || n == 0);
+
+	committed = watermark(b);
+
+	if (offset >= committed) {
+		return 0;
+	}
+
+	end = committed - offset < n ? committed : (unsigned long long)offset + n;
+
+	for (at = offset; at < end; at = last) {
+		k = segment_of(b, at);
+		first = ((1ull << k) - 1) << b->shift;
+		last = first + (1ull << (k + b->shift));
+		last = last < end ? last : end;
+		memcpy(d + (at - offset),
+		       atomic_load_explicit(&b->segments[k], memory_order_relaxed) + (at - first),
+		       last - at);
+	}
+
+	return end - offset;
+}
+
+String String_builder_finish(String_builder *b)
+{
+	unsigned long long total, first;
+	String s = NULL;
+	char *raw;
+
+	assert(b != NULL);
+
+	if (*b == NULL) {
+		return NULL;
+	}
+
+	total = watermark(*b);
+
+	/*
+	 * The first segment is grown into the String's buffer, so contents
+	 * that fit in it aren't copied at all.
+	 */
+	if (!atomic_load_explicit(&(*b)->failed, memory_order_relaxed) &&
+	    (s = String_new_steal(NULL, 0)) != NULL) {
+		/* appends have returned, so every reserved byte is there */
+		assert(total == atomic_load_explicit(&(*b)->reserved, memory_order_relaxed));
+		first = 1ull << (*b)->shift;
+
+		if ((raw = realloc((*b)->segments[0], total + 1)) == NULL) {
+			String_free(&s);
+		} else {
+			atomic_store_explicit(&(*b)->segments[0], NULL, memory_order_relaxed);
+
+			if (total > first) {
+				String_builder_read(*b, first, raw + first, total - first);
+			}
+
+			raw[total] = '\0';
+			s->raw = raw;
+			s->size = s->len = total + 1;
+		}
+	}
+
+	String_builder_free(b);
+	return s;
+}
+
+void String_builder_free(String_builder *b)
+{
+	unsigned k;
+
+	assert(b != NULL);
+
+	if (*b != NULL) {
+		for (k = 0; k < SEGMENTS; k++) {
+			free(atomic_load_explicit(&(*b)->segments[k], memory_order_relaxed));
+		}
+
+		free(*b);
+		*b = NULL;
+	}
+}
+
+static unsigned segment_of(String_builder b, unsigned long long offset)
+{
+	return 63 - __builtin_clzll((offset >> b->shift) + 1);
+}
+
+static char *segment(String_builder b, unsigned k)
+{
+	char *seg, *expected = NULL;
+	unsigned long long size;
+
+	if ((seg = atomic_load_explicit(&b->segments[k], memory_order_acquire)) != NULL) {
+		return seg;
+	}
+
+	if ((size = 1ull << (k + b->shift)) > SIZE_MAX || (seg = malloc(size)) == NULL) {
+		return NULL;
+	}
+
+	if (!atomic_compare_exchange_strong_explicit(&b->segments[k], &expected, seg,
+	                                             memory_order_acq_rel,
+	                                             memory_order_acquire)) {
+		free(seg);
+		seg = expected;
+	}
+
+	return seg;
+}
+
+static unsigned long long watermark(String_builder b)
+{
+	unsigned long long mark, next, first, last, reserved, filled;
+	unsigned k;
+
+	mark = atomic_load_explicit(&b->committed, memory_order_acquire);
+
+	for (k = segment_of(b, mark); k + b->shift < SEGMENTS; k++) {
+		first = ((1ull << k) - 1) << b->shift;
+		last = first + (1ull << (k + b->shift));
+
+		/*
+		 * Whatever has been copied was reserved before this reads
+		 * reserved, so if the counts match, nothing is missing.
+		 */
+		filled = atomic_load_explicit(&b->filled[k], memory_order_acquire);
+		reserved = atomic_load_explicit(&b->reserved, memory_order_relaxed);
+		reserved = reserved < last ? reserved : last;
+
+		if (reserved <= first || filled != reserved - first) {
+			break;
+		}
+
+		mark = reserved;
+
+		if (reserved < last) {
+			break;
+		}
+	}
+
+	/* someone else may have got further */
+	next = atomic_load_explicit(&b->committed, memory_order_acquire);
+
+	while (next < mark &&
+	       !atomic_compare_exchange_weak_explicit(&b->committed, &next, mark,
+	                                              memory_order_acq_rel,
+	                                              memory_order_acquire)) {
+	}
+
+	return next < mark ? mark : next;
+}
@@ -0,0 +1,490 @@
+/*
+ * File:    DStrings_case.c
+ * Author:  Eduardo Miravalls Sierra          <edu.miravalls@hotmail.com>
+ *
+ * Date:    2014-08-30 09:47
+ */
+
+/*
+ * Dynamic C Strings library.
+ * Copyright (C) 2014 Eduardo Miravalls Sierra
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+
+#include "DStrings_internal.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+/* whitespace in the "C" locale */
+#define is_space(c) ((c) == ' ' || ((c) >= '\t' && (c) <= '\r'))
+
+/* ASCII letters to lower case */
+#define lower(c) ((c) >= 'A' && (c) <= 'Z' ? (c) ^ 0x20 : (c))
+
+/**
+ * @brief flips the case of the chars of a word that are in [first, last].
+ * @details first and last are ASCII, the compares are done on the low 7
+ * bits of every byte so they don't carry into the next one.
+ *
+ * @param v 8 chars.
+ * @param first first char to convert.
+ * @param last last char to convert.
+ *
+ * @return v converted.
+ */
+static uint64_t flip8(uint64_t v, char first, char last);
+
+/**
+ * @brief portable case conversion kernel.
+ * @details flips the case of the chars in [first, last], which is 'A' to
+ * 'Z' or 'a' to 'z'. src and dst can be the same buffer.
+ *
+ * @param src chars to convert.
+ * @param dst where they go.
+ * @param n number of chars.
+ * @param first first char to convert.
+ * @param last last char to convert.
+ */
+static void convert_scalar(const char *src, char *dst, String_len n, char first, char last);
+
+/**
+ * @brief returns the offset of the first char of p that isn't whitespace.
+ *
+ * @param p buffer.
+ * @param n p's length.
+ *
+ * @return the offset, or n if they all are.
+ */
+static String_len skip_space_scalar(const char *p, String_len n);
+
+/**
+ * @brief returns the length of p without its trailing whitespace.
+ */
+static String_len rskip_space_scalar(const char *p, String_len n);
+
+/**
+ * @brief returns the offset of the first char where p1 and p2 differ,
+ * ignoring the case of ASCII letters.
+ *
+ * @param p1 buffer.
+ * @param p2 buffer.
+ * @param n length of both.
+ *
+ * @return the offset, or n if they don't differ.
+ */
+static String_len mismatch_scalar(const char *p1, const char *p2, String_len n);
+
+/**
+ * @brief returns the length of p's leading whitespace.
+ * @details most texts have none, so they're not sent to a kernel.
+ *
+ * @param p buffer.
+ * @param n p's length.
+ *
+ * @return the offset of the first char that isn't whitespace, or n.
+ */
+static String_len ltrim_offset(const char *p, String_len n);
+
+/**
+ * @brief returns the length of p without its trailing whitespace.
+ */
+static String_len rtrim_length(const char *p, String_len n);
+
+/**
+ * @brief converts the case of s in place.
+ *
+ * @param s String.
+ * @param first first char to convert.
+ * @param last last char to convert.
+ *
+ * @return -1 if s can't be modified.
+ * @return 0 otherwise.
+ */
+static int convert(String s, char first, char last);
+
+/**
+ * @brief copies src to dest, converting its case.
+ */
+static int copy_converted(String dest, StringView src, char first, char last);
+
+/**
+ * @brief removes a String's leading chars and keeps the first n of the
+ * rest.
+ *
+ * @param s String.
+ * @param from number of chars removed.
+ * @param n number of chars kept.
+ *
+ * @return -1 if s can't be modified.
+ * @return 0 otherwise.
+ */
+static int keep_slice(String s, String_len from, String_len n);
+
+#ifdef HAVE_X86
+/*
+ * Every chunk of W chars is handled with a handful of compares, whatever
+ * its contents: letters are in a range of signed chars that leaves out
+ * the bytes of UTF-8 sequences, which have their high bit set, so ASCII
+ * runs and everything else take the same path. What's left over is handed
+ * to the next narrower kernel, so short texts still get a vector or two.
+ * gcc doesn't always clear the upper halves of the AVX registers before a
+ * tail call, and the SSE2 kernels would pay for it, so leave() does.
+ */
+#define CASE_KERNELS(isa, next, vec, W, loadu, storeu, set1, cmpgt, cmpeq, and, or, \
+                     xor, movemask, leave) \
+static inline __attribute__((target(#isa))) void \
+convert_##isa(const char *src, char *dst, String_len n, char first, char last) \
+{ \
+	const vec lo = set1(first - 1), hi = set1(last + 1), bit = set1(0x20); \
+	String_len i; \
+	vec v; \
+\
+	for (i = 0; n - i >= W; i += W) { \
+		v = loadu((const vec *)(src + i)); \
+		storeu((vec *)(dst + i), xor(v, and(and(cmpgt(v, lo), cmpgt(hi, v)), bit))); \
+	} \
+\
+	leave(); \
+	convert_##next(src + i, dst + i, n - i, first, last); \
+} \
+\
+static inline __attribute__((target(#isa))) String_len \
+skip_space_##isa(const char *p, String_len n) \
+{ \
+	const vec space = set1(' '), lo = set1('\t' - 1), hi = set1('\r' + 1); \
+	String_len i; \
+	unsigned mask; \
+	vec v; \
+\
+	for (i = 0; n - i >= W; i += W) { \
+		v = loadu((const vec *)(p + i)); \
+		mask = ~movemask(or(cmpeq(v, space), and(cmpgt(v, lo), cmpgt(hi, v)))); \
+\
+		if ((mask &= (unsigned)((1ull << W) - 1)) != 0) { \
+			return i + __builtin_ctz(mask); \
+		} \
+	} \
+\
+	leave(); \
+	return i + skip_space_##next(p + i, n - i); \
+} \
+\
+static inline __attribute__((target(#isa))) String_len \
+rskip_space_##isa(const char *p, String_len n) \
+{ \
+	const vec space = set1(' '), lo = set1('\t' - 1), hi = set1('\r' + 1); \
+	unsigned mask; \
+	vec v; \
+\
+	for (; n >= W; n -= W) { \
+		v = loadu((const vec *)(p + n - W)); \
+		mask = ~movemask(or(cmpeq(v, space), and(cmpgt(v, lo), cmpgt(hi, v)))); \
+\
+		if ((mask &= (unsigned)((1ull << W) - 1)) != 0) { \
+			return n - W + 32 - __builtin_clz(mask); \
+		} \
+	} \
+\
+	leave(); \
+	return rskip_space_##next(p, n); \
+} \
+\
+static inline __attribute__((target(#isa))) vec \
+match_##isa(const char *p1, const char *p2) \
+{ \
+	const vec lo = set1('a' - 1), hi = set1('z' + 1), bit = set1(0x20), zero = set1(0); \
+	vec v1 = loadu((const vec *)p1), x = xor(v1, loadu((const vec *)p2)), l = or(v1, bit); \
+\
+	/* chars match if they're equal, or letters that only differ in case */ \
+	return or(cmpeq(x, zero), and(and(cmpgt(l, lo), cmpgt(hi, l)), cmpeq(x, bit))); \
+} \
+\
+static inline __attribute__((target(#isa))) String_len \
+mismatch_##isa(const char *p1, const char *p2, String_len n) \
+{ \
+	const unsigned full = (unsigned)((1ull << W) - 1); \
+	String_len i; \
+	unsigned mask; \
+\
+	/* two blocks per iteration while they match, then one at a time */ \
+	for (i = 0; n - i >= 2 * W; i += 2 * W) { \
+		if (movemask(and(match_##isa(p1 + i, p2 + i), \
+		                 match_##isa(p1 + i + W, p2 + i + W))) != full) { \
+			break; \
+		} \
+	} \
+\
+	for (; n - i >= W; i += W) { \
+		if ((mask = ~movemask(match_##isa(p1 + i, p2 + i)) & full) != 0) { \
+			return i + __builtin_ctz(mask); \
+		} \
+	} \
+\
+	leave(); \
+	return i + mismatch_##next(p1 + i, p2 + i, n - i); \
+}
+
+#define leave_sse2()
+
+CASE_KERNELS(sse2, scalar, __m128i, 16, _mm_loadu_si128, _mm_storeu_si128, _mm_set1_epi8,
+             _mm_cmpgt_epi8, _mm_cmpeq_epi8, _mm_and_si128, _mm_or_si128, _mm_xor_si128,
+             (unsigned)_mm_movemask_epi8, leave_sse2)
+CASE_KERNELS(avx2, sse2, __m256i, 32, _mm256_loadu_si256, _mm256_storeu_si256, _mm256_set1_epi8,
+             _mm256_cmpgt_epi8, _mm256_cmpeq_epi8, _mm256_and_si256, _mm256_or_si256,
+             _mm256_xor_si256, (unsigned)_mm256_movemask_epi8, _mm256_zeroupper)
+
+#undef CASE_KERNELS
+#undef leave_sse2
+
+#define dispatch(name) \
+	(__builtin_cpu_supports("avx2") ? name##_avx2 : \
+	 __builtin_cpu_supports("sse2") ? name##_sse2 : name##_scalar)
+#else
+#define dispatch(name) name##_scalar
+#endif
+
+int String_tolower(String s)
+{
+	assert(s != NULL);
+	return convert(s, 'A', 'Z');
+}
+
+int String_toupper(String s)
+{
+	assert(s != NULL);
+	return convert(s, 'a', 'z');
+}
+
+int String_cpy_lower(String dest, StringView src)
+{
+	assert(dest != NULL);
+	assert(src.ptr != NULL || src.len == 0);
+	return copy_converted(dest, src, 'A', 'Z');
+}
+
+int String_cpy_upper(String dest, StringView src)
+{
+	assert(dest != NULL);
+	assert(src.ptr != NULL || src.len == 0);
+	return copy_converted(dest, src, 'a', 'z');
+}
+
+StringView StringView_trim(StringView v)
+{
+	return StringView_rtrim(StringView_ltrim(v));
+}
+
+StringView StringView_ltrim(StringView v)
+{
+	String_len from;
+
+	assert(v.ptr != NULL || v.len == 0);
+
+	from = ltrim_offset(v.ptr, v.len);
+	return StringView_new(v.ptr + from, v.len - from);
+}
+
+StringView StringView_rtrim(StringView v)
+{
+	assert(v.ptr != NULL || v.len == 0);
+	return StringView_new(v.ptr, rtrim_length(v.ptr, v.len));
+}
+
+int String_trim(String s)
+{
+	String_len from;
+
+	assert(s != NULL);
+
+	from = ltrim_offset(s->raw, used(s));
+	return keep_slice(s, from, rtrim_length(s->raw + from, used(s) - from));
+}
+
+int String_ltrim(String s)
+{
+	String_len from;
+
+	assert(s != NULL);
+
+	from = ltrim_offset(s->raw, used(s));
+	return keep_slice(s, from, used(s) - from);
+}
+
+int String_rtrim(String s)
+{
+	assert(s != NULL);
+	return keep_slice(s, 0, rtrim_length(s->raw, used(s)));
+}
+
+int StringView_casecmp(StringView v1, StringView v2)
+{
+	String_len n = v1.len < v2.len ? v1.len : v2.len, i;
+	unsigned char c1, c2;
+
+	assert(v1.ptr != NULL || v1.len == 0);
+	assert(v2.ptr != NULL || v2.len == 0);
+
+	if ((i = dispatch(mismatch)(v1.ptr, v2.ptr, n)) < n) {
+		c1 = lower(v1.ptr[i]);
+		c2 = lower(v2.ptr[i]);
+		return c1 < c2 ? -1 : 1;
+	}
+
+	return (v1.len > v2.len) - (v1.len < v2.len);
+}
+
+int StringView_case_equal(StringView v1, StringView v2)
+{
+	assert(v1.ptr != NULL || v1.len == 0);
+	assert(v2.ptr != NULL || v2.len == 0);
+
+	return v1.len == v2.len && dispatch(mismatch)(v1.ptr, v2.ptr, v1.len) == v1.len;
+}
+
+uint64_t StringView_case_hash(StringView v)
+{
+	assert(v.ptr != NULL || v.len == 0);
+	return string_hash_bytes_nocase(v.ptr, v.len);
+}
+
+static uint64_t flip8(uint64_t v, char first, char last)
+{
+	const uint64_t ones = 0x0101010101010101ull, high = 0x8080808080808080ull;
+	uint64_t low = v & ~high;
+
+	/* the high bit of first <= c <= last goes to 0x20 */
+	return v ^ ((low + (0x80 - first) * ones) & ~(low + (0x80 - last - 1) * ones) & ~v & high) >> 2;
+}
+
+static void convert_scalar(const char *src, char *dst, String_len n, char first, char last)
+{
+	String_len i;
+	uint64_t w;
+
+	for (i = 0; n - i >= 8; i += 8) {
+		memcpy(&w, src + i, 8);
+		w = flip8(w, first, last);
+		memcpy(dst + i, &w, 8);
+	}
+
+	for (; i < n; i++) {
+		dst[i] = src[i] >= first && src[i] <= last ? src[i] ^ 0x20 : src[i];
+	}
+}
+
+static String_len skip_space_scalar(const char *p, String_len n)
+{
+	String_len i = 0;
+
+	while (i < n && is_space(p[i])) {
+		i++;
+	}
+
+	return i;
+}
+
+static String_len rskip_space_scalar(const char *p, String_len n)
+{
+	while (n > 0 && is_space(p[n - 1])) {
+		n--;
+	}
+
+	return n;
+}
+
+static String_len mismatch_scalar(const char *p1, const char *p2, String_len n)
+{
+	String_len i;
+	uint64_t w1, w2;
+
+	/* a word at a time, then the byte that differs */
+	for (i = 0; n - i >= 8; i += 8) {
+		memcpy(&w1, p1 + i, 8);
+		memcpy(&w2, p2 + i, 8);
+
+		if (flip8(w1, 'A', 'Z') != flip8(w2, 'A', 'Z')) {
+			break;
+		}
+	}
+
+	while (i < n && lower(p1[i]) == lower(p2[i])) {
+		i++;
+	}
+
+	return i;
+}
+
+static String_len ltrim_offset(const char *p, String_len n)
+{
+	return n == 0 || !is_space(p[0]) ? 0 : dispatch(skip_space)(p, n);
+}
+
+static String_len rtrim_length(const char *p, String_len n)
+{
+	return n == 0 || !is_space(p[n - 1]) ? n : dispatch(rskip_space)(p, n);
+}
+
+static int convert(String s, char first, char last)
+{
+	unsigned char before = s->flags;
+
+	if (string_prepare_write(s)) {
+		return -1;
+	}
+
+	dispatch(convert)(s->raw, s->raw, used(s), first, last);
+
+	/* changing ASCII chars for ASCII chars keeps what's known about UTF-8 */
+	s->flags |= before & (CHECKED | UTF8 | ASCII);
+	return 0;
+}
+
+static int copy_converted(String dest, StringView src, char first, char last)
+{
+	if (string_prepare_write(dest) || string_reserve_at(dest, 0, src.len)) {
+		return -1;
+	}
+
+	dispatch(convert)(src.ptr, dest->raw, src.len, first, last);
+	dest->raw[src.len] = '\0';
+	dest->len = src.len + 1;
+	return 0;
+}
+
+static int keep_slice(String s, String_len from, String_len n)
+{
+	unsigned char before = s->flags;
+
+	if (from == 0 && n == used(s)) {
+		return 0;
+	}
+
+	if (string_prepare_write(s)) {
+		return -1;
+	}
+
+	memmove(s->raw, s->raw + from, n);
+	s->raw[n] = '\0';
+	s->len = n + 1;
+
+	/* only ASCII chars were removed */
+	s->flags |= before & (CHECKED | UTF8 | ASCII);
+	return 0;
+}
@@ -0,0 +1,1031 @@
+/*
+ * File:    DStrings_codec.c
+ * Author:  Eduardo Miravalls Sierra          <edu.miravalls@hotmail.com>
+ *
+ * Date:    2014-08-30 09:47
+ */
+
+/*
+ * Dynamic C Strings library.
+ * Copyright (C) 2014 Eduardo Miravalls Sierra
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "DStrings_internal.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief chars classified at once when escaping JSON, one bit each.
+ */
+#define BLOCK 64
+
+/* src is in dest's buffer, which may move or be overwritten */
+#define aliased(dest, src) \
+	((uintptr_t)(src) - (uintptr_t)(dest)->raw < (dest)->size)
+
+/* value of a base64 digit, 0xff if c isn't one */
+#define base64_value(c) ((c) < 0x80 ? base64_values[c] : 0xff)
+
+/* value of a hex digit, above 15 if c isn't one */
+#define hex_value(c) \
+	((unsigned char)((c) - '0') < 10 ? (unsigned char)((c) - '0') : \
+	 (unsigned char)(((c) | 0x20) - 'a') < 6 ? (unsigned char)(((c) | 0x20) - 'a' + 10) : 16u)
+
+/* whether c goes as is in a URL */
+#define unreserved(c) (url_unreserved[(c) / 8] >> (c) % 8 & 1)
+
+/* whether c has to be escaped in a JSON string */
+#define json_special(c) ((c) < 0x20 || (c) == '"' || (c) == '\\')
+
+/* length of the escape sequence of a char that has to be escaped */
+#define json_escape_length(c) ((c) >= 0x20 || json_short[c] ? 2 : 6)
+
+static const char base64_digits[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static const char hex_digits[] = "0123456789abcdef";
+
+/* RFC 3986 recommends upper case */
+static const char url_digits[] = "0123456789ABCDEF";
+
+/* value of each ASCII base64 digit, 0xff for the rest */
+static const unsigned char base64_values[128] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x3e, 0xff, 0xff, 0xff, 0x3f,
+	0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e,
+	0x0f, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+	0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f, 0x30, 0x31, 0x32, 0x33, 0xff, 0xff, 0xff, 0xff, 0xff
+};
+
+/* RFC 3986 unreserved chars: letters, digits and "-._~", one bit each */
+static const unsigned char url_unreserved[32] = {
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x60, 0xff, 0x03,
+	0xfe, 0xff, 0xff, 0x87, 0xfe, 0xff, 0xff, 0x47
+};
+
+/* control chars with a two char escape, the rest are "\u00XX" */
+static const char json_short[32] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 'b', 't', 'n', 0, 'f', 'r', 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+/**
+ * @brief gets dest ready to have n chars written at dest_offset.
+ * @details same as String_ncpy_at: dest grows following its growth
+ * policy, and the gap, if dest_offset is past its end, is padded with 0's.
+ *
+ * @param dest String.
+ * @param dest_offset first char to be overwritten.
+ * @param n number of chars that will be written.
+ *
+ * @return where they go.
+ * @return NULL if dest can't be modified or reallocation failed.
+ */
+static char *start(String dest, String_len dest_offset, String_len n);
+
+/**
+ * @brief runs a codec on a copy of src, for when src is part of dest.
+ *
+ * @param codec the function called.
+ * @param dest String.
+ * @param dest_offset first char to be overwritten.
+ * @param src source, inside dest.
+ * @param n src's length.
+ *
+ * @return what codec returns.
+ * @return -1 if the copy couldn't be allocated.
+ */
+static int on_copy(int (*codec)(String, String_len, const void *, String_len),
+                   String dest, String_len dest_offset, const void *src, String_len n);
+
+/**
+ * @brief ends dest after the n chars written at dest_offset.
+ *
+ * @param dest String.
+ * @param dest_offset first char that was overwritten.
+ * @param n number of chars written.
+ */
+static void finish(String dest, String_len dest_offset, String_len n);
+
+/**
+ * @brief portable base64 encoding kernel.
+ *
+ * @param src bytes.
+ * @param n number of bytes.
+ * @param dst where their encoding goes, padding included.
+ */
+static void base64_encode_scalar(const unsigned char *src, String_len n, char *dst);
+
+/**
+ * @brief portable base64 decoding kernel.
+ *
+ * @param src digits, padding excluded.
+ * @param n number of digits, n % 4 can't be 1.
+ * @param dst where the bytes go.
+ *
+ * @return 0 if src has something other than base64 digits.
+ * @return != 0 otherwise.
+ */
+static int base64_decode_scalar(const unsigned char *src, String_len n, char *dst);
+
+/**
+ * @brief portable hex encoding kernel.
+ *
+ * @param src bytes.
+ * @param n number of bytes.
+ * @param dst where their 2 * n digits go.
+ */
+static void hex_encode_scalar(const unsigned char *src, String_len n, char *dst);
+
+/**
+ * @brief portable hex decoding kernel.
+ *
+ * @param src digits.
+ * @param n number of bytes, half the digits.
+ * @param dst where the bytes go.
+ *
+ * @return 0 if src has something other than hex digits.
+ * @return != 0 otherwise.
+ */
+static int hex_decode_scalar(const unsigned char *src, String_len n, char *dst);
+
+/**
+ * @brief finds the chars that have to be escaped in a JSON string.
+ *
+ * @param p chars.
+ * @param n number of chars.
+ *
+ * @return bit i is set if p[i] has to be escaped, for the first BLOCK
+ * chars at most.
+ */
+static uint64_t json_block(const unsigned char *p, String_len n);
+
+/**
+ * @brief finds the chars that have to be escaped in upto BLOCK chars.
+ *
+ * @param p chars.
+ * @param n number of chars.
+ *
+ * @return bit i is set if p[i] has to be escaped.
+ */
+static uint64_t json_mask_scalar(const unsigned char *p, String_len n);
+
+/**
+ * @brief copies a run of chars that need no escaping.
+ * @details most runs between escapes are short, they're copied with a
+ * couple of fixed size moves instead of a call to memcpy.
+ *
+ * @param w where they go.
+ * @param p chars.
+ * @param n number of chars.
+ *
+ * @return w + n.
+ */
+static char *copy_run(char *w, const unsigned char *p, String_len n);
+
+/**
+ * @brief reads the 4 hex digits of a "\u" escape.
+ *
+ * @param p digits.
+ *
+ * @return their value, or -1 if they aren't 4 hex digits.
+ */
+static long json_hex4(const unsigned char *p);
+
+#ifdef HAVE_X86
+/*
+ * Base64 is Muła and Lemire's ("Faster Base64 Encoding and Decoding Using
+ * AVX2 Instructions", 2018). Encoding spreads every 3 bytes over a 32-bit
+ * word with pshufb, moves the four 6-bit fields to the bottom of their
+ * bytes with a multiply high and a multiply low, and turns them into
+ * digits by adding the offset of their range, which another pshufb looks
+ * up. Decoding looks up the high and low nibbles of every char in two
+ * tables that only share bits for bad chars, adds each range's offset, and
+ * packs the fields back with two multiply-adds. The AVX2 kernels do 12
+ * bytes per lane.
+ *
+ * Hex digits are a pshufb away from nibbles, and back they're a range
+ * check each for digits and letters. JSON escaping classifies BLOCK chars
+ * at a time into a bitmask of the ones that have to be escaped, like the
+ * splitter does, and the runs in between are copied as is.
+ *
+ * What's left over is handed to the next narrower kernel, so short texts
+ * still get a vector or two. gcc doesn't always clear the upper halves of
+ * the AVX registers before a tail call, and the SSE kernels would pay for
+ * it, so leave() does.
+ */
+
+/* offset of each range of digits, by what's left of a field after subs 51 */
+static const signed char base64_shift[16] = {
+	'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+	'0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0
+};
+
+/* a char is bad if the entries of its low and high nibbles share a bit */
+static const unsigned char base64_bad_low[16] = {
+	0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+	0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a
+};
+
+static const unsigned char base64_bad_high[16] = {
+	0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+	0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10
+};
+
+/* minus the offset of each range of digits, by high nibble, '/' by itself */
+static const signed char base64_roll[16] = {
+	0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+/* 3 bytes to each 32-bit word, in the order the fields are taken */
+static const signed char base64_spread[16] = {
+	1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10
+};
+
+/* and back, 3 bytes out of each 32-bit word */
+static const signed char base64_gather[16] = {
+	2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1
+};
+
+#define CODEC_KERNELS(isa, next, vec, W, table, load12, loadu, storeu, set1_8, set1_16, \
+                      set1_32, and, or, add, sub, subs, min, cmpgt, cmpeq, shuffle, \
+                      srli16, srli32, mulhi, mullo, maddubs, madd, packus, unpacklo, \
+                      unpackhi, movemask, lanes, compact, order, leave) \
+static inline __attribute__((target(#isa))) void \
+base64_encode_##isa(const unsigned char *src, String_len n, char *dst) \
+{ \
+	const vec spread = table(base64_spread), shift = table(base64_shift); \
+	String_len i; \
+	vec v, fields; \
+\
+	/* the loads read 4 bytes past the ones encoded */ \
+	for (i = 0; n - i >= W / 4 * 3 + 4; i += W / 4 * 3, dst += W) { \
+		v = shuffle(load12(src + i), spread); \
+		fields = or(mulhi(and(v, set1_32(0x0fc0fc00)), set1_32(0x04000040)), \
+		            mullo(and(v, set1_32(0x003f03f0)), set1_32(0x01000010))); \
+		v = or(subs(fields, set1_8(51)), and(cmpgt(set1_8(26), fields), set1_8(13))); \
+		storeu((vec *)dst, add(fields, shuffle(shift, v))); \
+	} \
+\
+	leave(); \
+	base64_encode_##next(src + i, n - i, dst); \
+} \
+\
+static inline __attribute__((target(#isa))) int \
+base64_decode_##isa(const unsigned char *src, String_len n, char *dst) \
+{ \
+	const vec bad_low = table(base64_bad_low), bad_high = table(base64_bad_high); \
+	const vec roll = table(base64_roll), gather = table(base64_gather); \
+	const vec nibble = set1_8(0x0f), slash = set1_8('/'), zero = set1_8(0); \
+	String_len i; \
+	vec v, high; \
+\
+	/* the stores write W / 4 bytes past the ones decoded */ \
+	for (i = 0; n - i >= W + W / 2; i += W, dst += W / 4 * 3) { \
+		v = loadu((const vec *)(src + i)); \
+		high = and(srli32(v, 4), nibble); \
+\
+		if (~movemask(cmpeq(and(shuffle(bad_low, and(v, nibble)), \
+		                        shuffle(bad_high, high)), zero)) & \
+		    (unsigned)((1ull << W) - 1)) { \
+			leave(); \
+			return 0; \
+		} \
+\
+		v = add(v, shuffle(roll, add(cmpeq(v, slash), high))); \
+		v = madd(maddubs(v, set1_32(0x01400140)), set1_32(0x00011000)); \
+		storeu((vec *)dst, compact(shuffle(v, gather))); \
+	} \
+\
+	leave(); \
+	return base64_decode_##next(src + i, n - i, dst); \
+} \
+\
+static inline __attribute__((target(#isa))) void \
+hex_encode_##isa(const unsigned char *src, String_len n, char *dst) \
+{ \
+	const vec digits = table(hex_digits), nibble = set1_8(0x0f); \
+	String_len i; \
+	vec v, high, low; \
+\
+	for (i = 0; n - i >= W; i += W) { \
+		v = loadu((const vec *)(src + i)); \
+		high = shuffle(digits, and(srli16(v, 4), nibble)); \
+		low = shuffle(digits, and(v, nibble)); \
+		v = unpacklo(high, low); \
+		high = unpackhi(high, low); \
+		storeu((vec *)(dst + 2 * i), lanes(v, high, 0x20)); \
+		storeu((vec *)(dst + 2 * i + W), lanes(v, high, 0x31)); \
+	} \
+\
+	leave(); \
+	hex_encode_##next(src + i, n - i, dst + 2 * i); \
+} \
+\
+static inline __attribute__((target(#isa))) int \
+hex_decode_##isa(const unsigned char *src, String_len n, char *dst) \
+{ \
+	const vec d0 = set1_8('0'), a = set1_8('a'), nine = set1_8(9), five = set1_8(5); \
+	const vec ten = set1_8(10), bit = set1_8(0x20), pair = set1_16(0x0110); \
+	vec v[2], digit, letter, is_digit, is_letter, ok; \
+	String_len i; \
+	int k; \
+\
+	/* 2 vectors of digits, one of bytes */ \
+	for (i = 0; n - i >= W; i += W) { \
+		for (k = 0, ok = cmpeq(nine, nine); k < 2; k++) { \
+			v[k] = loadu((const vec *)(src + 2 * i + k * W)); \
+			digit = sub(v[k], d0); \
+			letter = sub(or(v[k], bit), a); \
+			is_digit = cmpeq(min(digit, nine), digit); \
+			is_letter = cmpeq(min(letter, five), letter); \
+			ok = and(ok, or(is_digit, is_letter)); \
+			v[k] = or(and(is_digit, digit), and(is_letter, add(letter, ten))); \
+			v[k] = maddubs(v[k], pair); \
+		} \
+\
+		if (~movemask(ok) & (unsigned)((1ull << W) - 1)) { \
+			leave(); \
+			return 0; \
+		} \
+\
+		storeu((vec *)(dst + i), order(packus(v[0], v[1]))); \
+	} \
+\
+	leave(); \
+	return hex_decode_##next(src + 2 * i, n - i, dst + i); \
+} \
+\
+static inline __attribute__((target(#isa))) uint64_t \
+json_mask_##isa(const unsigned char *p, String_len n) \
+{ \
+	const vec quote = set1_8('"'), backslash = set1_8('\\'), control = set1_8(0x1f); \
+	uint64_t mask = 0; \
+	String_len i; \
+	vec v; \
+\
+	for (i = 0; n - i >= W; i += W) { \
+		v = loadu((const vec *)(p + i)); \
+		mask |= (uint64_t)movemask(or(or(cmpeq(v, quote), cmpeq(v, backslash)), \
+		                              cmpeq(min(v, control), v))) << i; \
+	} \
+\
+	if (i == n) { \
+		return mask; \
+	} \
+\
+	leave(); \
+	return mask | json_mask_##next(p + i, n - i) << i; \
+}
+
+#define table_ssse3(t) _mm_loadu_si128((const __m128i *)(t))
+#define table_avx2(t) _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(t)))
+
+/* 12 bytes to each lane */
+#define load12_ssse3(p) _mm_loadu_si128((const __m128i *)(p))
+#define load12_avx2(p) \
+	_mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(p))), \
+	                        _mm_loadu_si128((const __m128i *)((p) + 12)), 1)
+
+/* unpacks work within lanes: the halves of a, b in order */
+#define lanes_ssse3(a, b, which) ((which) == 0x20 ? (a) : (b))
+#define lanes_avx2(a, b, which) _mm256_permute2x128_si256(a, b, which)
+
+/* and so do pshufb and packs: each lane's bytes next to the other's */
+#define compact_ssse3(v) (v)
+#define compact_avx2(v) _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7))
+#define order_ssse3(v) (v)
+#define order_avx2(v) _mm256_permute4x64_epi64(v, 0xd8)
+
+#define leave_ssse3()
+
+CODEC_KERNELS(ssse3, scalar, __m128i, 16, table_ssse3, load12_ssse3, _mm_loadu_si128,
+              _mm_storeu_si128, _mm_set1_epi8, _mm_set1_epi16, _mm_set1_epi32, _mm_and_si128,
+              _mm_or_si128, _mm_add_epi8, _mm_sub_epi8, _mm_subs_epu8, _mm_min_epu8,
+              _mm_cmpgt_epi8, _mm_cmpeq_epi8, _mm_shuffle_epi8, _mm_srli_epi16, _mm_srli_epi32,
+              _mm_mulhi_epu16, _mm_mullo_epi16, _mm_maddubs_epi16, _mm_madd_epi16,
+              _mm_packus_epi16, _mm_unpacklo_epi8, _mm_unpackhi_epi8,
+              (unsigned)_mm_movemask_epi8, lanes_ssse3, compact_ssse3, order_ssse3,
+              leave_ssse3)
+CODEC_KERNELS(avx2, ssse3, __m256i, 32, table_avx2, load12_avx2, _mm256_loadu_si256,
+              _mm256_storeu_si256, _mm256_set1_epi8, _mm256_set1_epi16, _mm256_set1_epi32,
+              _mm256_and_si256, _mm256_or_si256, _mm256_add_epi8, _mm256_sub_epi8,
+              _mm256_subs_epu8, _mm256_min_epu8, _mm256_cmpgt_epi8, _mm256_cmpeq_epi8,
+              _mm256_shuffle_epi8, _mm256_srli_epi16, _mm256_srli_epi32, _mm256_mulhi_epu16,
+              _mm256_mullo_epi16, _mm256_maddubs_epi16, _mm256_madd_epi16, _mm256_packus_epi16,
+              _mm256_unpacklo_epi8, _mm256_unpackhi_epi8, (unsigned)_mm256_movemask_epi8,
+              lanes_avx2, compact_avx2, order_avx2, _mm256_zeroupper)
+
+#undef CODEC_KERNELS
+#undef table_ssse3
+#undef table_avx2
+#undef load12_ssse3
+#undef load12_avx2
+#undef lanes_ssse3
+#undef lanes_avx2
+#undef compact_ssse3
+#undef compact_avx2
+#undef order_ssse3
+#undef order_avx2
+#undef leave_ssse3
+
+#define dispatch(name) \
+	(__builtin_cpu_supports("avx2") ? name##_avx2 : \
+	 __builtin_cpu_supports("ssse3") ? name##_ssse3 : name##_scalar)
+#else
+#define dispatch(name) name##_scalar
+#endif
+
+int String_base64_encode_at(String dest, String_len dest_offset,
+                            const void *src, String_len n)
+{
+	String_len out;
+	char *w;
+
+	assert(dest != NULL);
+	assert(src != NULL || n == 0);
+
+	/* src may be part of dest */
+	if (aliased(dest, src)) {
+		return on_copy(String_base64_encode_at, dest, dest_offset, src, n);
+	}
+
+	if (n / 3 >= STRING_LEN_MAX / 4 - 1) {
+		return -1;
+	}
+
+	out = n / 3 * 4 + (n % 3 ? 4 : 0);
+
+	if ((w = start(dest, dest_offset, out)) == NULL) {
+		return -1;
+	}
+
+	dispatch(base64_encode)(src, n, w);
+	finish(dest, dest_offset, out);
+	return 0;
+}
+
+int String_base64_decode_at(String dest, String_len dest_offset,
+                            const void *src, String_len n)
+{
+	const unsigned char *p = src;
+	String_len digits = n, out = 0;
+	char *w;
+
+	assert(dest != NULL);
+	assert(src != NULL || n == 0);
+
+	/* src may be part of dest */
+	if (aliased(dest, src)) {
+		return on_copy(String_base64_decode_at, dest, dest_offset, src, n);
+	}
+
+	/* padding only ever ends a whole group of 4 */
+	if (n % 4 == 0 && n > 0 && p[n - 1] == '=') {
+		digits -= p[n - 2] == '=' ? 2 : 1;
+	}
+
+	if (digits % 4 != 1) {
+		out = digits / 4 * 3 + (digits % 4 ? digits % 4 - 1 : 0);
+	}
+
+	if ((w = start(dest, dest_offset, out)) == NULL) {
+		return -1;
+	}
+
+	if (digits % 4 == 1 || !dispatch(base64_decode)(p, digits, w)) {
+		finish(dest, dest_offset, 0);
+		return -1;
+	}
+
+	finish(dest, dest_offset, out);
+	return 0;
+}
+
+int String_hex_encode_at(String dest, String_len dest_offset,
+                         const void *src, String_len n)
+{
+	char *w;
+
+	assert(dest != NULL);
+	assert(src != NULL || n == 0);
+
+	/* src may be part of dest */
+	if (aliased(dest, src)) {
+		return on_copy(String_hex_encode_at, dest, dest_offset, src, n);
+	}
+
+	if (n >= STRING_LEN_MAX / 2 || (w = start(dest, dest_offset, 2 * n)) == NULL) {
+		return -1;
+	}
+
+	dispatch(hex_encode)(src, n, w);
+	finish(dest, dest_offset, 2 * n);
+	return 0;
+}
+
+int String_hex_decode_at(String dest, String_len dest_offset,
+                         const void *src, String_len n)
+{
+	char *w;
+
+	assert(dest != NULL);
+	assert(src != NULL || n == 0);
+
+	/* src may be part of dest */
+	if (aliased(dest, src)) {
+		return on_copy(String_hex_decode_at, dest, dest_offset, src, n);
+	}
+
+	if ((w = start(dest, dest_offset, n / 2)) == NULL) {
+		return -1;
+	}
+
+	if (n % 2 != 0 || !dispatch(hex_decode)(src, n / 2, w)) {
+		finish(dest, dest_offset, 0);
+		return -1;
+	}
+
+	finish(dest, dest_offset, n / 2);
+	return 0;
+}
+
+int String_url_encode_at(String dest, String_len dest_offset,
+                         const void *src, String_len n)
+{
+	const unsigned char *p = src;
+	String_len i, escaped = 0;
+	char *w;
+
+	assert(dest != NULL);
+	assert(src != NULL || n == 0);
+
+	/* src may be part of dest */
+	if (aliased(dest, src)) {
+		return on_copy(String_url_encode_at, dest, dest_offset, src, n);
+	}
+
+	for (i = 0; i < n; i++) {
+		escaped += !unreserved(p[i]);
+	}
+
+	if (n >= STRING_LEN_MAX - 1 || escaped > (STRING_LEN_MAX - 1 - n) / 2 ||
+	    (w = start(dest, dest_offset, n + 2 * escaped)) == NULL) {
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (unreserved(p[i])) {
+			*w++ = p[i];
+		} else {
+			*w++ = '%';
+			*w++ = url_digits[p[i] >> 4];
+			*w++ = url_digits[p[i] & 0x0f];
+		}
+	}
+
+	finish(dest, dest_offset, n + 2 * escaped);
+	return 0;
+}
+
+int String_url_decode_at(String dest, String_len dest_offset,
+                         const void *src, String_len n)
+{
+	const unsigned char *p = src, *end = p + n, *q;
+	String_len escapes = 0;
+	unsigned high, low;
+	int ok = YES;
+	char *w;
+
+	assert(dest != NULL);
+	assert(src != NULL || n == 0);
+
+	/* src may be part of dest */
+	if (aliased(dest, src)) {
+		return on_copy(String_url_decode_at, dest, dest_offset, src, n);
+	}
+
+	/* every escape takes 3 chars and gives 1 */
+	for (q = p; ok && n > 0 && (q = memchr(q, '%', end - q)) != NULL; q += 3) {
+		ok = end - q >= 3;
+		escapes++;
+	}
+
+	if ((w = start(dest, dest_offset, ok ? n - 2 * escapes : 0)) == NULL) {
+		return -1;
+	}
+
+	while (ok && p < end) {
+		if ((q = memchr(p, '%', end - p)) == NULL) {
+			q = end;
+		}
+
+		memcpy(w, p, q - p);
+		w += q - p;
+
+		if ((p = q) < end) {
+			high = hex_value(p[1]);
+			low = hex_value(p[2]);
+			ok = (high | low) < 16;
+			*w++ = high << 4 | low;
+			p += 3;
+		}
+	}
+
+	if (!ok) {
+		finish(dest, dest_offset, 0);
+		return -1;
+	}
+
+	finish(dest, dest_offset, n - 2 * escapes);
+	return 0;
+}
+
+int String_json_escape_at(String dest, String_len dest_offset,
+                          const void *src, String_len n)
+{
+	const unsigned char *p = src;
+	String_len i, at, from, end, out = n;
+	uint64_t mask;
+	char *w;
+
+	assert(dest != NULL);
+	assert(src != NULL || n == 0);
+
+	/* src may be part of dest */
+	if (aliased(dest, src)) {
+		return on_copy(String_json_escape_at, dest, dest_offset, src, n);
+	}
+
+	for (i = 0; i < n; i += BLOCK) {
+		for (mask = json_block(p + i, n - i); mask != 0; mask &= mask - 1) {
+			if (out >= STRING_LEN_MAX - 6) {
+				return -1;
+			}
+
+			out += json_escape_length(p[i + __builtin_ctzll(mask)]) - 1;
+		}
+	}
+
+	if ((w = start(dest, dest_offset, out)) == NULL) {
+		return -1;
+	}
+
+	for (i = 0; i < n; i += BLOCK) {
+		end = n - i < BLOCK ? n - i : BLOCK;
+
+		if ((mask = json_block(p + i, n - i)) == 0 && end == BLOCK) {
+			memcpy(w, p + i, BLOCK);
+			w += BLOCK;
+			continue;
+		}
+
+		for (from = 0; ; mask &= mask - 1) {
+			at = mask != 0 ? (String_len)__builtin_ctzll(mask) : end;
+			w = copy_run(w, p + i + from, at - from);
+
+			if (at == end) {
+				break;
+			}
+
+			*w++ = '\\';
+
+			if (p[i + at] >= 0x20) {
+				*w++ = p[i + at];
+			} else if (json_short[p[i + at]]) {
+				*w++ = json_short[p[i + at]];
+			} else {
+				memcpy(w, "u00", 3);
+				w[3] = hex_digits[p[i + at] >> 4];
+				w[4] = hex_digits[p[i + at] & 0x0f];
+				w += 5;
+			}
+
+			from = at + 1;
+		}
+	}
+
+	finish(dest, dest_offset, out);
+	return 0;
+}
+
+int String_json_unescape_at(String dest, String_len dest_offset,
+                            const void *src, String_len n)
+{
+	const unsigned char *p = src, *end = p + n, *q;
+	long cp, low;
+	char *w, *first;
+
+	assert(dest != NULL);
+	assert(src != NULL || n == 0);
+
+	/* src may be part of dest */
+	if (aliased(dest, src)) {
+		return on_copy(String_json_unescape_at, dest, dest_offset, src, n);
+	}
+
+	/* no escape sequence is shorter than what it stands for */
+	if ((w = first = start(dest, dest_offset, n)) == NULL) {
+		return -1;
+	}
+
+	while (p < end) {
+		if ((q = memchr(p, '\\', end - p)) == NULL) {
+			q = end;
+		}
+
+		memcpy(w, p, q - p);
+		w += q - p;
+
+		if ((p = q) == end) {
+			break;
+		}
+
+		if (end - p < 2) {
+			goto error;
+		}
+
+		switch (p[1]) {
+		case '"': case '\\': case '/':
+			*w++ = p[1];
+			break;
+		case 'b':
+			*w++ = '\b';
+			break;
+		case 'f':
+			*w++ = '\f';
+			break;
+		case 'n':
+			*w++ = '\n';
+			break;
+		case 'r':
+			*w++ = '\r';
+			break;
+		case 't':
+			*w++ = '\t';
+			break;
+		case 'u':
+			if (end - p < 6 || (cp = json_hex4(p + 2)) < 0) {
+				goto error;
+			}
+
+			/* surrogates only come in pairs, high then low */
+			if (cp >= 0xd800 && cp <= 0xdfff) {
+				if (cp > 0xdbff || end - p < 12 || p[6] != '\\' || p[7] != 'u' ||
+				    (low = json_hex4(p + 8)) < 0xdc00 || low > 0xdfff) {
+					goto error;
+				}
+
+				cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+				p += 6;
+			}
+
+			if (cp < 0x80) {
+				*w++ = cp;
+			} else if (cp < 0x800) {
+				*w++ = 0xc0 | cp >> 6;
+				*w++ = 0x80 | (cp & 0x3f);
+			} else if (cp < 0x10000) {
+				*w++ = 0xe0 | cp >> 12;
+				*w++ = 0x80 | (cp >> 6 & 0x3f);
+				*w++ = 0x80 | (cp & 0x3f);
+			} else {
+				*w++ = 0xf0 | cp >> 18;
+				*w++ = 0x80 | (cp >> 12 & 0x3f);
+				*w++ = 0x80 | (cp >> 6 & 0x3f);
+				*w++ = 0x80 | (cp & 0x3f);
+			}
+
+			p += 4;
+			break;
+		default:
+			goto error;
+		}
+
+		p += 2;
+	}
+
+	finish(dest, dest_offset, w - first);
+	return 0;
+
+error:
+	finish(dest, dest_offset, 0);
+	return -1;
+}
+
+static int on_copy(int (*codec)(String, String_len, const void *, String_len),
+                   String dest, String_len dest_offset, const void *src, String_len n)
+{
+	char *copy;
+	int ret;
+
+	if ((copy = malloc(n ? n : 1)) == NULL) {
+		return -1;
+	}
+
+	memcpy(copy, src, n);
+	ret = codec(dest, dest_offset, copy, n);
+	free(copy);
+	return ret;
+}
+
+static char *start(String dest, String_len dest_offset, String_len n)
+{
+	if (string_prepare_write(dest) || string_reserve_at(dest, dest_offset, n)) {
+		return NULL;
+	}
+
+	return dest->raw + dest_offset;
+}
+
+static void finish(String dest, String_len dest_offset, String_len n)
+{
+	dest->len = dest_offset + n + 1;
+	dest->raw[dest_offset + n] = '\0';
+}
+
+static void base64_encode_scalar(const unsigned char *src, String_len n, char *dst)
+{
+	String_len i;
+	uint32_t v;
+
+	for (i = 0; n - i >= 3; i += 3, dst += 4) {
+		v = (uint32_t)src[i] << 16 | src[i + 1] << 8 | src[i + 2];
+		dst[0] = base64_digits[v >> 18];
+		dst[1] = base64_digits[v >> 12 & 0x3f];
+		dst[2] = base64_digits[v >> 6 & 0x3f];
+		dst[3] = base64_digits[v & 0x3f];
+	}
+
+	if (i < n) {
+		v = (uint32_t)src[i] << 16 | (n - i == 2 ? src[i + 1] << 8 : 0);
+		dst[0] = base64_digits[v >> 18];
+		dst[1] = base64_digits[v >> 12 & 0x3f];
+		dst[2] = n - i == 2 ? base64_digits[v >> 6 & 0x3f] : '=';
+		dst[3] = '=';
+	}
+}
+
+static int base64_decode_scalar(const unsigned char *src, String_len n, char *dst)
+{
+	unsigned char a, b, c, d;
+	String_len i;
+	uint32_t v;
+
+	for (i = 0; n - i >= 4; i += 4, dst += 3) {
+		a = base64_value(src[i]);
+		b = base64_value(src[i + 1]);
+		c = base64_value(src[i + 2]);
+		d = base64_value(src[i + 3]);
+
+		if ((a | b | c | d) & 0x80) {
+			return 0;
+		}
+
+		v = (uint32_t)a << 18 | b << 12 | c << 6 | d;
+		dst[0] = v >> 16;
+		dst[1] = v >> 8;
+		dst[2] = v;
+	}
+
+	/* a group of 2 digits gives 1 byte, one of 3 gives 2 */
+	if (i < n) {
+		a = base64_value(src[i]);
+		b = base64_value(src[i + 1]);
+		c = n - i == 3 ? base64_value(src[i + 2]) : 0;
+
+		if ((a | b | c) & 0x80) {
+			return 0;
+		}
+
+		v = (uint32_t)a << 18 | b << 12 | c << 6;
+		dst[0] = v >> 16;
+
+		if (n - i == 3) {
+			dst[1] = v >> 8;
+		}
+	}
+
+	return 1;
+}
+
+static void hex_encode_scalar(const unsigned char *src, String_len n, char *dst)
+{
+	String_len i;
+
+	for (i = 0; i < n; i++) {
+		dst[2 * i] = hex_digits[src[i] >> 4];
+		dst[2 * i + 1] = hex_digits[src[i] & 0x0f];
+	}
+}
+
+static int hex_decode_scalar(const unsigned char *src, String_len n, char *dst)
+{
+	unsigned high, low;
+	String_len i;
+
+	for (i = 0; i < n; i++) {
+		high = hex_value(src[2 * i]);
+		low = hex_value(src[2 * i + 1]);
+
+		if ((high | low) > 15) {
+			return 0;
+		}
+
+		dst[i] = high << 4 | low;
+	}
+
+	return 1;
+}
+
+static uint64_t json_block(const unsigned char *p, String_len n)
+{
+	return dispatch(json_mask)(p, n < BLOCK ? n : BLOCK);
+}
+
+static uint64_t json_mask_scalar(const unsigned char *p, String_len n)
+{
+	const uint64_t ones = 0x0101010101010101ull, low = 0x7f * ones, high = 0x80 * ones;
+	uint64_t mask = 0, v, x, special;
+	String_len i;
+
+	/*
+	 * A word at a time: a byte is below 0x20 if it doesn't reach 0x80
+	 * adding 0x60 to its low 7 bits and has its high bit clear, and it's
+	 * zero if adding 0x7f to its low 7 bits doesn't reach 0x80 either.
+	 * The multiply gathers the high bits of the bytes into the top one.
+	 */
+	for (i = 0; n - i >= 8; i += 8) {
+		memcpy(&v, p + i, 8);
+		special = ~(((v & low) + 0x60 * ones) | v);
+		x = v ^ '"' * ones;
+		special |= ~(((x & low) + low) | x);
+		x = v ^ '\\' * ones;
+		special |= ~(((x & low) + low) | x);
+		mask |= ((special & high) >> 7) * 0x0102040810204080ull >> 56 << i;
+	}
+
+	for (; i < n; i++) {
+		mask |= (uint64_t)json_special(p[i]) << i;
+	}
+
+	return mask;
+}
+
+static char *copy_run(char *w, const unsigned char *p, String_len n)
+{
+	/* the moves overlap when n isn't a power of 2 */
+	if (n > 16) {
+		memcpy(w, p, n);
+	} else if (n >= 8) {
+		memcpy(w, p, 8);
+		memcpy(w + n - 8, p + n - 8, 8);
+	} else if (n >= 4) {
+		memcpy(w, p, 4);
+		memcpy(w + n - 4, p + n - 4, 4);
+	} else if (n > 0) {
+		w[0] = p[0];
+		w[n / 2] = p[n / 2];
+		w[n - 1] = p[n - 1];
+	}
+
+	return w + n;
+}
+
+static long json_hex4(const unsigned char *p)
+{
+	long cp = 0;
+	unsigned i, digit;
+
+	for (i = 0; i < 4; i++) {
+		if ((digit = hex_value(p[i])) > 15) {
+			return -1;
+		}
+
+		cp = cp << 4 | digit;
+	}
+
+	return cp;
+}
@@ -0,0 +1,881 @@
+/*
+ * File:    DStrings_format.c
+ * Author:  Eduardo Miravalls Sierra          <edu.miravalls@hotmail.com>
+ *
+ * Date:    2014-08-30 09:47
+ */
+
+/*
+ * Dynamic C Strings library.
+ * Copyright (C) 2014 Eduardo Miravalls Sierra
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <wchar.h>
+#include <assert.h>
+
+#include "DStrings_internal.h"
+
+/**
+ * @brief conversion flags.
+ */
+enum {
+	F_MINUS = 1 << 0, /**< '-' left justify */
+	F_PLUS  = 1 << 1, /**< '+' always print the sign */
+	F_SPACE = 1 << 2, /**< ' ' space instead of '+' */
+	F_ALT   = 1 << 3, /**< '#' alternate form */
+	F_ZERO  = 1 << 4, /**< '0' pad with zeros */
+};
+
+/**
+ * @brief length modifiers.
+ */
+enum {L_NONE, L_HH, L_H, L_L, L_LL, L_J, L_Z, L_T, L_BIG_L};
+
+/**
+ * @brief a parsed conversion specification.
+ */
+struct spec {
+	unsigned flags;
+	int width;     /**< 0 if none */
+	int precision; /**< -1 if none */
+	int length;    /**< L_* */
+	char conv;     /**< conversion specifier */
+};
+
+/**
+ * @brief an argument handed to snprintf.
+ */
+union arg {
+	double d;
+	long double ld;
+	wint_t wc;
+	const wchar_t *ws;
+};
+
+/**
+ * @brief output cursor.
+ * @details s->len is kept at pos + 1 while formatting, so growing s
+ * preserves everything written so far.
+ */
+struct out {
+	String s;
+	String_len pos; /**< next byte to be written */
+};
+
+static const char digit_pairs[201] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static const char lower_digits[] = "0123456789abcdef";
+static const char upper_digits[] = "0123456789ABCDEF";
+
+/**
+ * @brief makes room for n more chars.
+ *
+ * @param o output.
+ * @param n number of chars.
+ *
+ * @return -1 on error.
+ * @return 0 otherwise.
+ */
+static int reserve(struct out *o, size_t n);
+
+/**
+ * @brief writes n bytes of p.
+ */
+static int emit(struct out *o, const char *p, size_t n);
+
+/**
+ * @brief writes n copies of c.
+ */
+static int pad(struct out *o, char c, size_t n);
+
+/**
+ * @brief writes p, n chars long, padded upto sp->width.
+ */
+static int emit_padded(struct out *o, const struct spec *sp,
+                       const char *p, size_t n);
+
+/**
+ * @brief converts an integer according to sp.
+ *
+ * @param o output.
+ * @param sp conversion specification, one of d i u o x X p.
+ * @param value absolute value.
+ * @param negative if value has to be printed as negative.
+ *
+ * @return -1 on error.
+ * @return 0 otherwise.
+ */
+static int emit_integer(struct out *o, const struct spec *sp,
+                        uintmax_t value, int negative);
+
+/**
+ * @brief lets snprintf convert a single argument, straight into s.
+ * @details used for the conversions this file doesn't implement itself:
+ * floating point and wide chars. The argument has already been fetched,
+ * so if it doesn't fit, s is grown and the conversion retried.
+ *
+ * @param o output.
+ * @param sp conversion specification.
+ * @param arg the argument, the member in use depends on sp.
+ *
+ * @return -1 on error.
+ * @return 0 otherwise.
+ */
+static int delegate(struct out *o, const struct spec *sp, const union arg *arg);
+
+/**
+ * @brief snprintf of a single argument.
+ *
+ * @param dst output buffer.
+ * @param room dst's size.
+ * @param fmt rebuilt conversion specification, with "*.*" for width and
+ * precision.
+ * @param sp conversion specification.
+ * @param arg the argument.
+ *
+ * @return what snprintf returns.
+ */
+static int convert(char *dst, size_t room, const char *fmt,
+                   const struct spec *sp, const union arg *arg);
+
+/**
+ * @brief appends n bytes of p to s.
+ * @details unlike String_ncat, p can't point inside s.
+ *
+ * @param s String.
+ * @param p buffer.
+ * @param n number of bytes.
+ *
+ * @return -1 on error.
+ * @return 0 otherwise.
+ */
+static int append(String s, const char *p, String_len n);
+
+/**
+ * @brief writes value in decimal ending right before end.
+ *
+ * @param end one past the last digit.
+ * @param value number.
+ *
+ * @return the first digit.
+ */
+static char *dec(char *end, uintmax_t value);
+
+int String_append_i64(String s, int64_t value)
+{
+	char buf[21];
+	char *p;
+
+	assert(s != NULL);
+
+	/* negate in unsigned arithmetic, INT64_MIN has no positive */
+	p = dec(buf + sizeof(buf), value < 0 ? -(uint64_t)value : (uint64_t)value);
+
+	if (value < 0) {
+		*--p = '-';
+	}
+
+	return append(s, p, buf + sizeof(buf) - p);
+}
+
+int String_append_u64(String s, uint64_t value)
+{
+	char buf[20];
+	char *p;
+
+	assert(s != NULL);
+
+	p = dec(buf + sizeof(buf), value);
+	return append(s, p, buf + sizeof(buf) - p);
+}
+
+int String_append_hex(String s, uint64_t value)
+{
+	char buf[16];
+	char *p = buf + sizeof(buf);
+
+	assert(s != NULL);
+
+	do {
+		*--p = lower_digits[value & 15];
+	} while (value >>= 4);
+
+	return append(s, p, buf + sizeof(buf) - p);
+}
+
+int String_append_char(String s, char c)
+{
+	assert(s != NULL);
+	return append(s, &c, 1);
+}
+
+#if _BSD_SOURCE || _XOPEN_SOURCE >= 500 || _ISOC99_SOURCE || _POSIX_C_SOURCE >= 200112L
+
+int String_append_double(String s, double value)
+{
+	char buf[32];
+	int precision, n;
+
+	assert(s != NULL);
+
+	/* the shortest of %.15g, %.16g and %.17g that reads back as value */
+	for (precision = 15; ; precision++) {
+		n = snprintf(buf, sizeof(buf), "%.*g", precision, value);
+
+		if (precision == 17 || value != value || strtod(buf, NULL) == value) {
+			break;
+		}
+	}
+
+	return append(s, buf, n);
+}
+
+int String_format_at(String s, String_len offset, const char *fmt, ...)
+{
+	va_list vargs;
+	int ret;
+
+	va_start(vargs, fmt);
+	ret = String_vformat_at(s, offset, fmt, vargs);
+	va_end(vargs);
+
+	return ret;
+}
+
+int String_vformat_at(String s, String_len offset, const char *fmt, va_list ap)
+{
+	struct out o;
+	struct spec sp;
+	const char *p;
+	va_list args;
+	union arg arg;
+	uintmax_t u;
+	intmax_t i;
+	int ret = 0;
+
+	assert(s != NULL);
+	assert(fmt != NULL);
+
+	if (string_prepare_write(s) || string_reserve_at(s, offset, 0)) {
+		return -1;
+	}
+
+	o.s = s;
+	o.pos = offset;
+	s->len = offset + 1;
+	va_copy(args, ap);
+
+	while (*fmt != '\0' && ret == 0) {
+		/* copy the literal run upto the next conversion in one go */
+		if (*fmt != '%') {
+			/* runs are short, a plain loop beats strchr + strlen */
+			for (p = fmt + 1; *p != '\0' && *p != '%'; p++) {
+				continue;
+			}
+
+			ret = emit(&o, fmt, p - fmt);
+			fmt = p;
+			continue;
+		}
+
+		fmt++;
+		sp.flags = 0;
+		sp.width = 0;
+		sp.precision = -1;
+		sp.length = L_NONE;
+
+		for (;; fmt++) {
+			if (*fmt == '-') {
+				sp.flags |= F_MINUS;
+
+			} else if (*fmt == '+') {
+				sp.flags |= F_PLUS;
+
+			} else if (*fmt == ' ') {
+				sp.flags |= F_SPACE;
+
+			} else if (*fmt == '#') {
+				sp.flags |= F_ALT;
+
+			} else if (*fmt == '0') {
+				sp.flags |= F_ZERO;
+
+			} else {
+				break;
+			}
+		}
+
+		if (*fmt == '*') {
+			if ((sp.width = va_arg(args, int)) < 0) {
+				sp.flags |= F_MINUS;
+				sp.width = -sp.width;
+			}
+
+			fmt++;
+
+		} else {
+			while (*fmt >= '0' && *fmt <= '9') {
+				sp.width = sp.width * 10 + (*fmt++ - '0');
+			}
+
+			if (*fmt == '$') { /* positional arguments aren't supported */
+				ret = -1;
+				break;
+			}
+		}
+
+		if (*fmt == '.') {
+			fmt++;
+
+			if (*fmt == '*') {
+				if ((sp.precision = va_arg(args, int)) < 0) {
+					sp.precision = -1;
+				}
+
+				fmt++;
+
+			} else {
+				sp.precision = 0;
+
+				while (*fmt >= '0' && *fmt <= '9') {
+					sp.precision = sp.precision * 10 + (*fmt++ - '0');
+				}
+			}
+		}
+
+		switch (*fmt) {
+		case 'h':
+			sp.length = (*++fmt == 'h') ? (fmt++, L_HH) : L_H;
+			break;
+
+		case 'l':
+			sp.length = (*++fmt == 'l') ? (fmt++, L_LL) : L_L;
+			break;
+
+		case 'q':
+			sp.length = L_LL;
+			fmt++;
+			break;
+
+		case 'j':
+			sp.length = L_J;
+			fmt++;
+			break;
+
+		case 'z':
+			sp.length = L_Z;
+			fmt++;
+			break;
+
+		case 't':
+			sp.length = L_T;
+			fmt++;
+			break;
+
+		case 'L':
+			sp.length = L_BIG_L;
+			fmt++;
+			break;
+		}
+
+		sp.conv = *fmt++;
+
+		switch (sp.conv) {
+		case 'd':
+		case 'i':
+			switch (sp.length) {
+			case L_HH:
+				i = (signed char)va_arg(args, int);
+				break;
+
+			case L_H:
+				i = (short)va_arg(args, int);
+				break;
+
+			case L_L:
+				i = va_arg(args, long);
+				break;
+
+			case L_LL:
+				i = va_arg(args, long long);
+				break;
+
+			case L_J:
+				i = va_arg(args, intmax_t);
+				break;
+
+			case L_Z:
+			case L_T:
+				i = va_arg(args, ptrdiff_t);
+				break;
+
+			default:
+				i = va_arg(args, int);
+			}
+
+			/* negate in unsigned arithmetic, INTMAX_MIN has no positive */
+			ret = emit_integer(&o, &sp, i < 0 ? -(uintmax_t)i : (uintmax_t)i,
+			                   i < 0);
+			break;
+
+		case 'u':
+		case 'o':
+		case 'x':
+		case 'X':
+			switch (sp.length) {
+			case L_HH:
+				u = (unsigned char)va_arg(args, unsigned);
+				break;
+
+			case L_H:
+				u = (unsigned short)va_arg(args, unsigned);
+				break;
+
+			case L_L:
+				u = va_arg(args, unsigned long);
+				break;
+
+			case L_LL:
+				u = va_arg(args, unsigned long long);
+				break;
+
+			case L_J:
+				u = va_arg(args, uintmax_t);
+				break;
+
+			case L_Z:
+				u = va_arg(args, size_t);
+				break;
+
+			case L_T:
+				u = (size_t)va_arg(args, ptrdiff_t);
+				break;
+
+			default:
+				u = va_arg(args, unsigned);
+			}
+
+			ret = emit_integer(&o, &sp, u, NO);
+			break;
+
+		case 'p':
+			if ((p = va_arg(args, void *)) == NULL) {
+				ret = emit_padded(&o, &sp, "(nil)", 5);
+
+			} else {
+				sp.flags |= F_ALT;
+				ret = emit_integer(&o, &sp, (uintptr_t)p, NO);
+			}
+
+			break;
+
+		case 'c':
+			if (sp.length == L_L) {
+				arg.wc = va_arg(args, wint_t);
+				ret = delegate(&o, &sp, &arg);
+
+			} else {
+				char c = (char)va_arg(args, int);
+
+				ret = emit_padded(&o, &sp, &c, 1);
+			}
+
+			break;
+
+		case 's':
+			if (sp.length == L_L) {
+				arg.ws = va_arg(args, const wchar_t *);
+				ret = delegate(&o, &sp, &arg);
+				break;
+			}
+
+			if ((p = va_arg(args, const char *)) == NULL) {
+				p = "(null)";
+			}
+
+			ret = emit_padded(&o, &sp, p, sp.precision < 0 ? strlen(p) :
+			                  strnlen(p, sp.precision));
+			break;
+
+		case 'f':
+		case 'F':
+		case 'e':
+		case 'E':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			if (sp.length == L_BIG_L) {
+				arg.ld = va_arg(args, long double);
+				ret = delegate(&o, &sp, &arg);
+
+			} else {
+				arg.d = va_arg(args, double);
+				ret = delegate(&o, &sp, &arg);
+			}
+
+			break;
+
+		case 'n':
+			u = o.pos - offset;
+
+			switch (sp.length) {
+			case L_HH:
+				*va_arg(args, signed char *) = u;
+				break;
+
+			case L_H:
+				*va_arg(args, short *) = u;
+				break;
+
+			case L_L:
+				*va_arg(args, long *) = u;
+				break;
+
+			case L_LL:
+				*va_arg(args, long long *) = u;
+				break;
+
+			case L_J:
+				*va_arg(args, intmax_t *) = u;
+				break;
+
+			case L_Z:
+				*va_arg(args, size_t *) = u;
+				break;
+
+			case L_T:
+				*va_arg(args, ptrdiff_t *) = u;
+				break;
+
+			default:
+				*va_arg(args, int *) = u;
+			}
+
+			break;
+
+		case '%':
+			ret = emit(&o, "%", 1);
+			break;
+
+		default: /* unknown conversion */
+			ret = -1;
+		}
+	}
+
+	va_end(args);
+	s->raw[o.pos] = '\0';
+	s->len = o.pos + 1;
+	return ret;
+}
+
+static int reserve(struct out *o, size_t n)
+{
+	if (!fits(o->pos, n)) {
+		return -1;
+	}
+
+	if (o->pos + n + 1 <= o->s->size) {
+		return 0;
+	}
+
+	o->s->len = o->pos + 1;
+	return string_reserve_at(o->s, o->pos, n);
+}
+
+static int emit(struct out *o, const char *p, size_t n)
+{
+	if (reserve(o, n)) {
+		return -1;
+	}
+
+	memcpy(o->s->raw + o->pos, p, n);
+	o->pos += n;
+	return 0;
+}
+
+static int pad(struct out *o, char c, size_t n)
+{
+	if (reserve(o, n)) {
+		return -1;
+	}
+
+	memset(o->s->raw + o->pos, c, n);
+	o->pos += n;
+	return 0;
+}
+
+static int emit_padded(struct out *o, const struct spec *sp,
+                       const char *p, size_t n)
+{
+	size_t fill = (size_t)sp->width > n ? sp->width - n : 0;
+
+	if (fill == 0) {
+		return emit(o, p, n);
+	}
+
+	if (reserve(o, n + fill)) {
+		return -1;
+	}
+
+	if (!(sp->flags & F_MINUS)) {
+		pad(o, ' ', fill);
+	}
+
+	emit(o, p, n);
+
+	if (sp->flags & F_MINUS) {
+		pad(o, ' ', fill);
+	}
+
+	return 0;
+}
+
+static int emit_integer(struct out *o, const struct spec *sp,
+                        uintmax_t value, int negative)
+{
+	char buf[sizeof(uintmax_t) * 3 + 1];
+	char *end = buf + sizeof(buf);
+	char *digits = end;
+	const char *prefix = "";
+	size_t ndigits, nprefix, zeros = 0, total, fill = 0;
+	char *w;
+
+	if (value != 0 || sp->precision != 0) {
+		switch (sp->conv) {
+		case 'o':
+			do {
+				*--digits = '0' + (value & 7);
+			} while (value >>= 3);
+
+			break;
+
+		case 'x':
+		case 'p':
+		case 'X': {
+			const char *set = sp->conv == 'X' ? upper_digits : lower_digits;
+
+			if (sp->flags & F_ALT && value != 0) {
+				prefix = sp->conv == 'X' ? "0X" : "0x";
+			}
+
+			do {
+				*--digits = set[value & 15];
+			} while (value >>= 4);
+
+			break;
+		}
+
+		default:
+			digits = dec(end, value);
+		}
+	}
+
+	ndigits = end - digits;
+
+	if (sp->conv == 'o' && sp->flags & F_ALT && (ndigits == 0 || *digits != '0') &&
+	    (sp->precision < 0 || (size_t)sp->precision <= ndigits)) {
+		*--digits = '0';
+		ndigits++;
+	}
+
+	if (sp->conv == 'd' || sp->conv == 'i') {
+		if (negative) {
+			prefix = "-";
+
+		} else if (sp->flags & F_PLUS) {
+			prefix = "+";
+
+		} else if (sp->flags & F_SPACE) {
+			prefix = " ";
+		}
+	}
+
+	nprefix = strlen(prefix);
+
+	if (sp->precision >= 0 && (size_t)sp->precision > ndigits) {
+		zeros = sp->precision - ndigits;
+	}
+
+	total = nprefix + zeros + ndigits;
+
+	if ((size_t)sp->width > total) {
+		if ((sp->flags & (F_ZERO | F_MINUS)) == F_ZERO && sp->precision < 0) {
+			zeros += sp->width - total;
+
+		} else {
+			fill = sp->width - total;
+		}
+
+		total = sp->width;
+	}
+
+	if (reserve(o, total)) {
+		return -1;
+	}
+
+	w = o->s->raw + o->pos;
+	o->pos += total;
+
+	if (fill > 0 && !(sp->flags & F_MINUS)) {
+		memset(w, ' ', fill);
+		w += fill;
+	}
+
+	while (nprefix-- > 0) {
+		*w++ = *prefix++;
+	}
+
+	if (zeros > 0) {
+		memset(w, '0', zeros);
+		w += zeros;
+	}
+
+	memcpy(w, digits, ndigits);
+
+	if (fill > 0 && sp->flags & F_MINUS) {
+		memset(w + ndigits, ' ', fill);
+	}
+
+	return 0;
+}
+
+static int delegate(struct out *o, const struct spec *sp, const union arg *arg)
+{
+	char fmt[16];
+	char *f = fmt;
+	size_t room;
+	int n;
+
+	*f++ = '%';
+
+	if (sp->flags & F_MINUS) *f++ = '-';
+	if (sp->flags & F_PLUS) *f++ = '+';
+	if (sp->flags & F_SPACE) *f++ = ' ';
+	if (sp->flags & F_ALT) *f++ = '#';
+	if (sp->flags & F_ZERO) *f++ = '0';
+
+	/* a negative precision is taken as if it was omitted */
+	*f++ = '*';
+	*f++ = '.';
+	*f++ = '*';
+
+	if (sp->length == L_L) {
+		*f++ = 'l';
+
+	} else if (sp->length == L_BIG_L) {
+		*f++ = 'L';
+	}
+
+	*f++ = sp->conv;
+	*f = '\0';
+
+	/* most conversions fit in 32 bytes, avoid a second pass for them */
+	if (reserve(o, sp->width > 32 ? sp->width : 32)) {
+		return -1;
+	}
+
+	room = o->s->size - o->pos;
+
+	if ((n = convert(o->s->raw + o->pos, room, fmt, sp, arg)) < 0) {
+		return -1;
+	}
+
+	if ((size_t)n >= room) {
+		if (reserve(o, n)) {
+			return -1;
+		}
+
+		n = convert(o->s->raw + o->pos, o->s->size - o->pos, fmt, sp, arg);
+	}
+
+	o->pos += n;
+	return 0;
+}
+
+static int convert(char *dst, size_t room, const char *fmt,
+                   const struct spec *sp, const union arg *arg)
+{
+	switch (sp->conv) {
+	case 'c':
+		return snprintf(dst, room, fmt, sp->width, sp->precision, arg->wc);
+
+	case 's':
+		return snprintf(dst, room, fmt, sp->width, sp->precision, arg->ws);
+
+	default:
+		if (sp->length == L_BIG_L) {
+			return snprintf(dst, room, fmt, sp->width, sp->precision, arg->ld);
+		}
+
+		return snprintf(dst, room, fmt, sp->width, sp->precision, arg->d);
+	}
+}
+
+#endif
+
+static int append(String s, const char *p, String_len n)
+{
+	String_len offset = used(s);
+
+	if (string_prepare_write(s) || string_reserve_at(s, offset, n)) {
+		return -1;
+	}
+
+	memcpy(s->raw + offset, p, n);
+	s->len = offset + n + 1;
+	s->raw[offset + n] = '\0';
+	return 0;
+}
+
+static char *dec(char *end, uintmax_t value)
+{
+	char *p = end;
+
+	/* two digits at a time */
+	while (value >= 100) {
+		unsigned i = (value % 100) * 2;
+
+		value /= 100;
+		*--p = digit_pairs[i + 1];
+		*--p = digit_pairs[i];
+	}
+
+	if (value >= 10) {
+		*--p = digit_pairs[value * 2 + 1];
+		*--p = digit_pairs[value * 2];
+
+	} else {
+		*--p = '0' + value;
+	}
+
+	return p;
+}
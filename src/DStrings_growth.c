@@ -0,0 +1,107 @@
+/*
+ * File:    DStrings_growth.c
+ * Author:  Eduardo Miravalls Sierra          <edu.miravalls@hotmail.com>
+ *
+ * Date:    2014-08-30 09:47
+ */
+
+/*
+ * Dynamic C Strings library.
+ * Copyright (C) 2014 Eduardo Miravalls Sierra
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "DStrings.h"
+
+#define PAGE_SIZE (4 * 1024)
+#define PAGES_THRESHOLD (64 * 1024)
+
+#define HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+/**
+ * @brief rounds n up to a multiple of unit, a power of 2.
+ *
+ * @param n capacity.
+ * @param unit granularity.
+ *
+ * @return the rounded capacity, or STRING_LEN_MAX if it doesn't fit.
+ */
+static String_len round_up(String_len n, String_len unit);
+
+/**
+ * @brief grows size by half, but at least upto needed.
+ *
+ * @param size current capacity.
+ * @param needed minimum capacity.
+ *
+ * @return the new capacity, or STRING_LEN_MAX if it doesn't fit.
+ */
+static String_len one_and_a_half(String_len size, String_len needed);
+
+String_len String_growth_pow2(String_len size, String_len needed)
+{
+	String_len n = 1;
+
+	(void)size;
+
+	if (needed > STRING_LEN_MAX / 2 + 1) {
+		return STRING_LEN_MAX;
+	}
+
+	while (n < needed) {
+		n <<= 1;
+	}
+
+	return n;
+}
+
+String_len String_growth_1_5x(String_len size, String_len needed)
+{
+	return round_up(one_and_a_half(size, needed), 16);
+}
+
+String_len String_growth_pages(String_len size, String_len needed)
+{
+	if (needed <= PAGES_THRESHOLD) {
+		return String_growth_pow2(size, needed);
+	}
+
+	return round_up(one_and_a_half(size, needed), PAGE_SIZE);
+}
+
+String_len String_growth_hugepages(String_len size, String_len needed)
+{
+	if (needed <= HUGEPAGE_SIZE) {
+		return String_growth_pow2(size, needed);
+	}
+
+	return round_up(one_and_a_half(size, needed), HUGEPAGE_SIZE);
+}
+
+static String_len round_up(String_len n, String_len unit)
+{
+	if (n > STRING_LEN_MAX - (unit - 1)) {
+		return STRING_LEN_MAX;
+	}
+
+	return (n + unit - 1) & ~(unit - 1);
+}
+
+static String_len one_and_a_half(String_len size, String_len needed)
+{
+	String_len n = size > STRING_LEN_MAX - size / 2 ? STRING_LEN_MAX : size + size / 2;
+
+	return n > needed ? n : needed;
+}
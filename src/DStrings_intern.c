@@ -0,0 +1,236 @@
+/*
+ * File:    DStrings_intern.c
+ * Author:  Eduardo Miravalls Sierra          <edu.miravalls@hotmail.com>
+ *
+ * Date:    2014-08-30 09:47
+ */
+
+/*
+ * Dynamic C Strings library.
+ * Copyright (C) 2014 Eduardo Miravalls Sierra
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "DStrings_internal.h"
+
+/**
+ * @brief number of independently locked shards, a power of 2.
+ */
+#define SHARDS 16
+
+/**
+ * @brief initial number of slots of each shard, a power of 2.
+ */
+#define SHARD_SLOTS 64
+
+/*
+ * The table is split in shards, selected by the hash's top bits, so
+ * threads interning different strings rarely wait for each other. Each
+ * shard is an open addressing hash set with linear probing.
+ */
+struct shard {
+	pthread_mutex_t lock;
+	String *slots;  /**< NULL means empty */
+	size_t mask;    /**< number of slots - 1 */
+	size_t count;   /**< used slots */
+};
+
+static struct shard table[SHARDS] = {
+#define SHARD_INIT {PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0}
+	SHARD_INIT, SHARD_INIT, SHARD_INIT, SHARD_INIT,
+	SHARD_INIT, SHARD_INIT, SHARD_INIT, SHARD_INIT,
+	SHARD_INIT, SHARD_INIT, SHARD_INIT, SHARD_INIT,
+	SHARD_INIT, SHARD_INIT, SHARD_INIT, SHARD_INIT,
+#undef SHARD_INIT
+};
+
+#define shard_of(hash) (&table[(hash) >> 60 & (SHARDS - 1)])
+
+/**
+ * @brief doubles sh's slots, or allocates them the first time.
+ *
+ * @param sh shard.
+ *
+ * @return -1 if allocation failed.
+ * @return 0 otherwise.
+ */
+static int grow(struct shard *sh);
+
+/**
+ * @brief creates the canonical copy of src.
+ *
+ * @param src buffer.
+ * @param n src's length.
+ * @param hash src's hash.
+ *
+ * @return a new immutable String.
+ * @return NULL if allocation failed.
+ */
+static String new_interned(const void *src, String_len n, uint64_t hash);
+
+/**
+ * @brief looks up src in the table, adding it if it's not there.
+ *
+ * @param src buffer.
+ * @param n src's length.
+ * @param hash src's hash.
+ *
+ * @return the interned String.
+ * @return NULL if allocation failed.
+ */
+static String intern(const void *src, String_len n, uint64_t hash);
+
+String String_intern(String s)
+{
+	assert(s != NULL);
+
+	if (s->flags & INTERNED) {
+		return s;
+	}
+
+	return intern(s->raw, used(s), String_hash(s));
+}
+
+String String_intern_buf(const void *src, String_len n)
+{
+	assert(src != NULL || n == 0);
+	return intern(src, n, string_hash_bytes(src, n));
+}
+
+int String_is_interned(String s)
+{
+	assert(s != NULL);
+	return (s->flags & INTERNED) != 0;
+}
+
+void String_intern_clear(void)
+{
+	struct shard *sh;
+	size_t i;
+
+	for (sh = table; sh < table + SHARDS; sh++) {
+		pthread_mutex_lock(&sh->lock);
+
+		for (i = 0; sh->count > 0 && i <= sh->mask; i++) {
+			if (sh->slots[i] != NULL) {
+				/* give it back its ownership so String_free releases it */
+				sh->slots[i]->flags = 0;
+				sh->slots[i]->resizable = YES;
+				String_free(&sh->slots[i]);
+				sh->count--;
+			}
+		}
+
+		free(sh->slots);
+		sh->slots = NULL;
+		sh->mask = 0;
+		pthread_mutex_unlock(&sh->lock);
+	}
+}
+
+static String intern(const void *src, String_len n, uint64_t hash)
+{
+	struct shard *sh = shard_of(hash);
+	String s;
+	size_t i;
+
+	pthread_mutex_lock(&sh->lock);
+
+	if (sh->count >= (sh->mask + 1) / 4 * 3 && grow(sh)) {
+		pthread_mutex_unlock(&sh->lock);
+		return NULL;
+	}
+
+	for (i = hash & sh->mask; (s = sh->slots[i]) != NULL; i = (i + 1) & sh->mask) {
+		if (s->hash == hash && used(s) == n && memcmp(s->raw, src, n) == 0) {
+			pthread_mutex_unlock(&sh->lock);
+			return s;
+		}
+	}
+
+	if ((s = new_interned(src, n, hash)) != NULL) {
+		sh->slots[i] = s;
+		sh->count++;
+	}
+
+	pthread_mutex_unlock(&sh->lock);
+	return s;
+}
+
+static int grow(struct shard *sh)
+{
+	size_t slots = sh->slots ? 2 * (sh->mask + 1) : SHARD_SLOTS;
+	String *new_slots;
+	size_t i, j;
+
+	if ((new_slots = calloc(slots, sizeof(*new_slots))) == NULL) {
+		return -1;
+	}
+
+	for (i = 0; sh->slots != NULL && i <= sh->mask; i++) {
+		if (sh->slots[i] != NULL) {
+			j = sh->slots[i]->hash & (slots - 1);
+
+			while (new_slots[j] != NULL) {
+				j = (j + 1) & (slots - 1);
+			}
+
+			new_slots[j] = sh->slots[i];
+		}
+	}
+
+	free(sh->slots);
+	sh->slots = new_slots;
+	sh->mask = slots - 1;
+	return 0;
+}
+
+static String new_interned(const void *src, String_len n, uint64_t hash)
+{
+	String s;
+
+	/* interned Strings outlive any arena or custom allocator */
+	if ((s = String_new_with(&string_stdlib_allocator, NULL, 0)) == NULL) {
+		return NULL;
+	}
+
+	if (String_ncpy(s, src, n)) {
+		String_free(&s);
+		return NULL;
+	}
+
+	/* non resizable, like stolen strings, and read only on top of that */
+	s->resizable = NO;
+	s->hash = hash;
+	s->flags = HASHED | CHECKED | FROZEN | INTERNED;
+
+	/*
+	 * Everything that's cached is worked out now: interned Strings are
+	 * shared by threads, so reading them mustn't write to them.
+	 */
+	if (StringView_utf8_validate(StringView_new(src, n))) {
+		s->flags |= UTF8;
+
+		if (StringView_is_ascii(StringView_new(src, n))) {
+			s->flags |= ASCII;
+		}
+	}
+
+	return s;
+}
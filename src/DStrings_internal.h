@@ -0,0 +1,201 @@
+/*
+ * File:    DStrings_internal.h
+ * Author:  Eduardo Miravalls Sierra          <edu.miravalls@hotmail.com>
+ *
+ * Date:    2014-08-30 09:47
+ *
+ * struct string and helpers shared by the library's translation units.
+ * Not part of the public API.
+ */
+
+/*
+ * Dynamic C Strings library.
+ * Copyright (C) 2014 Eduardo Miravalls Sierra
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DSTRINGS_INTERNAL_H_
+#define _DSTRINGS_INTERNAL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "DStrings.h"
+
+enum {NO = 0, YES};
+
+/**
+ * @brief struct string's flags.
+ */
+enum {
+	HASHED = 1 << 0,   /**< hash holds the contents' hash */
+	FROZEN = 1 << 1,   /**< immutable, every mutator fails */
+	INTERNED = 1 << 2, /**< canonical copy owned by the intern table */
+	MAPPED = 1 << 3,   /**< raw is a file mapping, unmapped on free */
+	CHECKED = 1 << 4,  /**< UTF8 and ASCII are known */
+	UTF8 = 1 << 5,     /**< the contents are valid UTF-8 */
+	ASCII = 1 << 6,    /**< the contents are 7 bit ASCII */
+};
+
+/**
+ * @brief flags caching facts about the contents, every mutator clears them.
+ */
+#define CACHED (HASHED | CHECKED | UTF8 | ASCII)
+
+#ifndef DSTRINGS_SSO_SIZE
+/**
+ * @brief bytes of the inline buffer short strings live in, '\0' included.
+ */
+#define DSTRINGS_SSO_SIZE 24
+#endif
+
+/**
+ * @brief reference count of a raw string shared by several Strings.
+ * @details allocated, like the raw string, with the Strings' allocator.
+ */
+struct share {
+	atomic_uint refs;
+};
+
+/*
+ * With DSTRINGS_FAM the handle and the String's initial contents are a
+ * single block: buf is sized when the String is allocated, after the
+ * contents it's created with. Otherwise buf is a fixed size inline buffer
+ * for short strings. Either way, a String that outgrows buf moves its
+ * contents to a separate heap buffer, since the handle itself can't move.
+ */
+struct string {
+	char *raw;     /**< raw string, may point to buf */
+	String_len len;  /**< includes trailing \0 */
+	String_len size; /**< allocated space */
+	const String_allocator *allocator; /**< where s and raw live */
+	String_growth growth; /**< picks raw's new size */
+	_Atomic(struct share *) share; /**< not NULL if raw is shared, copy on write */
+	uint64_t hash; /**< valid if HASHED is set */
+#ifdef DSTRINGS_FAM
+	String_len buf_size; /**< buf's capacity */
+	char resizable;
+	unsigned char flags;
+	char buf[];
+#else
+	char resizable;
+	unsigned char flags;
+	char buf[DSTRINGS_SSO_SIZE]; /**< inline storage for short strings */
+#endif
+};
+
+#define resizable(s) ((s)->resizable)
+#define writable(s) (!((s)->flags & FROZEN))
+#define shared(s) (atomic_load_explicit(&(s)->share, memory_order_relaxed) != NULL)
+#define is_inline(s) ((s)->raw == (s)->buf)
+
+/* number of chars, trailing '\0' excluded */
+#define used(s) ((s)->len ? (s)->len - 1 : 0)
+
+/* whether offset + n + 1 can be computed without overflowing */
+#define fits(offset, n) \
+	((offset) < STRING_LEN_MAX && (n) <= STRING_LEN_MAX - 1 - (offset))
+
+/* forget whatever was cached about s' contents */
+#define touch(s) ((s)->flags &= ~CACHED)
+
+#ifdef DSTRINGS_FAM
+#define buf_size(s) ((s)->buf_size)
+#define handle_size(s) (offsetof(struct string, buf) + (s)->buf_size)
+#else
+#define buf_size(s) DSTRINGS_SSO_SIZE
+#define handle_size(s) sizeof(*(s))
+#endif
+
+#define mem_alloc(a, n) ((a)->alloc((a)->ctx, n))
+#define mem_resize(a, p, old_size, n) ((a)->resize((a)->ctx, p, old_size, n))
+#define mem_release(a, p, size) ((a)->release((a)->ctx, p, size))
+
+/**
+ * @brief gets s ready to be modified.
+ * @details every mutator has to call it first: it fails on immutable
+ * Strings, gives s a private copy of its raw string if it's shared and
+ * forgets whatever was cached about its contents.
+ *
+ * @param s String.
+ *
+ * @return -1 if s can't be modified or the copy couldn't be allocated.
+ * @return 0 otherwise.
+ */
+int string_prepare_write(String s);
+
+/**
+ * @brief makes room in s to write n chars at offset, plus a '\0'.
+ * @details the first offset bytes of s are preserved, and if offset is
+ * past s' length the gap is padded with 0's. s' length isn't updated.
+ *
+ * @param s String, already prepared for writing.
+ * @param offset first byte that is going to be written.
+ * @param n number of chars that are going to be written.
+ *
+ * @return -1 on error or if s is not resizable and too small.
+ * @return 0 otherwise.
+ */
+int string_reserve_at(String s, String_len offset, String_len n);
+
+/**
+ * @brief finds where p is after s' buffer was moved by a reserve.
+ *
+ * @param s String.
+ * @param old s' buffer before the reserve.
+ * @param n s' content length before the reserve.
+ * @param p source buffer.
+ *
+ * @return the pointer to use in place of p.
+ */
+const char *string_rebase(String s, uintptr_t old, String_len n, const char *p);
+
+/**
+ * @brief malloc, realloc and free.
+ */
+extern const String_allocator string_stdlib_allocator;
+
+/**
+ * @brief unmaps the raw string of a String made by String_new_mmap_file.
+ *
+ * @param s String.
+ */
+void string_unmap(String s);
+
+/**
+ * @brief hashes n bytes of p.
+ * @details wyhash (https://github.com/wangyi-fudan/wyhash): reads 8 bytes
+ * at a time and mixes them with 64x64->128 bit multiplications.
+ *
+ * @param p buffer.
+ * @param n p's length.
+ *
+ * @return p's hash.
+ */
+uint64_t string_hash_bytes(const void *p, size_t n);
+
+/**
+ * @brief hashes n bytes of p, ignoring the case of ASCII letters.
+ * @details same as hashing p with its ASCII letters in lower case.
+ *
+ * @param p buffer.
+ * @param n p's length.
+ *
+ * @return p's hash.
+ */
+uint64_t string_hash_bytes_nocase(const void *p, size_t n);
+
+#endif /* _DSTRINGS_INTERNAL_H_ */
@@ -0,0 +1,322 @@
+/*
+ * File:    DStrings_io.c
+ * Author:  Eduardo Miravalls Sierra          <edu.miravalls@hotmail.com>
+ *
+ * Date:    2014-08-30 09:47
+ */
+
+/*
+ * Dynamic C Strings library.
+ * Copyright (C) 2014 Eduardo Miravalls Sierra
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _XOPEN_SOURCE 700 /* IOV_MAX */
+
+#include <stdio.h>
+#include <errno.h>
+#include <limits.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "DStrings_internal.h"
+
+/**
+ * @brief how much room to make when the size to read is unknown.
+ */
+#define READ_CHUNK (64 * 1024)
+
+/**
+ * @brief maximum number of Strings written by a single writev.
+ */
+#ifdef IOV_MAX
+#define BATCH (IOV_MAX < 1024 ? IOV_MAX : 1024)
+#else
+#define BATCH 16
+#endif
+
+/**
+ * @brief reads from fd straight into s' spare capacity until EOF.
+ *
+ * @param s String, already prepared for writing.
+ * @param fd file descriptor.
+ * @param hint expected number of bytes, 0 if unknown.
+ *
+ * @return -1 on error, what was read so far is kept.
+ * @return 0 otherwise.
+ */
+static int read_all(String s, int fd, size_t hint);
+
+/**
+ * @brief guesses how much is left to be read from fd.
+ *
+ * @param fd file descriptor.
+ *
+ * @return the number of bytes left if fd is a regular file.
+ * @return 0 otherwise.
+ */
+static size_t remaining(int fd);
+
+int String_read_fd(String s, int fd)
+{
+	assert(s != NULL);
+
+	if (string_prepare_write(s)) {
+		return -1;
+	}
+
+	return read_all(s, fd, remaining(fd));
+}
+
+int String_read_file(String s, const char *path)
+{
+	int fd, ret;
+
+	assert(s != NULL);
+	assert(path != NULL);
+
+	if (string_prepare_write(s) || (fd = open(path, O_RDONLY)) < 0) {
+		return -1;
+	}
+
+	ret = read_all(s, fd, remaining(fd));
+	close(fd);
+	return ret;
+}
+
+int String_write_fd(String s, int fd)
+{
+	const char *p;
+	String_len left;
+	ssize_t n;
+
+	assert(s != NULL);
+
+	p = s->raw;
+	left = used(s);
+
+	while (left > 0) {
+		if ((n = write(fd, p, left)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return -1;
+		}
+
+		p += n;
+		left -= n;
+	}
+
+	return 0;
+}
+
+int String_writev_fd(int fd, const String *strings, unsigned count)
+{
+	struct iovec iov[BATCH];
+	unsigned first = 0, i, n;
+	ssize_t written;
+
+	assert(strings != NULL || count == 0);
+
+	while (first < count) {
+		n = count - first < BATCH ? count - first : BATCH;
+
+		for (i = 0; i < n; i++) {
+			iov[i].iov_base = strings[first + i]->raw;
+			iov[i].iov_len = used(strings[first + i]);
+		}
+
+		for (i = 0; i < n; ) {
+			if ((written = writev(fd, iov + i, n - i)) < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+
+				return -1;
+			}
+
+			/* skip what was written, a write may stop in the middle */
+			while (i < n && (size_t)written >= iov[i].iov_len) {
+				written -= iov[i].iov_len;
+				i++;
+			}
+
+			if (i < n) {
+				iov[i].iov_base = (char *)iov[i].iov_base + written;
+				iov[i].iov_len -= written;
+			}
+		}
+
+		first += n;
+	}
+
+	return 0;
+}
+
+ssize_t String_readv_fd(int fd, String *strings, unsigned count)
+{
+	struct iovec iov[BATCH];
+	String_len before[BATCH];
+	unsigned i, n;
+	ssize_t got, left;
+
+	assert(strings != NULL || count == 0);
+
+	n = count < BATCH ? count : BATCH;
+
+	for (i = 0; i < n; i++) {
+		if (string_prepare_write(strings[i])) {
+			return -1;
+		}
+
+		before[i] = used(strings[i]);
+		iov[i].iov_base = strings[i]->raw + before[i];
+		/* the last byte is kept for the '\0' */
+		iov[i].iov_len = strings[i]->size - before[i] - 1;
+	}
+
+	while ((got = readv(fd, iov, n)) < 0 && errno == EINTR) {
+		continue;
+	}
+
+	if (got < 0) {
+		return -1;
+	}
+
+	for (i = 0, left = got; i < n; i++) {
+		String_len m = (size_t)left < iov[i].iov_len ? (String_len)left : iov[i].iov_len;
+
+		strings[i]->len = before[i] + m + 1;
+		strings[i]->raw[before[i] + m] = '\0';
+		left -= m;
+	}
+
+	return got;
+}
+
+int String_getline(String s, FILE *f)
+{
+	char *p, *end;
+	int c, ret = 0;
+
+	assert(s != NULL);
+	assert(f != NULL);
+
+	if (string_prepare_write(s)) {
+		return -1;
+	}
+
+	/* a malloc'ed buffer can be handed to getdelim, which scans stdio's
+	 * buffer with memchr instead of going char by char */
+	if (s->allocator == &string_stdlib_allocator && resizable(s) && !is_inline(s)) {
+		size_t size = s->size;
+		ssize_t n;
+
+		n = getdelim(&s->raw, &size, '\n', f);
+		s->size = size;
+		s->len = n > 0 ? (String_len)n + 1 : 1;
+		s->raw[s->len - 1] = '\0';
+		return n > 0 ? 0 : -1;
+	}
+
+	p = s->raw;
+	end = s->raw + s->size - 1; /* room for the '\0' */
+	flockfile(f);
+
+	while ((c = getc_unlocked(f)) != EOF) {
+		if (p == end) {
+			String_len n = p - s->raw;
+
+			/* double the room, keeping what's been read */
+			s->len = n + 1;
+
+			if (string_reserve_at(s, n, n + 1)) {
+				ret = -1;
+				break;
+			}
+
+			p = s->raw + n;
+			end = s->raw + s->size - 1;
+		}
+
+		*p++ = c;
+
+		if (c == '\n') {
+			break;
+		}
+	}
+
+	funlockfile(f);
+	s->len = p - s->raw + 1;
+	*p = '\0';
+
+	return p > s->raw && !ferror(f) ? ret : -1;
+}
+
+static int read_all(String s, int fd, size_t hint)
+{
+	String_len offset = used(s);
+	ssize_t n;
+
+	/* sized exactly, plus a byte so EOF is seen without growing */
+	if (hint > 0 && (hint > STRING_LEN_MAX - 2 - offset ||
+	                 String_reserve(s, offset + hint + 2))) {
+		return -1;
+	}
+
+	for (;;) {
+		if (offset + 1 >= s->size) {
+			s->len = offset + 1;
+
+			if (string_reserve_at(s, offset, READ_CHUNK)) {
+				n = -1;
+				break;
+			}
+		}
+
+		n = read(fd, s->raw + offset, s->size - offset - 1);
+
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (n <= 0) {
+			break;
+		}
+
+		offset += n;
+	}
+
+	s->len = offset + 1;
+	s->raw[offset] = '\0';
+	return n < 0 ? -1 : 0;
+}
+
+static size_t remaining(int fd)
+{
+	struct stat st;
+	off_t pos;
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) ||
+	    (pos = lseek(fd, 0, SEEK_CUR)) < 0 || pos >= st.st_size) {
+		return 0;
+	}
+
+	return st.st_size - pos;
+}
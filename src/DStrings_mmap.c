@@ -0,0 +1,218 @@
+/*
+ * File:    DStrings_mmap.c
+ * Author:  Eduardo Miravalls Sierra          <edu.miravalls@hotmail.com>
+ *
+ * Date:    2014-08-30 09:47
+ */
+
+/*
+ * Dynamic C Strings library.
+ * Copyright (C) 2014 Eduardo Miravalls Sierra
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE /* mremap */
+
+#include <stdlib.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "DStrings_internal.h"
+
+/**
+ * @brief blocks from this size on are mapped instead of malloc'ed.
+ */
+#define MMAP_THRESHOLD (256 * 1024)
+
+/**
+ * @brief the system's page size.
+ */
+static size_t page_size(void);
+
+/**
+ * @brief rounds n up to a whole number of pages.
+ */
+static size_t whole_pages(size_t n);
+
+/**
+ * @brief maps n bytes of anonymous memory, or mallocs them if n is small.
+ *
+ * @param ctx unused.
+ * @param n number of bytes.
+ *
+ * @return the allocated memory.
+ * @return NULL on failure.
+ */
+static void *mmap_alloc(void *ctx, size_t n);
+
+/**
+ * @brief resizes p, moving bytes only when it crosses MMAP_THRESHOLD.
+ * @details mapped blocks are grown and shrunk with mremap, which remaps
+ * the pages instead of copying them.
+ *
+ * @param ctx unused.
+ * @param p memory allocated by mmap_alloc.
+ * @param old_size p's size.
+ * @param n new size.
+ *
+ * @return the resized memory.
+ * @return NULL on error, p is left untouched.
+ */
+static void *mmap_resize(void *ctx, void *p, size_t old_size, size_t n);
+
+/**
+ * @brief unmaps or frees p, depending on its size.
+ *
+ * @param ctx unused.
+ * @param p memory allocated by mmap_alloc.
+ * @param size p's size.
+ */
+static void mmap_release(void *ctx, void *p, size_t size);
+
+static const String_allocator mmap_allocator = {
+	mmap_alloc, mmap_resize, mmap_release, NULL
+};
+
+const String_allocator *String_mmap_allocator(void)
+{
+	return &mmap_allocator;
+}
+
+String String_new_mmap_file(const char *path)
+{
+	struct stat st;
+	String s;
+	char *p;
+	size_t n;
+	int fd;
+
+	assert(path != NULL);
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		return NULL;
+	}
+
+	if (fstat(fd, &st) || (uintmax_t)st.st_size >= STRING_LEN_MAX ||
+	    (s = String_new_with(&string_stdlib_allocator, NULL, 0)) == NULL) {
+		close(fd);
+		return NULL;
+	}
+
+	/* one page more than the file: it's zero filled, so it provides the
+	 * '\0' even when the file ends right at a page boundary */
+	n = whole_pages(st.st_size) + page_size();
+
+	if ((p = mmap(NULL, n, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED ||
+	    (st.st_size > 0 && mmap(p, st.st_size, PROT_READ, MAP_PRIVATE | MAP_FIXED,
+	                            fd, 0) == MAP_FAILED)) {
+		if (p != MAP_FAILED) {
+			munmap(p, n);
+		}
+
+		String_free(&s);
+		close(fd);
+		return NULL;
+	}
+
+	close(fd);
+
+	/* like stolen strings, it can't grow, and it's read only on top of that */
+	s->raw = p;
+	s->len = st.st_size + 1;
+	s->size = n;
+	s->resizable = NO;
+	s->flags = FROZEN | MAPPED;
+	return s;
+}
+
+void string_unmap(String s)
+{
+	munmap(s->raw, s->size);
+}
+
+static size_t page_size(void)
+{
+	static size_t size;
+
+	if (size == 0) {
+		size = sysconf(_SC_PAGESIZE);
+	}
+
+	return size;
+}
+
+static size_t whole_pages(size_t n)
+{
+	return (n + page_size() - 1) & ~(page_size() - 1);
+}
+
+static void *mmap_alloc(void *ctx, size_t n)
+{
+	void *p;
+
+	(void)ctx;
+
+	if (n < MMAP_THRESHOLD) {
+		return malloc(n);
+	}
+
+	p = mmap(NULL, whole_pages(n), PROT_READ | PROT_WRITE,
+	         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return p == MAP_FAILED ? NULL : p;
+}
+
+static void *mmap_resize(void *ctx, void *p, size_t old_size, size_t n)
+{
+	void *q;
+
+	if (p == NULL) {
+		return mmap_alloc(ctx, n);
+	}
+
+	if (old_size < MMAP_THRESHOLD && n < MMAP_THRESHOLD) {
+		return realloc(p, n);
+	}
+
+#ifdef MREMAP_MAYMOVE
+	if (old_size >= MMAP_THRESHOLD && n >= MMAP_THRESHOLD) {
+		q = mremap(p, whole_pages(old_size), whole_pages(n), MREMAP_MAYMOVE);
+		return q == MAP_FAILED ? NULL : q;
+	}
+#endif
+
+	/* crossing the threshold, or no mremap */
+	if ((q = mmap_alloc(ctx, n)) == NULL) {
+		return NULL;
+	}
+
+	memcpy(q, p, old_size < n ? old_size : n);
+	mmap_release(ctx, p, old_size);
+	return q;
+}
+
+static void mmap_release(void *ctx, void *p, size_t size)
+{
+	(void)ctx;
+
+	if (size < MMAP_THRESHOLD) {
+		free(p);
+
+	} else if (p != NULL) {
+		munmap(p, whole_pages(size));
+	}
+}
@@ -0,0 +1,579 @@
+/*
+ * File:    DStrings_patterns.c
+ * Author:  Eduardo Miravalls Sierra          <edu.miravalls@hotmail.com>
+ *
+ * Date:    2014-08-30 09:47
+ */
+
+/*
+ * Dynamic C Strings library.
+ * Copyright (C) 2014 Eduardo Miravalls Sierra
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "DStrings_internal.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief sets with more patterns than this always use Aho-Corasick.
+ * @details Teddy's buckets are shared by several patterns, past this
+ * point most candidates are false positives.
+ */
+#define TEDDY_MAX_PATTERNS 32
+
+/**
+ * @brief number of Teddy buckets, one bit of each fingerprint byte.
+ */
+#define TEDDY_BUCKETS 8
+
+/**
+ * @brief marks DFA transitions into states where some pattern ends.
+ */
+#define ACCEPTS 0x80000000u
+
+enum {AHO_CORASICK, TEDDY_SSSE3, TEDDY_AVX2};
+
+/*
+ * Both engines report matches in the order they end, and matches ending at
+ * the same offset in pattern order, so results don't depend on which one a
+ * set was compiled for.
+ *
+ * Aho-Corasick is a DFA over byte classes: every byte that appears in some
+ * pattern is a class of its own, the rest share class 0. Transitions are
+ * premultiplied by the number of classes, so a step is a single load, and
+ * the ones into states where patterns end are tagged with ACCEPTS.
+ *
+ * Teddy looks at the last (up to) 3 bytes of every pattern. Patterns are
+ * spread over 8 buckets, and for each of those bytes a pair of 16 entry
+ * tables, indexed by the low and the high nibble, says which buckets have
+ * a pattern with that nibble there. pshufb looks 16 or 32 bytes up at
+ * once, and ANDing the results gives, for every offset of the text, the
+ * buckets that may have a pattern ending there. Those are then compared.
+ */
+struct string_patterns {
+	unsigned count;        /**< number of patterns */
+	String_len *lens;      /**< their lengths */
+	const char **ptrs;     /**< their bytes, copied in bytes */
+	char *bytes;
+	int engine;
+
+	/* Aho-Corasick */
+	uint16_t classes[256];      /**< byte -> class, 0 if unused */
+	unsigned char starts[256];  /**< whether a pattern starts with byte */
+	unsigned nclasses;
+	uint32_t *delta;       /**< state * nclasses + class -> next state */
+	uint32_t *out_begin;   /**< first of the state's patterns in out */
+	uint32_t *out_count;   /**< number of patterns ending in the state */
+	unsigned *out;         /**< patterns ending in each state, sorted */
+
+	/* Teddy */
+	unsigned fp;           /**< fingerprint length, 1 to 3 */
+	unsigned char lo[3][16]; /**< low nibble -> buckets */
+	unsigned char hi[3][16]; /**< high nibble -> buckets */
+};
+
+/**
+ * @brief builds the Aho-Corasick DFA.
+ *
+ * @param p pattern set, with its patterns copied.
+ * @param total sum of the patterns' lengths.
+ *
+ * @return -1 if allocation failed or the DFA would be too big.
+ * @return 0 otherwise.
+ */
+static int build_aho_corasick(struct string_patterns *p, size_t total);
+
+#ifdef HAVE_X86
+/**
+ * @brief fills the Teddy tables.
+ *
+ * @param p pattern set, with its patterns copied.
+ * @param min_len length of the shortest pattern.
+ */
+static void build_teddy(struct string_patterns *p, String_len min_len);
+#endif
+
+/**
+ * @brief stores a match if there's room for it, and counts it anyway.
+ *
+ * @param matches array.
+ * @param max matches' size.
+ * @param found number of matches so far, incremented.
+ * @param end offset of the match's last char.
+ * @param len match's length.
+ * @param pattern matching pattern.
+ */
+static void emit(String_match *matches, String_len max, String_len *found,
+                 String_len end, String_len len, unsigned pattern);
+
+/**
+ * @brief Aho-Corasick scan.
+ */
+static String_len scan_aho_corasick(String_patterns p, const unsigned char *h,
+                                    String_len n, String_match *matches,
+                                    String_len max);
+
+#ifdef HAVE_X86
+/**
+ * @brief compares the patterns in some buckets with the text ending at end.
+ *
+ * @param p pattern set.
+ * @param h text.
+ * @param end offset of the last char of a candidate.
+ * @param buckets candidate buckets.
+ * @param matches array.
+ * @param max matches' size.
+ * @param found number of matches so far, incremented.
+ */
+static void teddy_verify(String_patterns p, const char *h, String_len end,
+                         unsigned buckets, String_match *matches,
+                         String_len max, String_len *found);
+
+/**
+ * @brief Teddy, a byte at a time, for the windows starting in [from, to).
+ */
+static void teddy_scalar(String_patterns p, const char *h, String_len from,
+                         String_len to, String_match *matches, String_len max,
+                         String_len *found);
+
+/*
+ * Every window start i + j of a block gets the buckets of its bytes looked
+ * up, fingerprint bytes past fp have all-ones tables and don't filter
+ * anything. The last windows, which don't fill a block, are left to
+ * teddy_scalar.
+ */
+#define TEDDY_KERNEL(isa, vec, W, table, loadu, storeu, set1, and, shuffle, \
+                     srli16, cmpeq, movemask) \
+static __attribute__((target(#isa))) String_len \
+teddy_##isa(String_patterns p, const char *h, String_len n, \
+            String_match *matches, String_len max) \
+{ \
+	const vec nibble = set1(0x0f), zero = set1(0); \
+	const vec lo0 = table(p->lo[0]), hi0 = table(p->hi[0]); \
+	const vec lo1 = table(p->lo[1]), hi1 = table(p->hi[1]); \
+	const vec lo2 = table(p->lo[2]), hi2 = table(p->hi[2]); \
+	unsigned char buckets[W]; \
+	unsigned mask, j; \
+	String_len i, found = 0; \
+	vec v, res; \
+\
+	for (i = 0; n - i >= W + 2; i += W) { \
+		v = loadu((const vec *)(h + i)); \
+		res = and(shuffle(lo0, and(v, nibble)), \
+		          shuffle(hi0, and(srli16(v, 4), nibble))); \
+		v = loadu((const vec *)(h + i + 1)); \
+		res = and(res, and(shuffle(lo1, and(v, nibble)), \
+		                   shuffle(hi1, and(srli16(v, 4), nibble)))); \
+		v = loadu((const vec *)(h + i + 2)); \
+		res = and(res, and(shuffle(lo2, and(v, nibble)), \
+		                   shuffle(hi2, and(srli16(v, 4), nibble)))); \
+\
+		if ((mask = ~movemask(cmpeq(res, zero)) & (unsigned)((1ull << W) - 1)) == 0) { \
+			continue; \
+		} \
+\
+		storeu((vec *)buckets, res); \
+\
+		for (; mask != 0; mask &= mask - 1) { \
+			j = __builtin_ctz(mask); \
+			teddy_verify(p, h, i + j + p->fp - 1, buckets[j], matches, max, &found); \
+		} \
+	} \
+\
+	if (n >= p->fp) { \
+		teddy_scalar(p, h, i, n - p->fp + 1, matches, max, &found); \
+	} \
+\
+	return found; \
+}
+
+#define table_ssse3(t) _mm_loadu_si128((const __m128i *)(t))
+#define table_avx2(t) _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(t)))
+
+TEDDY_KERNEL(ssse3, __m128i, 16, table_ssse3, _mm_loadu_si128, _mm_storeu_si128,
+             _mm_set1_epi8, _mm_and_si128, _mm_shuffle_epi8, _mm_srli_epi16,
+             _mm_cmpeq_epi8, (unsigned)_mm_movemask_epi8)
+TEDDY_KERNEL(avx2, __m256i, 32, table_avx2, _mm256_loadu_si256, _mm256_storeu_si256,
+             _mm256_set1_epi8, _mm256_and_si256, _mm256_shuffle_epi8, _mm256_srli_epi16,
+             _mm256_cmpeq_epi8, (unsigned)_mm256_movemask_epi8)
+
+#undef TEDDY_KERNEL
+#undef table_ssse3
+#undef table_avx2
+#endif
+
+String_patterns String_patterns_new(const String *patterns, unsigned count)
+{
+	struct string_patterns *p;
+	String_len min_len = STRING_LEN_MAX;
+	size_t total = 0;
+	unsigned i;
+	char *q;
+
+	assert(patterns != NULL || count == 0);
+
+	for (i = 0; i < count; i++) {
+		assert(patterns[i] != NULL);
+
+		if (used(patterns[i]) == 0) {
+			return NULL;
+		}
+
+		if (used(patterns[i]) < min_len) {
+			min_len = used(patterns[i]);
+		}
+
+		total += used(patterns[i]);
+	}
+
+	if ((p = calloc(1, sizeof(*p))) == NULL) {
+		return NULL;
+	}
+
+	p->count = count;
+	p->lens = malloc(count * sizeof(*p->lens) + 1);
+	p->ptrs = malloc(count * sizeof(*p->ptrs) + 1);
+	p->bytes = malloc(total + 1);
+
+	if (p->lens == NULL || p->ptrs == NULL || p->bytes == NULL) {
+		String_patterns_free(&p);
+		return NULL;
+	}
+
+	for (i = 0, q = p->bytes; i < count; i++) {
+		p->lens[i] = used(patterns[i]);
+		p->ptrs[i] = memcpy(q, patterns[i]->raw, p->lens[i]);
+		q += p->lens[i];
+	}
+
+#ifdef HAVE_X86
+	if (count > 0 && count <= TEDDY_MAX_PATTERNS) {
+		if (__builtin_cpu_supports("avx2")) {
+			p->engine = TEDDY_AVX2;
+		} else if (__builtin_cpu_supports("ssse3")) {
+			p->engine = TEDDY_SSSE3;
+		}
+	}
+
+	if (p->engine != AHO_CORASICK) {
+		build_teddy(p, min_len);
+		return p;
+	}
+#endif
+
+	if (build_aho_corasick(p, total)) {
+		String_patterns_free(&p);
+	}
+
+	return p;
+}
+
+void String_patterns_free(String_patterns *p)
+{
+	assert(p != NULL);
+
+	if (*p == NULL) {
+		return;
+	}
+
+	free((*p)->lens);
+	free((*p)->ptrs);
+	free((*p)->bytes);
+	free((*p)->delta);
+	free((*p)->out_begin);
+	free((*p)->out_count);
+	free((*p)->out);
+	free(*p);
+	*p = NULL;
+}
+
+unsigned String_patterns_count(String_patterns p)
+{
+	assert(p != NULL);
+	return p->count;
+}
+
+String_len String_patterns_match(String_patterns p, StringView v,
+                                 String_match *matches, String_len max)
+{
+	assert(p != NULL);
+	assert(v.ptr != NULL || v.len == 0);
+	assert(matches != NULL || max == 0);
+
+	switch (p->engine) {
+#ifdef HAVE_X86
+	case TEDDY_AVX2:
+		return teddy_avx2(p, v.ptr, v.len, matches, max);
+
+	case TEDDY_SSSE3:
+		return teddy_ssse3(p, v.ptr, v.len, matches, max);
+#endif
+
+	default:
+		return scan_aho_corasick(p, (const unsigned char *)v.ptr, v.len, matches, max);
+	}
+}
+
+static void emit(String_match *matches, String_len max, String_len *found,
+                 String_len end, String_len len, unsigned pattern)
+{
+	if (*found < max) {
+		matches[*found].offset = end + 1 - len;
+		matches[*found].len = len;
+		matches[*found].pattern = pattern;
+	}
+
+	(*found)++;
+}
+
+static String_len scan_aho_corasick(String_patterns p, const unsigned char *h,
+                                    String_len n, String_match *matches,
+                                    String_len max)
+{
+	const uint32_t *delta = p->delta;
+	const uint16_t *classes = p->classes;
+	String_len i, found = 0;
+	uint32_t state = 0, s, k;
+
+	for (i = 0; i < n; i++) {
+		/*
+		 * From the root, bytes no pattern starts with lead back to it.
+		 * Skipping them doesn't depend on the previous step, so it's
+		 * several times faster than walking the automaton.
+		 */
+		if (state == 0) {
+			while (i < n && !p->starts[h[i]]) {
+				i++;
+			}
+
+			if (i == n) {
+				break;
+			}
+		}
+
+		state = delta[state + classes[h[i]]];
+
+		if (state & ACCEPTS) {
+			state &= ~ACCEPTS;
+			s = state / p->nclasses;
+
+			for (k = p->out_begin[s]; k < p->out_begin[s] + p->out_count[s]; k++) {
+				emit(matches, max, &found, i, p->lens[p->out[k]], p->out[k]);
+			}
+		}
+	}
+
+	return found;
+}
+
+#ifdef HAVE_X86
+static void teddy_verify(String_patterns p, const char *h, String_len end,
+                         unsigned buckets, String_match *matches,
+                         String_len max, String_len *found)
+{
+	unsigned i;
+
+	for (i = 0; i < p->count; i++) {
+		if ((buckets & (1u << i % TEDDY_BUCKETS)) && p->lens[i] <= end + 1 &&
+		    memcmp(h + end + 1 - p->lens[i], p->ptrs[i], p->lens[i]) == 0) {
+			emit(matches, max, found, end, p->lens[i], i);
+		}
+	}
+}
+
+static void teddy_scalar(String_patterns p, const char *h, String_len from,
+                         String_len to, String_match *matches, String_len max,
+                         String_len *found)
+{
+	unsigned char c;
+	unsigned buckets, t;
+	String_len i;
+
+	for (i = from; i < to; i++) {
+		buckets = 0xff;
+
+		for (t = 0; t < p->fp; t++) {
+			c = h[i + t];
+			buckets &= p->lo[t][c & 0x0f] & p->hi[t][c >> 4];
+		}
+
+		if (buckets != 0) {
+			teddy_verify(p, h, i + p->fp - 1, buckets, matches, max, found);
+		}
+	}
+}
+
+static void build_teddy(struct string_patterns *p, String_len min_len)
+{
+	unsigned i, t;
+	unsigned char c;
+
+	p->fp = min_len < 3 ? min_len : 3;
+	memset(p->lo, 0, sizeof(p->lo));
+	memset(p->hi, 0, sizeof(p->hi));
+
+	for (i = 0; i < p->count; i++) {
+		for (t = 0; t < p->fp; t++) {
+			c = p->ptrs[i][p->lens[i] - p->fp + t];
+			p->lo[t][c & 0x0f] |= 1u << i % TEDDY_BUCKETS;
+			p->hi[t][c >> 4] |= 1u << i % TEDDY_BUCKETS;
+		}
+	}
+
+	/* unused fingerprint bytes let everything through */
+	for (t = p->fp; t < 3; t++) {
+		memset(p->lo[t], 0xff, sizeof(p->lo[t]));
+		memset(p->hi[t], 0xff, sizeof(p->hi[t]));
+	}
+}
+#endif
+
+static int build_aho_corasick(struct string_patterns *p, size_t total)
+{
+	size_t states = total + 1, next = 1, out_size = 0, head, tail;
+	uint32_t *fail = NULL, *queue = NULL, *first = NULL, *chain = NULL;
+	uint32_t s, t, f, c, k, a, b, end, *row;
+	unsigned i, *out;
+	String_len j;
+	int ret = -1;
+
+	for (i = 0; i < p->count; i++) {
+		p->starts[(unsigned char)p->ptrs[i][0]] = YES;
+
+		for (j = 0; j < p->lens[i]; j++) {
+			if (p->classes[(unsigned char)p->ptrs[i][j]] == 0) {
+				p->classes[(unsigned char)p->ptrs[i][j]] = ++p->nclasses;
+			}
+		}
+	}
+
+	p->nclasses++;
+
+	if (states > (ACCEPTS - 1) / p->nclasses) {
+		return -1;
+	}
+
+	p->delta = calloc(states * p->nclasses, sizeof(*p->delta));
+	p->out_begin = calloc(states, sizeof(*p->out_begin));
+	p->out_count = calloc(states, sizeof(*p->out_count));
+	fail = calloc(states, sizeof(*fail));
+	queue = malloc(states * sizeof(*queue));
+	/* patterns ending in each state, chained through chain, in order */
+	first = malloc(states * sizeof(*first));
+	chain = malloc((p->count + 1) * sizeof(*chain));
+
+	if (!p->delta || !p->out_begin || !p->out_count || !fail || !queue ||
+	    !first || !chain) {
+		goto out;
+	}
+
+	memset(first, 0xff, states * sizeof(*first));
+
+	/* the trie, 0 means no child since the root is nobody's child */
+	for (i = p->count; i-- > 0;) {
+		for (s = 0, j = 0; j < p->lens[i]; j++) {
+			row = p->delta + (size_t)s * p->nclasses;
+			c = p->classes[(unsigned char)p->ptrs[i][j]];
+
+			if (row[c] == 0) {
+				row[c] = next++ * p->nclasses;
+			}
+
+			s = row[c] / p->nclasses;
+		}
+
+		chain[i] = first[s];
+		first[s] = i;
+		p->out_count[s]++;
+	}
+
+	/* failure links and missing transitions, breadth first */
+	head = tail = 0;
+
+	for (c = 0; c < p->nclasses; c++) {
+		if ((t = p->delta[c]) != 0) {
+			fail[t / p->nclasses] = 0;
+			queue[tail++] = t / p->nclasses;
+		}
+	}
+
+	while (head < tail) {
+		s = queue[head++];
+		row = p->delta + (size_t)s * p->nclasses;
+		f = fail[s] * p->nclasses;
+
+		for (c = 0; c < p->nclasses; c++) {
+			if (row[c] != 0) {
+				fail[row[c] / p->nclasses] = p->delta[f + c] / p->nclasses;
+				queue[tail++] = row[c] / p->nclasses;
+			} else {
+				row[c] = p->delta[f + c];
+			}
+		}
+	}
+
+	/* a state's output is its own patterns plus its failure state's */
+	for (head = 0; head < tail; head++) {
+		s = queue[head];
+		p->out_count[s] += p->out_count[fail[s]];
+		out_size += p->out_count[s];
+	}
+
+	if ((p->out = malloc(out_size * sizeof(*p->out) + 1)) == NULL) {
+		goto out;
+	}
+
+	for (head = 0, out = p->out; head < tail; head++) {
+		s = queue[head];
+		f = fail[s];
+		p->out_begin[s] = out - p->out;
+
+		/* merge both sorted lists */
+		a = first[s];
+		b = p->out_begin[f];
+		end = b + p->out_count[f];
+
+		for (k = 0; k < p->out_count[s]; k++) {
+			if (a != UINT32_MAX && (b == end || a < p->out[b])) {
+				*out++ = a;
+				a = chain[a];
+			} else {
+				*out++ = p->out[b++];
+			}
+		}
+	}
+
+	for (k = 0; k < states * p->nclasses; k++) {
+		if (p->out_count[p->delta[k] / p->nclasses] > 0) {
+			p->delta[k] |= ACCEPTS;
+		}
+	}
+
+	ret = 0;
+
+out:
+	free(fail);
+	free(queue);
+	free(first);
+	free(chain);
+	return ret;
+}
@@ -0,0 +1,714 @@
+/*
+ * File:    DStrings_search.c
+ * Author:  Eduardo Miravalls Sierra          <edu.miravalls@hotmail.com>
+ *
+ * Date:    2014-08-30 09:47
+ */
+
+/*
+ * Dynamic C Strings library.
+ * Copyright (C) 2014 Eduardo Miravalls Sierra
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <assert.h>
+
+#include "DStrings_internal.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief needles longer than this are searched with Two-Way.
+ * @details the filter kernels compare every candidate with memcmp, which
+ * costs O(n * m) on unlucky inputs. Two-Way is linear, but its setup and
+ * byte at a time scan only pay off for long needles.
+ */
+#define TWO_WAY_THRESHOLD 64
+
+/**
+ * @brief portable first occurrence kernel.
+ * @details memchr finds the candidates, whose last byte is checked before
+ * calling memcmp. Every kernel, SIMD ones included, has this contract.
+ *
+ * @param h haystack.
+ * @param hlen h's length.
+ * @param n needle.
+ * @param m n's length, 0 < m <= hlen.
+ *
+ * @return the offset of the first (or last) occurrence of n in h.
+ * @return STRING_NOT_FOUND if there's none.
+ */
+static String_len find_scalar(const char *h, String_len hlen,
+                              const char *n, String_len m);
+
+/**
+ * @brief portable last occurrence kernel.
+ */
+static String_len rfind_scalar(const char *h, String_len hlen,
+                               const char *n, String_len m);
+
+#ifdef HAVE_X86
+/**
+ * @brief checks the candidates a SIMD filter found.
+ *
+ * @param p haystack, where the block starts.
+ * @param mask bit i is set if p + i is a candidate.
+ * @param n needle.
+ * @param m n's length.
+ *
+ * @return the offset of the first candidate that matches.
+ * @return STRING_NOT_FOUND if there's none.
+ */
+static String_len verify(const char *p, unsigned mask, const char *n, String_len m);
+#endif
+
+/**
+ * @brief returns the number of times c appears in n bytes of h.
+ */
+static String_len count_char_scalar(const char *h, String_len n, char c);
+
+/**
+ * @brief Two-Way string matching (Crochemore and Perrin, 1991).
+ * @details O(hlen + m) time and O(1) space. Same contract as a kernel.
+ */
+static String_len two_way(const char *h, String_len hlen,
+                          const char *n, String_len m);
+
+/**
+ * @brief splits n at its critical factorization.
+ *
+ * @param n needle.
+ * @param m n's length.
+ * @param period where n's period is stored.
+ *
+ * @return the length of the left half.
+ */
+static size_t critical_factorization(const unsigned char *n, size_t m,
+                                     size_t *period);
+
+/**
+ * @brief copies needle and rep if any of them points into s' raw string,
+ * which is about to be rewritten.
+ *
+ * @param s String.
+ * @param needle where needle is, updated if it's copied.
+ * @param n needle's length.
+ * @param rep where the replacement is, updated if it's copied.
+ * @param rep_len rep's length.
+ * @param copy where the copies' buffer is stored, NULL if there are none.
+ *
+ * @return -1 if allocation failed.
+ * @return 0 otherwise.
+ */
+static int unalias(String s, const void **needle, String_len n,
+                   const void **rep, String_len rep_len, char **copy);
+
+/**
+ * @brief replaces every occurrence of needle, going forward.
+ * @details the text to rewrite is raw[r, end), and the result is written
+ * from raw + w on. w must be <= r, and stay so: every replacement can
+ * only grow the output by the room left between w and r.
+ *
+ * @param raw buffer.
+ * @param r first byte of the text.
+ * @param end end of the text.
+ * @param w where the result goes.
+ * @param needle what's replaced.
+ * @param n needle's length, > 0.
+ * @param rep replacement.
+ * @param rep_len rep's length.
+ *
+ * @return the result's end.
+ */
+static String_len rewrite(char *raw, String_len r, String_len end, String_len w,
+                          const char *needle, String_len n,
+                          const char *rep, String_len rep_len);
+
+#ifdef HAVE_X86
+/*
+ * The SIMD kernels are Wojciech Mula's "generic SIMD" filter: the needle's
+ * first and last bytes are broadcast, and compared with W haystack bytes
+ * at i and at i + m - 1. Bits set in both masks are candidates, verified
+ * with memcmp. Single bytes are the m == 1 case of the same filter.
+ *
+ * Every ISA gets its own copy, compiled with its target attribute, and
+ * dispatch() picks the widest one the CPU supports at runtime.
+ */
+#define FILTER_KERNELS(isa, vec, W, set1, loadu, cmpeq, and, movemask) \
+static __attribute__((target(#isa))) String_len \
+find_##isa(const char *h, String_len hlen, const char *n, String_len m) \
+{ \
+	const vec first = set1(n[0]), last = set1(n[m - 1]); \
+	String_len i, found; \
+	unsigned lo, hi; \
+\
+	/* two blocks per iteration, most of them have no candidates at all */ \
+	for (i = 0; hlen - (m - 1) - i >= 2 * W; i += 2 * W) { \
+		lo = movemask(and(cmpeq(first, loadu((const vec *)(h + i))), \
+		                  cmpeq(last, loadu((const vec *)(h + i + m - 1))))); \
+		hi = movemask(and(cmpeq(first, loadu((const vec *)(h + i + W))), \
+		                  cmpeq(last, loadu((const vec *)(h + i + W + m - 1))))); \
+\
+		if ((lo | hi) == 0) { \
+			continue; \
+		} \
+\
+		if ((found = verify(h + i, lo, n, m)) != STRING_NOT_FOUND) { \
+			return i + found; \
+		} \
+\
+		if ((found = verify(h + i + W, hi, n, m)) != STRING_NOT_FOUND) { \
+			return i + W + found; \
+		} \
+	} \
+\
+	found = find_scalar(h + i, hlen - i, n, m); \
+	return found == STRING_NOT_FOUND ? STRING_NOT_FOUND : i + found; \
+} \
+\
+static __attribute__((target(#isa))) String_len \
+rfind_##isa(const char *h, String_len hlen, const char *n, String_len m) \
+{ \
+	const vec first = set1(n[0]), last = set1(n[m - 1]); \
+	String_len end; \
+	unsigned mask, bit; \
+\
+	/* candidates left to check are [0, end) */ \
+	for (end = hlen - m + 1; end >= W; end -= W) { \
+		mask = movemask(and(cmpeq(first, loadu((const vec *)(h + end - W))), \
+		                    cmpeq(last, loadu((const vec *)(h + end - W + m - 1))))); \
+\
+		for (; mask != 0; mask &= ~(1u << bit)) { \
+			bit = 31 - __builtin_clz(mask); \
+			if (m <= 2 || memcmp(h + end - W + bit + 1, n + 1, m - 2) == 0) { \
+				return end - W + bit; \
+			} \
+		} \
+	} \
+\
+	return rfind_scalar(h, end + m - 1, n, m); \
+} \
+\
+static __attribute__((target(#isa))) String_len \
+count_char_##isa(const char *h, String_len n, char c) \
+{ \
+	const vec v = set1(c); \
+	String_len i, count = 0; \
+\
+	for (i = 0; n - i >= W; i += W) { \
+		count += __builtin_popcount(movemask(cmpeq(v, loadu((const vec *)(h + i))))); \
+	} \
+\
+	return count + count_char_scalar(h + i, n - i, c); \
+}
+
+FILTER_KERNELS(sse2, __m128i, 16, _mm_set1_epi8, _mm_loadu_si128,
+               _mm_cmpeq_epi8, _mm_and_si128, (unsigned)_mm_movemask_epi8)
+FILTER_KERNELS(avx2, __m256i, 32, _mm256_set1_epi8, _mm256_loadu_si256,
+               _mm256_cmpeq_epi8, _mm256_and_si256, (unsigned)_mm256_movemask_epi8)
+
+#undef FILTER_KERNELS
+
+/*
+ * __builtin_cpu_supports only reads a table libgcc fills in before main,
+ * so it's cheap enough to ask every time instead of caching the choice.
+ */
+#define dispatch(name) \
+	(__builtin_cpu_supports("avx2") ? name##_avx2 : \
+	 __builtin_cpu_supports("sse2") ? name##_sse2 : name##_scalar)
+#else
+#define dispatch(name) name##_scalar
+#endif
+
+String_len StringView_find(StringView v, StringView needle)
+{
+	assert(v.ptr != NULL || v.len == 0);
+	assert(needle.ptr != NULL || needle.len == 0);
+
+	if (needle.len == 0) {
+		return 0;
+	}
+
+	if (needle.len > v.len) {
+		return STRING_NOT_FOUND;
+	}
+
+	if (needle.len == 1) {
+		return StringView_find_char(v, needle.ptr[0]);
+	}
+
+	if (needle.len > TWO_WAY_THRESHOLD) {
+		return two_way(v.ptr, v.len, needle.ptr, needle.len);
+	}
+
+	return dispatch(find)(v.ptr, v.len, needle.ptr, needle.len);
+}
+
+String_len StringView_rfind(StringView v, StringView needle)
+{
+	assert(v.ptr != NULL || v.len == 0);
+	assert(needle.ptr != NULL || needle.len == 0);
+
+	if (needle.len == 0) {
+		return v.len;
+	}
+
+	if (needle.len > v.len) {
+		return STRING_NOT_FOUND;
+	}
+
+	return dispatch(rfind)(v.ptr, v.len, needle.ptr, needle.len);
+}
+
+String_len StringView_find_char(StringView v, char c)
+{
+	const char *p;
+
+	assert(v.ptr != NULL || v.len == 0);
+
+	/* libc's memchr is already vectorized and dispatched */
+	if (v.len == 0 || (p = memchr(v.ptr, c, v.len)) == NULL) {
+		return STRING_NOT_FOUND;
+	}
+
+	return p - v.ptr;
+}
+
+String_len StringView_rfind_char(StringView v, char c)
+{
+	assert(v.ptr != NULL || v.len == 0);
+
+	if (v.len == 0) {
+		return STRING_NOT_FOUND;
+	}
+
+	return dispatch(rfind)(v.ptr, v.len, &c, 1);
+}
+
+String_len StringView_count(StringView v, StringView needle)
+{
+	String_len count = 0, i;
+
+	assert(v.ptr != NULL || v.len == 0);
+	assert(needle.ptr != NULL || needle.len == 0);
+
+	if (needle.len == 0 || needle.len > v.len) {
+		return 0;
+	}
+
+	if (needle.len == 1) {
+		return dispatch(count_char)(v.ptr, v.len, needle.ptr[0]);
+	}
+
+	while ((i = StringView_find(v, needle)) != STRING_NOT_FOUND) {
+		count++;
+		v.ptr += i + needle.len;
+		v.len -= i + needle.len;
+	}
+
+	return count;
+}
+
+String_len String_find(String s, const void *needle, String_len n)
+{
+	assert(s != NULL);
+	return StringView_find(String_view(s), StringView_new(needle, n));
+}
+
+String_len String_rfind(String s, const void *needle, String_len n)
+{
+	assert(s != NULL);
+	return StringView_rfind(String_view(s), StringView_new(needle, n));
+}
+
+String_len String_find_char(String s, char c)
+{
+	assert(s != NULL);
+	return StringView_find_char(String_view(s), c);
+}
+
+String_len String_rfind_char(String s, char c)
+{
+	assert(s != NULL);
+	return StringView_rfind_char(String_view(s), c);
+}
+
+String_len String_count(String s, const void *needle, String_len n)
+{
+	assert(s != NULL);
+	return StringView_count(String_view(s), StringView_new(needle, n));
+}
+
+int String_replace(String s, const void *needle, String_len n,
+                   const void *rep, String_len rep_len)
+{
+	String_len i, len;
+	char *copy;
+
+	assert(s != NULL);
+	assert(needle != NULL || n == 0);
+	assert(rep != NULL || rep_len == 0);
+
+	if (n == 0 || (i = String_find(s, needle, n)) == STRING_NOT_FOUND) {
+		return 0;
+	}
+
+	if (string_prepare_write(s) || unalias(s, &needle, n, &rep, rep_len, &copy)) {
+		return -1;
+	}
+
+	len = used(s);
+
+	if (rep_len > n && string_reserve_at(s, len, rep_len - n)) {
+		free(copy);
+		return -1;
+	}
+
+	memmove(s->raw + i + rep_len, s->raw + i + n, len - i - n + 1);
+
+	if (rep_len > 0) {
+		memcpy(s->raw + i, rep, rep_len);
+	}
+
+	s->len = len - n + rep_len + 1;
+	free(copy);
+	return 0;
+}
+
+int String_replace_all(String s, const void *needle, String_len n,
+                       const void *rep, String_len rep_len)
+{
+	String_len count, len, extra = 0;
+	char *copy;
+
+	assert(s != NULL);
+	assert(needle != NULL || n == 0);
+	assert(rep != NULL || rep_len == 0);
+
+	if (n == 0 || used(s) < n) {
+		return 0;
+	}
+
+	if (string_prepare_write(s) || unalias(s, &needle, n, &rep, rep_len, &copy)) {
+		return -1;
+	}
+
+	len = used(s);
+
+	if (rep_len > n) {
+		/*
+		 * Size the result first, so s is reallocated once and to its
+		 * exact size. The text is then moved to the end of the buffer
+		 * and rewritten forward from the start.
+		 */
+		count = String_count(s, needle, n);
+
+		if (count > (STRING_LEN_MAX - 1 - len) / (rep_len - n)) {
+			free(copy);
+			return -1;
+		}
+
+		extra = count * (rep_len - n);
+
+		if (String_reserve(s, len + extra + 1)) {
+			free(copy);
+			return -1;
+		}
+
+		memmove(s->raw + extra, s->raw, len);
+	}
+
+	len = rewrite(s->raw, extra, extra + len, 0, needle, n, rep, rep_len);
+	s->raw[len] = '\0';
+	s->len = len + 1;
+	free(copy);
+	return 0;
+}
+
+static int unalias(String s, const void **needle, String_len n,
+                   const void **rep, String_len rep_len, char **copy)
+{
+	/* unsigned arithmetic, so pointers to other buffers aren't compared */
+	uintptr_t raw = (uintptr_t)s->raw;
+
+	*copy = NULL;
+
+	if ((uintptr_t)*needle - raw >= s->len && (uintptr_t)*rep - raw >= s->len) {
+		return 0;
+	}
+
+	if ((*copy = malloc(n + rep_len + 1)) == NULL) {
+		return -1;
+	}
+
+	memcpy(*copy, *needle, n);
+
+	if (rep_len > 0) {
+		memcpy(*copy + n, *rep, rep_len);
+	}
+
+	*needle = *copy;
+	*rep = *copy + n;
+	return 0;
+}
+
+static String_len rewrite(char *raw, String_len r, String_len end, String_len w,
+                          const char *needle, String_len n,
+                          const char *rep, String_len rep_len)
+{
+	StringView pattern = StringView_new(needle, n);
+	String_len i;
+
+	while ((i = StringView_find(StringView_new(raw + r, end - r), pattern)) != STRING_NOT_FOUND) {
+		if (w != r) {
+			memmove(raw + w, raw + r, i);
+		}
+
+		if (rep_len > 0) {
+			memcpy(raw + w + i, rep, rep_len);
+		}
+
+		w += i + rep_len;
+		r += i + n;
+	}
+
+	if (w != r) {
+		memmove(raw + w, raw + r, end - r);
+	}
+
+	return w + end - r;
+}
+
+static String_len find_scalar(const char *h, String_len hlen,
+                              const char *n, String_len m)
+{
+	const char *p = h, *end = h + hlen - m + 1;
+
+	while (p < end && (p = memchr(p, n[0], end - p)) != NULL) {
+		if (p[m - 1] == n[m - 1] && memcmp(p + 1, n + 1, m - 1) == 0) {
+			return p - h;
+		}
+
+		p++;
+	}
+
+	return STRING_NOT_FOUND;
+}
+
+static String_len rfind_scalar(const char *h, String_len hlen,
+                               const char *n, String_len m)
+{
+	String_len i;
+
+	if (m > hlen) {
+		return STRING_NOT_FOUND;
+	}
+
+	for (i = hlen - m + 1; i-- > 0;) {
+		if (h[i] == n[0] && h[i + m - 1] == n[m - 1] &&
+		    memcmp(h + i + 1, n + 1, m - 1) == 0) {
+			return i;
+		}
+	}
+
+	return STRING_NOT_FOUND;
+}
+
+#ifdef HAVE_X86
+static String_len verify(const char *p, unsigned mask, const char *n, String_len m)
+{
+	unsigned bit;
+
+	for (; mask != 0; mask &= mask - 1) {
+		bit = __builtin_ctz(mask);
+
+		if (m <= 2 || memcmp(p + bit + 1, n + 1, m - 2) == 0) {
+			return bit;
+		}
+	}
+
+	return STRING_NOT_FOUND;
+}
+#endif
+
+static String_len count_char_scalar(const char *h, String_len n, char c)
+{
+	String_len i, count = 0;
+
+	for (i = 0; i < n; i++) {
+		count += h[i] == c;
+	}
+
+	return count;
+}
+
+static size_t critical_factorization(const unsigned char *n, size_t m,
+                                     size_t *period)
+{
+	size_t suffix, rsuffix, j, k, p;
+
+	/*
+	 * Maximal suffix for < and for >, the longest of the two is the
+	 * critical factorization. suffix starts at -1, so suffix + k wraps
+	 * around to k - 1.
+	 */
+	suffix = SIZE_MAX;
+	j = 0;
+	k = p = 1;
+
+	while (j + k < m) {
+		if (n[j + k] < n[suffix + k]) {
+			j += k;
+			k = 1;
+			p = j - suffix;
+		} else if (n[j + k] == n[suffix + k]) {
+			if (k != p) {
+				k++;
+			} else {
+				j += p;
+				k = 1;
+			}
+		} else {
+			suffix = j++;
+			k = p = 1;
+		}
+	}
+
+	*period = p;
+
+	rsuffix = SIZE_MAX;
+	j = 0;
+	k = p = 1;
+
+	while (j + k < m) {
+		if (n[j + k] > n[rsuffix + k]) {
+			j += k;
+			k = 1;
+			p = j - rsuffix;
+		} else if (n[j + k] == n[rsuffix + k]) {
+			if (k != p) {
+				k++;
+			} else {
+				j += p;
+				k = 1;
+			}
+		} else {
+			rsuffix = j++;
+			k = p = 1;
+		}
+	}
+
+	if (rsuffix + 1 < suffix + 1) {
+		return suffix + 1;
+	}
+
+	*period = p;
+	return rsuffix + 1;
+}
+
+static String_len two_way(const char *hay, String_len hlen,
+                          const char *needle, String_len m)
+{
+	const unsigned char *h = (const unsigned char *)hay;
+	const unsigned char *n = (const unsigned char *)needle;
+	size_t suffix, period, memory, shift, i, j;
+	size_t shift_table[256];
+
+	suffix = critical_factorization(n, m, &period);
+
+	/*
+	 * Horspool's bad character rule on the window's last byte skips most
+	 * windows without looking at them. When it says 0, the last bytes
+	 * match and the window is checked by Two-Way.
+	 */
+	for (i = 0; i < 256; i++) {
+		shift_table[i] = m;
+	}
+
+	for (i = 0; i < m; i++) {
+		shift_table[n[i]] = m - i - 1;
+	}
+
+	if (memcmp(n, n + period, suffix) == 0) {
+		/*
+		 * n is periodic: after a full match of the right half only a
+		 * period can be skipped, but what's already known to match
+		 * isn't compared again.
+		 */
+		for (j = 0, memory = 0; j <= hlen - m;) {
+			if ((shift = shift_table[h[j + m - 1]]) > 0) {
+				if (memory && shift < period) {
+					shift = m - period;
+				}
+
+				memory = 0;
+				j += shift;
+				continue;
+			}
+
+			for (i = suffix > memory ? suffix : memory; i < m - 1 && n[i] == h[i + j]; i++) {
+			}
+
+			if (i < m - 1) {
+				j += i - suffix + 1;
+				memory = 0;
+				continue;
+			}
+
+			for (i = suffix; i > memory && n[i - 1] == h[i - 1 + j]; i--) {
+			}
+
+			if (i <= memory) {
+				return j;
+			}
+
+			j += period;
+			memory = m - period;
+		}
+	} else {
+		/* the halves are distinct, any mismatch shifts as far as possible */
+		period = (suffix > m - suffix ? suffix : m - suffix) + 1;
+
+		for (j = 0; j <= hlen - m;) {
+			if ((shift = shift_table[h[j + m - 1]]) > 0) {
+				j += shift;
+				continue;
+			}
+
+			for (i = suffix; i < m - 1 && n[i] == h[i + j]; i++) {
+			}
+
+			if (i < m - 1) {
+				j += i - suffix + 1;
+				continue;
+			}
+
+			for (i = suffix; i > 0 && n[i - 1] == h[i - 1 + j]; i--) {
+			}
+
+			if (i == 0) {
+				return j;
+			}
+
+			j += period;
+		}
+	}
+
+	return STRING_NOT_FOUND;
+}
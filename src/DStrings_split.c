@@ -0,0 +1,381 @@
+/*
+ * File:    DStrings_split.c
+ * Author:  Eduardo Miravalls Sierra          <edu.miravalls@hotmail.com>
+ *
+ * Date:    2014-08-30 09:47
+ */
+
+/*
+ * Dynamic C Strings library.
+ * Copyright (C) 2014 Eduardo Miravalls Sierra
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+
+#include "DStrings_internal.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief bytes classified at once, one bit each.
+ */
+#define BLOCK 64
+
+/*
+ * The text is classified a block at a time into a bitmask of delimiters,
+ * kept in the splitter, and tokens are found with count trailing zeros on
+ * it. Delimiter sets of ASCII chars are classified with pshufb: lo maps a
+ * char's low nibble to the set of high nibbles (0 to 7) of the delimiters
+ * that have it, and the high nibble selects one bit of that. Other sets,
+ * and the last partial block, use the bitmap.
+ */
+
+/**
+ * @brief sets up a splitter.
+ *
+ * @param it splitter.
+ * @param v text.
+ * @param delims delimiters.
+ * @param n number of delimiters.
+ * @param skip_empty whether runs of delimiters are a single one.
+ */
+static void init(String_splitter *it, StringView v, const char *delims,
+                 unsigned n, char skip_empty);
+
+/**
+ * @brief finds the next delimiter, or non delimiter, from offset from on.
+ *
+ * @param it splitter.
+ * @param from first offset to look at.
+ * @param delim YES to look for a delimiter, NO for anything else.
+ *
+ * @return its offset, or the text's length if there's none.
+ */
+static String_len scan(String_splitter *it, String_len from, int delim);
+
+/**
+ * @brief produces the next token.
+ *
+ * @param it splitter.
+ * @param span where the token's offset and length are stored.
+ *
+ * @return 0 if there are no more tokens.
+ * @return != 0 otherwise.
+ */
+static int next_span(String_splitter *it, String_span *span);
+
+/**
+ * @brief classifies the block of it's text at offset block.
+ *
+ * @param it splitter.
+ * @param block offset, a multiple of BLOCK.
+ *
+ * @return bit i is set if the char at block + i is a delimiter.
+ */
+static uint64_t classify_block(const String_splitter *it, String_len block);
+
+/**
+ * @brief classifies a block of upto BLOCK chars with the bitmap.
+ *
+ * @param it splitter.
+ * @param p block.
+ * @param n block's length.
+ *
+ * @return bit i is set if p[i] is a delimiter.
+ */
+static uint64_t classify_scalar(const String_splitter *it, const char *p, String_len n);
+
+#ifdef HAVE_X86
+/* bit of each high nibble, the ones of non-ASCII chars select nothing */
+static const unsigned char high_bits[16] = {
+	1, 2, 4, 8, 16, 32, 64, 128, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+#define CLASSIFY_KERNEL(isa, vec, W, table, loadu, set1, and, shuffle, \
+                        srli16, cmpeq, movemask) \
+static __attribute__((target(#isa))) uint64_t \
+classify_##isa(const String_splitter *it, const char *p) \
+{ \
+	const vec nibble = set1(0x0f), zero = set1(0); \
+	const vec lo = table(it->lo), hi = table(high_bits); \
+	uint64_t mask = 0; \
+	unsigned i; \
+	vec v; \
+\
+	for (i = 0; i < BLOCK; i += W) { \
+		v = loadu((const vec *)(p + i)); \
+		v = and(shuffle(lo, and(v, nibble)), shuffle(hi, and(srli16(v, 4), nibble))); \
+		mask |= (uint64_t)(~movemask(cmpeq(v, zero)) & (unsigned)((1ull << W) - 1)) << i; \
+	} \
+\
+	return mask; \
+}
+
+#define table_ssse3(t) _mm_loadu_si128((const __m128i *)(t))
+#define table_avx2(t) _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(t)))
+
+CLASSIFY_KERNEL(ssse3, __m128i, 16, table_ssse3, _mm_loadu_si128, _mm_set1_epi8,
+                _mm_and_si128, _mm_shuffle_epi8, _mm_srli_epi16, _mm_cmpeq_epi8,
+                (unsigned)_mm_movemask_epi8)
+CLASSIFY_KERNEL(avx2, __m256i, 32, table_avx2, _mm256_loadu_si256, _mm256_set1_epi8,
+                _mm256_and_si256, _mm256_shuffle_epi8, _mm256_srli_epi16, _mm256_cmpeq_epi8,
+                (unsigned)_mm256_movemask_epi8)
+
+#undef CLASSIFY_KERNEL
+#undef table_ssse3
+#undef table_avx2
+
+#define classify(it, p) \
+	(!(it)->simd ? classify_scalar(it, p, BLOCK) : \
+	 __builtin_cpu_supports("avx2") ? classify_avx2(it, p) : \
+	 __builtin_cpu_supports("ssse3") ? classify_ssse3(it, p) : \
+	 classify_scalar(it, p, BLOCK))
+#else
+#define classify(it, p) classify_scalar(it, p, BLOCK)
+#endif
+
+void StringView_split(String_splitter *it, StringView v, char sep)
+{
+	assert(it != NULL);
+	assert(v.ptr != NULL || v.len == 0);
+	init(it, v, &sep, 1, NO);
+}
+
+void StringView_tokenize(String_splitter *it, StringView v, const char *delims)
+{
+	assert(it != NULL);
+	assert(v.ptr != NULL || v.len == 0);
+	assert(delims != NULL);
+	init(it, v, delims, strlen(delims), YES);
+}
+
+int String_splitter_next(String_splitter *it, StringView *token)
+{
+	String_span span;
+
+	assert(it != NULL);
+	assert(token != NULL);
+
+	if (!next_span(it, &span)) {
+		return 0;
+	}
+
+	/* not StringView_new, it would move empty fields out of the text */
+	token->ptr = it->ptr + span.offset;
+	token->len = span.len;
+	return 1;
+}
+
+String_len StringView_split_spans(StringView v, char sep,
+                                  String_span *spans, String_len max)
+{
+	String_splitter it;
+	String_len block, start = 0, end, n = 0;
+	uint64_t mask;
+
+	assert(spans != NULL || max == 0);
+
+	/* straight from the blocks' masks, every delimiter ends a field */
+	for (StringView_split(&it, v, sep), block = 0; block < v.len; block += BLOCK) {
+		for (mask = classify_block(&it, block); mask != 0; mask &= mask - 1) {
+			end = block + __builtin_ctzll(mask);
+
+			if (n < max) {
+				spans[n].offset = start;
+				spans[n].len = end - start;
+			}
+
+			n++;
+			start = end + 1;
+		}
+	}
+
+	if (n < max) {
+		spans[n].offset = start;
+		spans[n].len = v.len - start;
+	}
+
+	return n + 1;
+}
+
+String_len StringView_tokenize_spans(StringView v, const char *delims,
+                                     String_span *spans, String_len max)
+{
+	String_splitter it;
+	String_len block, start = 0, n = 0;
+	uint64_t text, edges, prev = 0;
+	unsigned bit;
+
+	assert(spans != NULL || max == 0);
+
+	/*
+	 * Tokens start where text follows a delimiter and end where a
+	 * delimiter follows text: the bits that differ from the previous one.
+	 * They alternate, start, end, start...
+	 */
+	for (StringView_tokenize(&it, v, delims), block = 0; block < v.len; block += BLOCK) {
+		text = ~classify_block(&it, block);
+
+		/* past the end is all delimiters, so a last token ends there */
+		if (v.len - block < BLOCK) {
+			text &= ((uint64_t)1 << (v.len - block)) - 1;
+		}
+
+		for (edges = text ^ (text << 1 | prev); edges != 0; edges &= edges - 1) {
+			bit = __builtin_ctzll(edges);
+
+			if (text >> bit & 1) {
+				start = block + bit;
+				continue;
+			}
+
+			if (n < max) {
+				spans[n].offset = start;
+				spans[n].len = block + bit - start;
+			}
+
+			n++;
+		}
+
+		prev = text >> (BLOCK - 1);
+	}
+
+	/* only a token running into the end of a full block is left open */
+	if (prev) {
+		if (n < max) {
+			spans[n].offset = start;
+			spans[n].len = v.len - start;
+		}
+
+		n++;
+	}
+
+	return n;
+}
+
+static void init(String_splitter *it, StringView v, const char *delims,
+                 unsigned n, char skip_empty)
+{
+	unsigned char c;
+	unsigned i;
+
+	it->ptr = v.ptr;
+	it->len = v.len;
+	it->pos = 0;
+	it->block = STRING_LEN_MAX;
+	it->mask = 0;
+	it->simd = YES;
+	it->skip_empty = skip_empty;
+	it->done = NO;
+	memset(it->lo, 0, sizeof(it->lo));
+	memset(it->set, 0, sizeof(it->set));
+
+	for (i = 0; i < n; i++) {
+		c = delims[i];
+		it->set[c / 8] |= 1u << c % 8;
+
+		if (c < 0x80) {
+			it->lo[c & 0x0f] |= 1u << (c >> 4);
+		} else {
+			it->simd = NO;
+		}
+	}
+}
+
+static int next_span(String_splitter *it, String_span *span)
+{
+	String_len start, end;
+
+	if (it->done) {
+		return 0;
+	}
+
+	if (it->skip_empty) {
+		if ((start = scan(it, it->pos, NO)) >= it->len) {
+			it->done = YES;
+			return 0;
+		}
+
+		end = scan(it, start, YES);
+		it->pos = end;
+	} else {
+		start = it->pos;
+		end = scan(it, start, YES);
+
+		/* a delimiter at the very end is followed by an empty field */
+		if (end >= it->len) {
+			it->done = YES;
+		} else {
+			it->pos = end + 1;
+		}
+	}
+
+	span->offset = start;
+	span->len = end - start;
+	return 1;
+}
+
+static String_len scan(String_splitter *it, String_len from, int delim)
+{
+	String_len block;
+	uint64_t mask;
+
+	while (from < it->len) {
+		block = from - from % BLOCK;
+
+		if (block != it->block) {
+			it->block = block;
+			it->mask = classify_block(it, block);
+		}
+
+		mask = (delim ? it->mask : ~it->mask) & ~(uint64_t)0 << (from - block);
+
+		if (mask != 0) {
+			from = block + __builtin_ctzll(mask);
+			return from < it->len ? from : it->len;
+		}
+
+		from = block + BLOCK;
+	}
+
+	return it->len;
+}
+
+static uint64_t classify_block(const String_splitter *it, String_len block)
+{
+	if (it->len - block < BLOCK) {
+		return classify_scalar(it, it->ptr + block, it->len - block);
+	}
+
+	return classify(it, it->ptr + block);
+}
+
+static uint64_t classify_scalar(const String_splitter *it, const char *p, String_len n)
+{
+	uint64_t mask = 0;
+	unsigned char c;
+	String_len i;
+
+	for (i = 0; i < n; i++) {
+		c = p[i];
+		mask |= (uint64_t)(it->set[c / 8] >> c % 8 & 1) << i;
+	}
+
+	return mask;
+}
@@ -27,6 +27,10 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
+#include <wchar.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "DStrings.h"
 
@@ -124,6 +128,34 @@ void test_ncpy_gap(void)
 	printf("passed!\n");
 }
 
+void test_ncat_self(void)
+{
+	String s;
+	char *greeting = "Hello World!\n";
+	unsigned greeting_len = strlen(greeting);
+	unsigned i;
+	unsigned n = 10;
+
+	printf("%s: ", __func__);
+
+	s = String_new_str(greeting);
+
+	for (i = 0; i < n; i++) {
+		assert(0 == String_ncat(s, String_raw(s), String_length(s) - 1));
+	}
+
+	assert((greeting_len << n) + 1 == String_length(s));
+
+	for (i = 0; i < (1u << n); i++) {
+		assert(0 == memcmp(String_raw(s) + greeting_len * i,
+		                   greeting,
+		                   greeting_len));
+	}
+
+	String_free(&s);
+	printf("passed!\n");
+}
+
 void test_ncat_with_initial_string_empty(void)
 {
 	String s;
@@ -266,6 +298,2153 @@ void test_shrink(void)
 	printf("passed!\n");
 }
 
+void test_short_strings(void)
+{
+	String s;
+	char *alphabet = "abcdefghijklmnopqrstuvwxyz";
+	unsigned i;
+
+	printf("%s: ", __func__);
+
+	s = String_new(alphabet, 3);
+	assert(0 == strcmp(String_raw(s), "abc"));
+	assert(4 == String_length(s));
+
+	/* grow out of any inline storage, one char at a time */
+	for (i = 3; i < strlen(alphabet); i++) {
+		assert(0 == String_ncat(s, alphabet + i, 1));
+		assert(0 == memcmp(String_raw(s), alphabet, i + 1));
+		assert(i + 2 == String_length(s));
+	}
+
+	assert(0 == strcmp(String_raw(s), alphabet));
+	String_free(&s);
+
+	s = String_new(alphabet, 5);
+	assert(0 == String_set_size(s, 3));
+	assert(0 == strcmp(String_raw(s), "ab"));
+	assert(0 == String_set_size(s, 100));
+	assert(100 == String_size(s));
+	assert(0 == strcmp(String_raw(s), "ab"));
+	String_free(&s);
+
+	s = String_new_steal(NULL, 0);
+	assert(0 == String_cpy_str(s, alphabet));
+	assert(0 == strcmp(String_raw(s), alphabet));
+	String_free(&s);
+
+	printf("passed!\n");
+}
+
+void test_arena(void)
+{
+	String_arena a;
+	String s[64];
+	String cpy;
+	char *alphabet = "abcdefghijklmnopqrstuvwxyz";
+	unsigned i, j;
+	unsigned n = sizeof(s) / sizeof(s[0]);
+
+	printf("%s: ", __func__);
+
+	a = String_arena_new(256);
+
+	for (j = 0; j < 3; j++) {
+		for (i = 0; i < n; i++) {
+			s[i] = String_new_arena_str(a, alphabet);
+			assert(s[i] != NULL);
+		}
+
+		/* the last one grows in place, the rest are copied */
+		for (i = 0; i < n; i++) {
+			assert(0 == String_cat_str(s[i], alphabet));
+			assert(0 == String_cat_str(s[n - 1], alphabet));
+		}
+
+		for (i = 0; i < n - 1; i++) {
+			assert(2 * strlen(alphabet) + 1 == String_length(s[i]));
+			assert(0 == strncmp(String_raw(s[i]), alphabet, strlen(alphabet)));
+			assert(0 == strcmp(String_raw(s[i]) + strlen(alphabet), alphabet));
+		}
+
+		assert((n + 2) * strlen(alphabet) + 1 == String_length(s[n - 1]));
+
+		cpy = String_dup_to(s[0], 9);
+		assert(0 == strcmp(String_raw(cpy), "abcdefghij"));
+		String_free(&cpy);
+		String_free(&s[0]);
+
+		String_arena_reset(a);
+	}
+
+	String_arena_free(&a);
+	assert(NULL == a);
+	printf("passed!\n");
+}
+
+struct counting_allocator {
+	unsigned blocks;  /* live blocks */
+	size_t bytes;     /* live bytes */
+	unsigned resizes; /* calls to resize */
+};
+
+static void *counting_alloc(void *ctx, size_t n)
+{
+	struct counting_allocator *c = ctx;
+
+	c->blocks++;
+	c->bytes += n;
+	return malloc(n);
+}
+
+static void *counting_resize(void *ctx, void *p, size_t old_size, size_t n)
+{
+	struct counting_allocator *c = ctx;
+
+	if (p == NULL) {
+		return counting_alloc(ctx, n);
+	}
+
+	c->resizes++;
+	c->bytes += n - old_size;
+	return realloc(p, n);
+}
+
+static void counting_release(void *ctx, void *p, size_t size)
+{
+	struct counting_allocator *c = ctx;
+
+	if (p != NULL) {
+		c->blocks--;
+		c->bytes -= size;
+		free(p);
+	}
+}
+
+void test_allocator(void)
+{
+	struct counting_allocator counters = {0, 0, 0};
+	String_allocator a = {
+		counting_alloc, counting_resize, counting_release, &counters
+	};
+	String s1, s2, s3;
+	char *alphabet = "abcdefghijklmnopqrstuvwxyz";
+	int i;
+
+	printf("%s: ", __func__);
+
+	s1 = String_new_with(&a, alphabet, 3);
+	assert(counters.blocks > 0);
+
+	String_set_allocator(&a);
+	assert(&a == String_get_allocator());
+	s2 = String_new_str(alphabet);
+	String_set_allocator(NULL);
+	assert(&a != String_get_allocator());
+
+	for (i = 0; i < 5; i++) {
+		String_cat_str(s1, alphabet);
+		String_cat_str(s2, String_raw(s1));
+	}
+
+	String_set_size(s2, 7);
+	String_cpy_str(s2, alphabet);
+	s3 = String_dup(s1);
+
+	String_free(&s1);
+	String_free(&s2);
+	assert(counters.blocks > 0);
+	String_free(&s3);
+
+	/* appenders follow the growth policy, repeated appends don't resize each time */
+	s1 = String_new_with(&a, "", 0);
+	s2 = String_new_with(&a, "", 0);
+	s3 = String_new_with(&a, "", 0);
+	counters.resizes = 0;
+
+	for (i = 0; i < 10000; i++) {
+		assert(0 == String_cat_str(s1, "a"));
+		assert(0 == String_cat_latin1(s2, "\xe9", 1));
+		assert(0 == String_cat_utf16(s3, (const uint16_t []){0x20ac}, 1));
+	}
+
+	assert(10001 == String_length(s1));
+	assert(20001 == String_length(s2));
+	assert(30001 == String_length(s3));
+	assert(counters.resizes < 3 * 20);
+	String_free(&s1);
+	String_free(&s2);
+	String_free(&s3);
+
+	assert(0 == counters.blocks);
+	assert(0 == counters.bytes);
+	printf("passed!\n");
+}
+
+void test_compare(void)
+{
+	String s1, s2, s3, s4;
+	char binary[] = {'a', 0, 'b'};
+
+	printf("%s: ", __func__);
+
+	s1 = String_new_str("Hello");
+	s2 = String_new_str("Hello World!\n");
+	s3 = String_new_empty();
+	s4 = String_new_empty();
+
+	assert(-1 == String_cmp(s1, s2));
+	assert(1 == String_cmp(s2, s1));
+	assert(0 == String_cmp(s1, s1));
+	assert(0 == String_ncmp(s1, s2, 5));
+	assert(-1 == String_ncmp(s1, s2, 6));
+	assert(String_nequals(s1, s2, 5));
+	assert(!String_equals(s1, s2));
+	assert(String_equals(s3, s4));
+	assert(-1 == String_cmp(s3, s1));
+
+	/* embedded '\0's are compared too */
+	String_ncpy(s3, binary, 3);
+	String_ncpy(s4, binary, 2);
+	assert(1 == String_cmp(s3, s4));
+	assert(!String_equals(s3, s4));
+	String_ncat(s4, binary + 2, 1);
+	assert(String_equals(s3, s4));
+	String_ncpy_at(s4, 2, "c", 1);
+	assert(-1 == String_cmp(s3, s4));
+
+	assert(String_starts_with(s2, s1));
+	assert(!String_starts_with(s1, s2));
+	assert(String_starts_with_str(s2, ""));
+	assert(String_ends_with_str(s2, "World!\n"));
+	assert(!String_ends_with_str(s1, "World!\n"));
+	assert(String_ends_with(s1, s1));
+	assert(String_nends_with(s3, binary + 1, 2));
+
+	String_free(&s4);
+	String_free(&s3);
+	String_free(&s2);
+	String_free(&s1);
+	printf("passed!\n");
+}
+
+void test_hash(void)
+{
+	String s1, s2;
+	char *alphabet = "abcdefghijklmnopqrstuvwxyz";
+	uint64_t h;
+	unsigned i;
+
+	printf("%s: ", __func__);
+
+	s1 = String_new_empty();
+	s2 = String_new_empty();
+	assert(String_hash(s1) == String_hash(s2));
+
+	/* every length goes through a different path */
+	for (i = 0; i < 3 * strlen(alphabet); i++) {
+		h = String_hash(s1);
+		String_ncat(s1, alphabet + i % strlen(alphabet), 1);
+		assert(h != String_hash(s1));
+		assert(!String_equals(s1, s2));
+
+		String_ncat(s2, alphabet + i % strlen(alphabet), 1);
+		assert(String_hash(s1) == String_hash(s2));
+		assert(String_equals(s1, s2));
+	}
+
+	/* mutators invalidate the cached hash */
+	h = String_hash(s1);
+	String_ncpy_at(s1, 1, "B", 1);
+	assert(h != String_hash(s1));
+	assert(!String_equals(s1, s2));
+
+	h = String_hash(s1);
+	String_set_size(s1, 2);
+	assert(String_hash(s1) != h);
+
+#if _BSD_SOURCE || _XOPEN_SOURCE >= 500 || _ISOC99_SOURCE || _POSIX_C_SOURCE >= 200112L
+	h = String_hash(s2);
+	String_format(s2, "%s", "a");
+	assert(String_hash(s2) != h);
+	assert(String_equals(s1, s2));
+	assert(String_hash(s1) == String_hash(s2));
+#endif
+
+	String_free(&s2);
+	String_free(&s1);
+	printf("passed!\n");
+}
+
+#define INTERN_THREADS 4
+#define INTERN_KEYS 1000
+
+static void *intern_keys(void *arg)
+{
+	String *interned = arg;
+	char key[32];
+	unsigned i;
+
+	for (i = 0; i < INTERN_KEYS; i++) {
+		sprintf(key, "key-%u", i);
+		interned[i] = String_intern_str(key);
+		/* read only, though other threads hold the same String */
+		assert(String_utf8_validate(interned[i]) && String_is_ascii(interned[i]));
+	}
+
+	return NULL;
+}
+
+void test_intern(void)
+{
+	String s1, s2, i1, i2, i3;
+	static String interned[INTERN_THREADS][INTERN_KEYS];
+	pthread_t threads[INTERN_THREADS];
+	unsigned i, j;
+
+	printf("%s: ", __func__);
+
+	s1 = String_new_str("Hello World!\n");
+	s2 = String_dup_to(s1, 4);
+
+	i1 = String_intern(s1);
+	i2 = String_intern_str("Hello World!\n");
+	i3 = String_intern(s2);
+
+	assert(i1 != s1);
+	assert(i1 == i2);
+	assert(i1 != i3);
+	assert(String_is_interned(i1));
+	assert(!String_is_interned(s1));
+	assert(String_intern(i1) == i1);
+	assert(String_equals(i1, s1));
+	assert(!String_equals(i1, i3));
+	assert(String_length(i1) == String_length(s1));
+	assert(0 == strcmp(String_raw(i3), "Hello"));
+
+	/* immutable */
+	assert(0 != String_cat_str(i1, "!"));
+	assert(0 != String_ncpy(i1, "J", 1));
+	assert(0 != String_set_size(i1, 100));
+	assert(0 == strcmp(String_raw(i1), "Hello World!\n"));
+
+	/* what's cached is known from the start */
+	assert(String_is_ascii(i1) && String_utf8_validate(i1));
+	i2 = String_intern_str("caf\xc3\xa9");
+	assert(String_utf8_validate(i2) && !String_is_ascii(i2));
+	i2 = String_intern_str("caf\xe9");
+	assert(!String_utf8_validate(i2) && !String_is_ascii(i2));
+	i2 = String_intern_str("Hello World!\n");
+
+	/* owned by the table */
+	String_free(&i2);
+	assert(NULL == i2);
+	assert(0 == strcmp(String_raw(i1), "Hello World!\n"));
+
+	for (i = 0; i < INTERN_THREADS; i++) {
+		pthread_create(&threads[i], NULL, intern_keys, interned[i]);
+	}
+
+	for (i = 0; i < INTERN_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	for (i = 1; i < INTERN_THREADS; i++) {
+		for (j = 0; j < INTERN_KEYS; j++) {
+			assert(interned[i][j] == interned[0][j]);
+		}
+	}
+
+	String_intern_clear();
+	String_free(&s2);
+	String_free(&s1);
+	printf("passed!\n");
+}
+
+#define DUP_THREADS 4
+
+static void *dup_and_free(void *arg)
+{
+	String *s = arg;
+	String cpy;
+	unsigned i;
+
+	for (i = 0; i < 1000; i++) {
+		cpy = String_dup(*s);
+		assert(String_equals(cpy, *s));
+
+		if (i % 2) {
+			String_cat_str(cpy, "!");
+		}
+
+		String_free(&cpy);
+	}
+
+	String_free(s);
+	return NULL;
+}
+
+struct dup_job {
+	String src;
+	String cpy;
+};
+
+static void *dup_once(void *arg)
+{
+	struct dup_job *job = arg;
+
+	job->cpy = String_dup(job->src);
+	return NULL;
+}
+
+void test_dup_cow(void)
+{
+	String s1, s2, s3, s4;
+	String shared[DUP_THREADS];
+	pthread_t threads[DUP_THREADS];
+	struct dup_job jobs[DUP_THREADS];
+	char *alphabet = "abcdefghijklmnopqrstuvwxyz";
+	unsigned i, round;
+
+	printf("%s: ", __func__);
+
+	s1 = String_new_str(alphabet);
+	String_cat_str(s1, alphabet);
+
+	s2 = String_dup(s1);
+	s3 = String_dup(s2);
+	assert(String_raw(s1) == String_raw(s2));
+	assert(String_raw(s1) == String_raw(s3));
+	assert(String_length(s1) == String_length(s2));
+
+	/* the first write gets a copy */
+	assert(0 == String_ncpy_at(s2, 0, "A", 1));
+	assert(String_raw(s1) != String_raw(s2));
+	assert(0 == strcmp(String_raw(s2), "A"));
+	assert(0 == strncmp(String_raw(s1), alphabet, strlen(alphabet)));
+	assert(0 == strncmp(String_raw(s3), alphabet, strlen(alphabet)));
+
+	/* overlapping copies from the shared raw string */
+	assert(0 == String_ncat(s3, String_raw(s3), 26));
+	assert(3 * strlen(alphabet) + 1 == String_length(s3));
+	assert(2 * strlen(alphabet) + 1 == String_length(s1));
+
+	String_free(&s1);
+	s1 = String_dup(s3);
+	assert(0 == String_set_size(s3, 27));
+	assert(0 == strcmp(String_raw(s3), alphabet));
+	assert(3 * strlen(alphabet) + 1 == String_length(s1));
+
+	/* slices are clamped and copied */
+	s4 = String_dup_from(s3, 20);
+	assert(0 == strcmp(String_raw(s4), "uvwxyz"));
+	String_free(&s4);
+	s4 = String_dup_slice(s3, 30, 40);
+	assert(1 == String_length(s4));
+	String_free(&s4);
+
+	for (i = 0; i < DUP_THREADS; i++) {
+		shared[i] = String_dup(s1);
+	}
+
+	String_free(&s1);
+
+	for (i = 0; i < DUP_THREADS; i++) {
+		pthread_create(&threads[i], NULL, dup_and_free, &shared[i]);
+	}
+
+	for (i = 0; i < DUP_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	/* first dups of a String that isn't shared yet, from several threads */
+	for (round = 0; round < 50; round++) {
+		s4 = String_dup(s3);
+		String_cat_str(s4, "!");
+
+		for (i = 0; i < DUP_THREADS; i++) {
+			jobs[i].src = s4;
+			pthread_create(&threads[i], NULL, dup_once, &jobs[i]);
+		}
+
+		for (i = 0; i < DUP_THREADS; i++) {
+			pthread_join(threads[i], NULL);
+			assert(String_raw(jobs[i].cpy) == String_raw(s4));
+			assert(String_equals(jobs[i].cpy, s4));
+		}
+
+		String_free(&s4);
+
+		for (i = 0; i < DUP_THREADS; i++) {
+			String_free(&jobs[i].cpy);
+		}
+	}
+
+	String_free(&s3);
+	String_free(&s2);
+	printf("passed!\n");
+}
+
+void test_view(void)
+{
+	String s1, s2;
+	StringView v1, v2, v3;
+	char binary[] = {'a', 0, 'b'};
+
+	printf("%s: ", __func__);
+
+	s1 = String_new_str("Hello World!\n");
+	v1 = String_view(s1);
+	assert(v1.ptr == String_raw(s1));
+	assert(v1.len == String_length(s1) - 1);
+
+	v2 = String_view_slice(s1, 6, 10);
+	assert(5 == v2.len);
+	assert(0 == memcmp(v2.ptr, "World", 5));
+	assert(StringView_equal(v2, StringView_str("World")));
+	assert(StringView_ends_with(v1, StringView_slice(v1, 6, 100)));
+	assert(StringView_starts_with(v1, StringView_slice(v1, 0, 4)));
+	assert(!StringView_starts_with(v2, v1));
+	assert(0 == StringView_slice(v1, 100, 200).len);
+
+	assert(-1 == StringView_compare(v1, v2));
+	assert(1 == StringView_compare(v2, v1));
+	assert(0 == StringView_compare(v2, v2));
+
+	/* views hash like the Strings they look at */
+	s2 = String_new_view(v2);
+	assert(0 == strcmp(String_raw(s2), "World"));
+	assert(StringView_hash(v2) == String_hash(s2));
+	assert(String_intern_view(v2) == String_intern(s2));
+	String_free(&s2);
+
+	v3 = StringView_new(binary, sizeof(binary));
+	s2 = String_new_view(v3);
+	assert(sizeof(binary) + 1 == String_length(s2));
+	assert(StringView_equal(String_view(s2), v3));
+
+	String_cat_view(s2, v2);
+	assert(StringView_ends_with(String_view(s2), v2));
+
+	String_intern_clear();
+	String_free(&s2);
+	String_free(&s1);
+	printf("passed!\n");
+}
+
+/* formats with String_format and snprintf and compares both outputs */
+#define check_format(s, ...)                                        \
+	do {                                                            \
+		char expected[512];                                         \
+		snprintf(expected, sizeof(expected), __VA_ARGS__);          \
+		assert(0 == String_format(s, __VA_ARGS__));                 \
+		assert(0 == strcmp(String_raw(s), expected));               \
+		assert(String_length(s) == strlen(expected) + 1);           \
+	} while (0)
+
+void test_format_conversions(void)
+{
+	String s;
+	long long big = -9223372036854775807LL - 1;
+	int n = 0;
+
+	printf("%s: ", __func__);
+
+	s = String_new_empty();
+
+	check_format(s, "%d|%i|%u|%o|%x|%X", -42, 17, 4000000000u, 8, 255, 255);
+	check_format(s, "%5d|%-5d|%05d|%+d|% d|%+05d", 42, 42, -42, 42, 42, -42);
+	check_format(s, "%.0d|%.3d|%8.3d|%-8.3x|%#.0o|%#o|%#x|%#X", 0, 7, -7,
+	             10, 0, 8, 0, 255);
+	check_format(s, "%*d|%-*d|%.*d|%*.*x", 6, 1, -6, 2, 4, 3, 8, 4, 255);
+	check_format(s, "%hhd|%hhu|%hd|%hu", 300, 300, 70000, 70000);
+	check_format(s, "%ld|%lld|%llu|%lx|%jd|%zu|%td", -1L, big,
+	             18446744073709551615ULL, 0xdeadbeefUL, (intmax_t)-5,
+	             (size_t)123456789, (ptrdiff_t)-3);
+	check_format(s, "%c|%3c|%-3c|%s|%.3s|%8s|%-8s|%%", 'a', 'b', 'c', "str",
+	             "string", "right", "left");
+	check_format(s, "%p|%12p|%-14p", (void *)&n, (void *)&n, (void *)NULL);
+	check_format(s, "%f|%.2f|%10.3e|%-10g|%+.1E|%a|%Lf|%08.3f", 3.14159,
+	             2.5, 12345.678, 0.0001, -1.0, 1.0, (long double)1.5, -2.5);
+	check_format(s, "%lc|%ls", (wint_t)'w', L"wide");
+	check_format(s, "%s", "a string long enough to need more than one resize "
+	             "of the String's buffer while it's being formatted");
+	check_format(s, "%200d|%.100f", 1, 1.0 / 3);
+
+	assert(0 == String_format(s, "abc%n%s", &n, "def"));
+	assert(3 == n);
+	assert(-1 == String_format(s, "%1$d", 1));
+	assert(-1 == String_format(s, "%y", 1));
+
+	/* appending at the end doesn't touch what's before */
+	String_format(s, "%s", "value=");
+	assert(0 == String_format_at(s, String_length(s) - 1, "%d %s", 42, "ms"));
+	assert(0 == strcmp(String_raw(s), "value=42 ms"));
+
+	String_free(&s);
+	printf("passed!\n");
+}
+
+void test_append(void)
+{
+	String s;
+
+	printf("%s: ", __func__);
+
+	s = String_new_empty();
+	assert(0 == String_append_i64(s, 0));
+	assert(0 == String_append_char(s, ' '));
+	assert(0 == String_append_i64(s, -9223372036854775807LL - 1));
+	assert(0 == String_append_char(s, ' '));
+	assert(0 == String_append_u64(s, 18446744073709551615ULL));
+	assert(0 == String_append_char(s, ' '));
+	assert(0 == String_append_hex(s, 0xdeadbeef));
+	assert(0 == String_append_char(s, ' '));
+	assert(0 == String_append_hex(s, 0));
+	assert(0 == strcmp(String_raw(s), "0 -9223372036854775808 "
+	                   "18446744073709551615 deadbeef 0"));
+	assert(String_length(s) == strlen(String_raw(s)) + 1);
+
+	String_ncpy(s, "", 0);
+	assert(0 == String_append_double(s, 0.1));
+	assert(0 == String_append_char(s, ' '));
+	assert(0 == String_append_double(s, 1.0 / 3));
+	assert(0 == String_append_char(s, ' '));
+	assert(0 == String_append_double(s, -1e300));
+	assert(0 == String_append_char(s, ' '));
+	assert(0 == String_append_double(s, 42));
+	assert(0 == strcmp(String_raw(s), "0.1 0.3333333333333333 -1e+300 42"));
+
+	/* '\0' can be appended too */
+	String_ncpy(s, "a", 1);
+	assert(0 == String_append_char(s, '\0'));
+	assert(0 == String_append_char(s, 'b'));
+	assert(4 == String_length(s));
+	assert(0 == memcmp(String_raw(s), "a\0b", 4));
+
+	String_free(&s);
+	printf("passed!\n");
+}
+
+void test_catv(void)
+{
+	String s, parts[3];
+	struct iovec iov[3];
+
+	printf("%s: ", __func__);
+
+	s = String_new_str("a");
+	iov[0].iov_base = "bc";
+	iov[0].iov_len = 2;
+	iov[1].iov_base = "";
+	iov[1].iov_len = 0;
+	iov[2].iov_base = "defghijklmnopqrstuvwxyz0123456789";
+	iov[2].iov_len = 33;
+	assert(0 == String_catv(s, iov, 3));
+	assert(0 == strcmp(String_raw(s), "abcdefghijklmnopqrstuvwxyz0123456789"));
+	assert(String_length(s) == 37);
+
+	/* fragments inside dest survive it moving */
+	assert(0 == String_set_size(s, 37));
+	iov[0].iov_base = String_raw(s);
+	iov[0].iov_len = 3;
+	iov[1].iov_base = String_raw(s) + 26;
+	iov[1].iov_len = 10;
+	iov[2] = iov[0];
+	assert(0 == String_catv(s, iov, 3));
+	assert(0 == strcmp(String_raw(s), "abcdefghijklmnopqrstuvwxyz0123456789"
+	                   "abc0123456789abc"));
+
+	assert(0 == String_cpy_str(s, "x"));
+	assert(0 == String_cat_strs(s, "y", "", "z", String_raw(s), NULL));
+	assert(0 == strcmp(String_raw(s), "xyzx"));
+	assert(0 == String_cat_strs(s, NULL));
+	assert(0 == strcmp(String_raw(s), "xyzx"));
+
+	parts[0] = String_new_str("usr");
+	parts[1] = String_new_str("local");
+	parts[2] = String_new_str("bin");
+	assert(0 == String_cpy_str(s, "/"));
+	assert(0 == String_join(s, parts, 3, "/", 1));
+	assert(0 == strcmp(String_raw(s), "/usr/local/bin"));
+	assert(0 == String_join(s, parts, 0, ", ", 2));
+	assert(0 == strcmp(String_raw(s), "/usr/local/bin"));
+
+	/* dest as one of the parts */
+	String_free(&parts[1]);
+	parts[1] = s;
+	assert(0 == String_join(s, parts, 3, ", ", 2));
+	assert(0 == strcmp(String_raw(s), "/usr/local/binusr, /usr/local/bin, bin"));
+	parts[1] = NULL;
+
+	/* String_cpy and String_cat take Strings */
+	assert(0 == String_cpy(s, parts[0]));
+	assert(0 == String_cat(s, parts[2]));
+	assert(0 == String_cat(s, s));
+	assert(0 == strcmp(String_raw(s), "usrbinusrbin"));
+	assert(String_length(s) == 13);
+
+	String_free(&parts[0]);
+	String_free(&parts[2]);
+	String_free(&s);
+	printf("passed!\n");
+}
+
+void test_growth(void)
+{
+	String s;
+	unsigned i;
+
+	printf("%s: ", __func__);
+
+	assert(64 == String_growth_pow2(32, 33));
+	assert(64 == String_growth_pow2(0, 64));
+	assert(STRING_LEN_MAX == String_growth_pow2(0, STRING_LEN_MAX));
+	assert(48 == String_growth_1_5x(32, 33));
+	assert(112 == String_growth_1_5x(32, 100));
+	assert(STRING_LEN_MAX == String_growth_1_5x(STRING_LEN_MAX - 100,
+	                                           STRING_LEN_MAX - 99));
+	assert(65536 == String_growth_pages(32768, 40000));
+	assert(98304 == String_growth_pages(65536, 65537));
+	assert(1u << 21 == String_growth_hugepages(1u << 20, 1u << 21));
+	assert(4u << 20 == String_growth_hugepages(2u << 20, (2u << 20) + 1));
+
+	s = String_new_str("Hello");
+
+	/* reserve never shrinks, and doesn't round */
+	assert(0 == String_reserve(s, 1000));
+	assert(1000 == String_size(s));
+	assert(0 == String_reserve(s, 10));
+	assert(1000 == String_size(s));
+	assert(0 == strcmp(String_raw(s), "Hello"));
+
+	String_set_growth_of(s, String_growth_1_5x);
+
+	for (i = 0; i < 1000; i++) {
+		String_cat_str(s, "x");
+	}
+
+	assert(1504 == String_size(s));
+	assert(1006 == String_length(s));
+
+	String_set_growth(String_growth_pages);
+	assert(String_growth_pages == String_get_growth());
+	String_set_growth_of(s, NULL);
+	String_set_growth(NULL);
+	assert(String_growth_pow2 == String_get_growth());
+
+	String_free(&s);
+	printf("passed!\n");
+}
+
+#if defined(DSTRINGS_SIZE_T) && SIZE_MAX > 0xffffffffu
+/*
+ * Allocator whose big blocks are the same 64 MiB of memory mapped over
+ * and over, so a String can grow past 4 GiB without needing the RAM.
+ */
+#define ALIAS_BLOCK ((size_t)64 << 20)
+
+static void *alias_alloc(void *ctx, size_t n)
+{
+	char *p;
+	size_t i;
+
+	if (n < ALIAS_BLOCK) {
+		return malloc(n);
+	}
+
+	n = (n + ALIAS_BLOCK - 1) & ~(ALIAS_BLOCK - 1);
+
+	if ((p = mmap(NULL, n, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+	              -1, 0)) == MAP_FAILED) {
+		return NULL;
+	}
+
+	for (i = 0; i < n; i += ALIAS_BLOCK) {
+		if (mmap(p + i, ALIAS_BLOCK, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+		         *(int *)ctx, 0) == MAP_FAILED) {
+			munmap(p, n);
+			return NULL;
+		}
+	}
+
+	return p;
+}
+
+static void alias_release(void *ctx, void *p, size_t size)
+{
+	(void)ctx;
+
+	if (size < ALIAS_BLOCK) {
+		free(p);
+
+	} else if (p != NULL) {
+		munmap(p, (size + ALIAS_BLOCK - 1) & ~(ALIAS_BLOCK - 1));
+	}
+}
+
+static void *alias_resize(void *ctx, void *p, size_t old_size, size_t n)
+{
+	void *q;
+
+	if (n < ALIAS_BLOCK) {
+		return realloc(p, n);
+	}
+
+	/* big blocks can't be moved, the test grows straight to its size */
+	if (old_size >= ALIAS_BLOCK || (q = alias_alloc(ctx, n)) == NULL) {
+		return NULL;
+	}
+
+	memcpy(q, p, old_size);
+	free(p);
+	return q;
+}
+
+static void test_past_4GiB(void)
+{
+	const size_t chunk = 1 << 20, target = ((size_t)4 << 30) + chunk;
+	String_allocator a = {alias_alloc, alias_resize, alias_release, NULL};
+	char name[] = "/tmp/DStrings_test_XXXXXX";
+	char *fragment;
+	String s;
+	int fd;
+
+	if ((fd = mkstemp(name)) < 0) {
+		printf("skipped, no temporary file... ");
+		return;
+	}
+
+	unlink(name);
+	a.ctx = &fd;
+
+	if (ftruncate(fd, ALIAS_BLOCK) || (fragment = malloc(chunk)) == NULL) {
+		printf("skipped, no memory... ");
+		close(fd);
+		return;
+	}
+
+	memset(fragment, 'x', chunk);
+	fragment[chunk - 1] = 'y';
+	s = String_new_with(&a, "head", 4);
+
+	if (String_reserve(s, target + 64)) {
+		printf("skipped, no address space... ");
+		String_free(&s);
+		free(fragment);
+		close(fd);
+		return;
+	}
+
+	while (String_length(s) < target) {
+		assert(0 == String_ncat(s, fragment, chunk));
+	}
+
+	assert(0 == String_cat_str(s, "tail"));
+	assert(String_length(s) == 4 + target + 4 + 1);
+	assert(String_length(s) > ((size_t)4 << 30));
+	assert(0 == memcmp(String_raw(s) + String_length(s) - 6, "ytail", 6));
+
+	String_free(&s);
+	free(fragment);
+	close(fd);
+}
+#endif
+
+void test_large(void)
+{
+	String s;
+
+	printf("%s: ", __func__);
+
+	/* lengths that would overflow are refused, s is left alone */
+	s = String_new_str("abc");
+	assert(-1 == String_ncpy_at(s, STRING_LEN_MAX - 2, "abc", 3));
+	assert(-1 == String_ncpy_at(s, STRING_LEN_MAX, "", 0));
+	assert(-1 == String_format_at(s, STRING_LEN_MAX, "%d", 1));
+	assert(0 == strcmp(String_raw(s), "abc"));
+	String_free(&s);
+
+#if defined(DSTRINGS_SIZE_T) && SIZE_MAX > 0xffffffffu
+	test_past_4GiB();
+#endif
+
+	printf("passed!\n");
+}
+
+void test_mmap(void)
+{
+	char name[] = "/tmp/DStrings_test_XXXXXX";
+	char page[4096];
+	String s, dup;
+	unsigned i;
+	FILE *f;
+	int fd;
+
+	printf("%s: ", __func__);
+
+	/* growing past the threshold, and back below it */
+	s = String_new_mmap("0123456789", 10);
+
+	for (i = 0; i < 100000; i++) {
+		assert(0 == String_ncat(s, "0123456789", 10));
+	}
+
+	assert(String_length(s) == 1000011);
+	assert(0 == memcmp(String_raw(s) + 999990, "0123456789", 10));
+	assert(0 == String_set_size(s, 100));
+	assert(0 == strcmp(String_raw(s), "0123456789012345678901234567890123456789"
+	                   "01234567890123456789012345678901234567890123456789"
+	                   "012345678"));
+	String_free(&s);
+
+	assert(NULL == String_new_mmap_file("/nonexistent/file"));
+
+	/* a file that ends on a page boundary still gets its '\0' */
+	assert((fd = mkstemp(name)) >= 0);
+	assert((f = fdopen(fd, "w")) != NULL);
+	memset(page, 'a', sizeof(page));
+	fwrite(page, 1, sizeof(page), f);
+	fclose(f);
+
+	assert((s = String_new_mmap_file(name)) != NULL);
+	assert(String_length(s) == sizeof(page) + 1);
+	assert(strlen(String_raw(s)) == sizeof(page));
+	assert(String_nstarts_with(s, "aaaa", 4));
+
+	/* read only */
+	assert(-1 == String_ncat(s, "b", 1));
+	assert(-1 == String_format(s, "%d", 1));
+	assert(-1 == String_set_size(s, 10));
+
+	/* copies are ordinary Strings */
+	dup = String_dup(s);
+	assert(String_equal(s, dup));
+	assert(0 == String_cat_str(dup, "b"));
+	String_free(&dup);
+	String_free(&s);
+
+	/* an empty file */
+	assert((f = fopen(name, "w")) != NULL);
+	fclose(f);
+	assert((s = String_new_mmap_file(name)) != NULL);
+	assert(1 == String_length(s));
+	assert(0 == strcmp(String_raw(s), ""));
+	String_free(&s);
+
+	unlink(name);
+	printf("passed!\n");
+}
+
+void test_io(void)
+{
+	char name[] = "/tmp/DStrings_test_XXXXXX";
+	String s, read, parts[3];
+	int fd, pipefd[2];
+	unsigned i;
+	FILE *f;
+
+	printf("%s: ", __func__);
+
+	assert((fd = mkstemp(name)) >= 0);
+	s = String_new_str("first line\nsecond line\n");
+
+	/* a file bigger than any chunk the String would grow by */
+	for (i = 0; i < 20000; i++) {
+		String_cat_str(s, "0123456789");
+	}
+
+	String_cat_str(s, "\nlast line, no newline");
+	assert(0 == String_write_fd(s, fd));
+	close(fd);
+
+	read = String_new_str("prefix:");
+	assert(0 == String_read_file(read, name));
+	assert(String_length(read) == String_length(s) + 7);
+	assert(0 == memcmp(String_raw(read), "prefix:", 7));
+	assert(0 == strcmp(String_raw(read) + 7, String_raw(s)));
+	assert(-1 == String_read_file(read, "/nonexistent/file"));
+	String_free(&read);
+
+	/* a pipe, its size is unknown */
+	assert(0 == pipe(pipefd));
+	parts[0] = String_new_str("abc");
+	parts[1] = String_new_empty();
+	parts[2] = String_new_str("defgh");
+	assert(0 == String_writev_fd(pipefd[1], parts, 3));
+	close(pipefd[1]);
+	read = String_new_empty();
+	assert(0 == String_read_fd(read, pipefd[0]));
+	assert(0 == strcmp(String_raw(read), "abcdefgh"));
+	close(pipefd[0]);
+
+	/* readv fills the Strings' spare room in order */
+	assert(0 == pipe(pipefd));
+	assert(0 == String_write_fd(read, pipefd[1]));
+	close(pipefd[1]);
+	assert(0 == String_reserve(parts[0], 100));
+	assert(0 == String_reserve(parts[1], 100));
+	memset(String_raw(parts[0]), 'x', 96);
+	String_ncpy(parts[0], String_raw(parts[0]), 96);
+	String_ncpy(parts[1], "", 0);
+	assert(8 == String_readv_fd(pipefd[0], parts, 2));
+	assert(99 == String_length(parts[0]) - 1);
+	assert(0 == strcmp(String_raw(parts[0]) + 96, "abc"));
+	assert(0 == strcmp(String_raw(parts[1]), "defgh"));
+	assert(0 == String_readv_fd(pipefd[0], parts, 0));
+	close(pipefd[0]);
+
+	assert((f = fopen(name, "r")) != NULL);
+	assert(0 == String_getline(read, f));
+	assert(0 == strcmp(String_raw(read), "first line\n"));
+	assert(0 == String_getline(read, f));
+	assert(0 == strcmp(String_raw(read), "second line\n"));
+	assert(0 == String_getline(read, f));
+	assert(200001 == String_length(read) - 1);
+	assert(0 == String_getline(read, f));
+	assert(0 == strcmp(String_raw(read), "last line, no newline"));
+	assert(-1 == String_getline(read, f));
+	assert(0 == strcmp(String_raw(read), ""));
+	fclose(f);
+
+	for (i = 0; i < 3; i++) {
+		String_free(&parts[i]);
+	}
+
+	String_free(&read);
+	String_free(&s);
+	unlink(name);
+	printf("passed!\n");
+}
+
+static String_len naive_find(const char *h, String_len hlen, const char *n, String_len m)
+{
+	String_len i;
+
+	for (i = 0; m <= hlen && i <= hlen - m; i++) {
+		if (memcmp(h + i, n, m) == 0) {
+			return i;
+		}
+	}
+
+	return STRING_NOT_FOUND;
+}
+
+static String_len naive_rfind(const char *h, String_len hlen, const char *n, String_len m)
+{
+	String_len i;
+
+	for (i = hlen - m + 1; m <= hlen && i-- > 0;) {
+		if (memcmp(h + i, n, m) == 0) {
+			return i;
+		}
+	}
+
+	return STRING_NOT_FOUND;
+}
+
+void test_search(void)
+{
+	char h[300], n[100];
+	String s;
+	StringView v;
+	String_len hlen, m, i, j, count;
+	unsigned round;
+
+	printf("%s: ", __func__);
+
+	s = String_new_str("one two one two three");
+	assert(0 == String_find_str(s, "one"));
+	assert(8 == String_rfind_str(s, "one"));
+	assert(4 == String_find_str(s, "two"));
+	assert(19 == String_find_str(s, "ee"));
+	assert(STRING_NOT_FOUND == String_find_str(s, "four"));
+	assert(STRING_NOT_FOUND == String_rfind_str(s, "one two one two three!"));
+	assert(0 == String_find_str(s, ""));
+	assert(21 == String_rfind_str(s, ""));
+	assert(3 == String_find_char(s, ' '));
+	assert(15 == String_rfind_char(s, ' '));
+	assert(STRING_NOT_FOUND == String_find_char(s, 'z'));
+	assert(2 == String_count_str(s, "one"));
+	assert(4 == String_count_str(s, "e"));
+	assert(0 == String_count_str(s, ""));
+
+	/* slices, offsets are relative to them */
+	v = String_view_slice(s, 4, 14);
+	assert(4 == StringView_find(v, StringView_str("one")));
+	assert(STRING_NOT_FOUND == StringView_find(v, StringView_str("three")));
+	assert(2 == StringView_count(v, StringView_str("two")));
+
+	/* '\0' is just another char */
+	String_ncpy(s, "ab\0cd\0cd", 8);
+	assert(2 == String_find(s, "\0cd", 3));
+	assert(5 == String_rfind(s, "\0cd", 3));
+	assert(5 == String_rfind_char(s, '\0'));
+	assert(2 == String_count(s, "\0", 1));
+	String_free(&s);
+
+	/* compare every kernel against the naive search, small alphabets make
+	 * lots of partial matches */
+	srand(18);
+
+	for (round = 0; round < 20000; round++) {
+		hlen = rand() % sizeof(h);
+		m = 1 + rand() % (round % 2 ? 8 : sizeof(n));
+
+		for (i = 0; i < hlen; i++) {
+			h[i] = "ab\0"[rand() % (round % 3 + 1)];
+		}
+
+		for (i = 0; i < m; i++) {
+			n[i] = "ab\0"[rand() % (round % 3 + 1)];
+		}
+
+		/* plant the needle now and then */
+		if (round % 4 == 0 && m <= hlen) {
+			memcpy(h + rand() % (hlen - m + 1), n, m);
+		}
+
+		v = StringView_new(h, hlen);
+		assert(naive_find(h, hlen, n, m) == StringView_find(v, StringView_new(n, m)));
+		assert(naive_rfind(h, hlen, n, m) == StringView_rfind(v, StringView_new(n, m)));
+
+		for (count = 0, i = 0; (j = naive_find(h + i, hlen - i, n, m)) != STRING_NOT_FOUND; i += j + m) {
+			count++;
+		}
+
+		assert(count == StringView_count(v, StringView_new(n, m)));
+		assert(naive_rfind(h, hlen, n, 1) == StringView_rfind_char(v, n[0]));
+	}
+
+	printf("passed!\n");
+}
+
+static String_len naive_match(String *patterns, unsigned count, const char *h,
+                              String_len n, String_match *matches)
+{
+	String_len end, len, found = 0;
+	unsigned i;
+
+	for (end = 0; end < n; end++) {
+		for (i = 0; i < count; i++) {
+			len = String_length(patterns[i]) - 1;
+
+			if (len <= end + 1 && memcmp(h + end + 1 - len, String_raw(patterns[i]), len) == 0) {
+				matches[found].offset = end + 1 - len;
+				matches[found].len = len;
+				matches[found].pattern = i;
+				found++;
+			}
+		}
+	}
+
+	return found;
+}
+
+void test_patterns(void)
+{
+	static String_match got[1 << 16], expected[1 << 16];
+	const char *words[] = {"he", "she", "his", "hers", "he"};
+	String patterns[100], bytes[257], s, slice;
+	String_patterns p;
+	String_len n, i, found;
+	unsigned round, count, j, k;
+	char h[512];
+
+	printf("%s: ", __func__);
+
+	for (j = 0; j < 5; j++) {
+		patterns[j] = String_new_str(words[j]);
+	}
+
+	p = String_patterns_new(patterns, 5);
+	assert(5 == String_patterns_count(p));
+	s = String_new_str("ushers his");
+	assert(5 == String_patterns_match(p, String_view(s), got, 1 << 16));
+	/* "he", "she" and "he" again end at 3, "hers" at 5, "his" at 9 */
+	assert(2 == got[0].offset && 2 == got[0].len && 0 == got[0].pattern);
+	assert(1 == got[1].offset && 3 == got[1].len && 1 == got[1].pattern);
+	assert(2 == got[2].offset && 4 == got[2].pattern);
+	assert(2 == got[3].offset && 4 == got[3].len && 3 == got[3].pattern);
+	assert(7 == got[4].offset && 2 == got[4].pattern);
+
+	/* matches are counted even if they don't fit */
+	assert(5 == String_patterns_match(p, String_view(s), got, 1));
+	assert(5 == String_patterns_match(p, String_view(s), NULL, 0));
+
+	/* offsets work with String_dup_slice, and slices can be searched */
+	slice = String_dup_slice(s, got[0].offset, got[0].offset + got[0].len - 1);
+	assert(0 == strcmp(String_raw(slice), "he"));
+	String_free(&slice);
+	assert(1 == String_patterns_match(p, String_view_slice(s, 6, 9), got, 1 << 16));
+	assert(1 == got[0].offset && 2 == got[0].pattern);
+	String_free(&s);
+	String_patterns_free(&p);
+	assert(p == NULL);
+
+	/* empty patterns are rejected, empty sets match nothing */
+	String_ncpy(patterns[4], "", 0);
+	assert(NULL == String_patterns_new(patterns, 5));
+	p = String_patterns_new(patterns, 0);
+	assert(0 == String_patterns_match(p, StringView_str("hello"), got, 1 << 16));
+	String_patterns_free(&p);
+
+	/* every byte value, so there are 256 classes besides the unused one */
+	for (j = 0; j < 257; j++) {
+		bytes[j] = String_new_empty();
+		String_append_char(bytes[j], j < 256 ? j : 0xff);
+	}
+
+	p = String_patterns_new(bytes, 257);
+	assert(1 == String_patterns_match(p, StringView_new("", 1), got, 1 << 16));
+	assert(0 == got[0].offset && 0 == got[0].pattern);
+	assert(2 == String_patterns_match(p, StringView_new("\xff", 1), got, 1 << 16));
+	assert(255 == got[0].pattern && 256 == got[1].pattern);
+	String_patterns_free(&p);
+
+	for (i = 0; i < sizeof(h); i++) {
+		h[i] = rand();
+	}
+
+	for (round = 0; round < 50; round++) {
+		for (j = 0; j < 257; j++) {
+			String_ncpy(bytes[j], "", 0);
+
+			for (k = 1 + rand() % 3; k > 0; k--) {
+				String_append_char(bytes[j], rand() % (round % 2 ? 256 : 8));
+			}
+		}
+
+		assert((p = String_patterns_new(bytes, 257)) != NULL);
+		found = String_patterns_match(p, StringView_new(h, sizeof(h)), got, 1 << 16);
+		assert(found == naive_match(bytes, 257, h, sizeof(h), expected));
+
+		for (i = 0; i < found; i++) {
+			assert(got[i].offset == expected[i].offset);
+			assert(got[i].pattern == expected[i].pattern);
+		}
+
+		String_patterns_free(&p);
+	}
+
+	for (j = 0; j < 257; j++) {
+		String_free(&bytes[j]);
+	}
+
+	for (j = 5; j < 100; j++) {
+		patterns[j] = String_new_empty();
+	}
+
+	/* random sets, both engines, over small alphabets */
+	srand(19);
+
+	for (round = 0; round < 2000; round++) {
+		count = 1 + rand() % (round % 2 ? 32 : 100);
+		n = rand() % sizeof(h);
+
+		for (j = 0; j < count; j++) {
+			k = 1 + rand() % (round % 4 ? 6 : 12);
+			String_ncpy(patterns[j], "", 0);
+
+			while (k--) {
+				String_append_char(patterns[j], "ab\0c"[rand() % (round % 3 + 2)]);
+			}
+		}
+
+		for (i = 0; i < n; i++) {
+			h[i] = "ab\0c"[rand() % (round % 3 + 2)];
+		}
+
+		assert((p = String_patterns_new(patterns, count)) != NULL);
+		found = String_patterns_match(p, StringView_new(h, n), got, 1 << 16);
+		assert(found == naive_match(patterns, count, h, n, expected));
+
+		for (i = 0; i < found; i++) {
+			assert(got[i].offset == expected[i].offset);
+			assert(got[i].len == expected[i].len);
+			assert(got[i].pattern == expected[i].pattern);
+		}
+
+		String_patterns_free(&p);
+	}
+
+	for (j = 0; j < 100; j++) {
+		String_free(&patterns[j]);
+	}
+
+	printf("passed!\n");
+}
+
+void test_replace(void)
+{
+	char text[64], expected[64 * 10 + 1], *p;
+	const char *needle, *rep;
+	String s, dup, frozen;
+	unsigned round, i, n;
+
+	printf("%s: ", __func__);
+
+	s = String_new_str("user=bob password=hunter2 password=x");
+
+	/* shorter replacement, in place */
+	assert(0 == String_replace_all_str(s, "password=", "pw="));
+	assert(0 == strcmp(String_raw(s), "user=bob pw=hunter2 pw=x"));
+
+	/* longer replacement */
+	assert(0 == String_replace_all_str(s, "pw=", "password: "));
+	assert(0 == strcmp(String_raw(s), "user=bob password: hunter2 password: x"));
+
+	/* same length, empty replacement, no match */
+	assert(0 == String_replace_all_str(s, "password", "PASSWORD"));
+	assert(0 == String_replace_all_str(s, "PASSWORD: ", ""));
+	assert(0 == strcmp(String_raw(s), "user=bob hunter2 x"));
+	assert(0 == String_replace_all_str(s, "nothing", "!"));
+	assert(0 == String_replace_all(s, "", 0, "!", 1));
+	assert(0 == strcmp(String_raw(s), "user=bob hunter2 x"));
+
+	/* only the first one */
+	assert(0 == String_replace_str(s, "b", "B"));
+	assert(0 == String_replace_str(s, "x", "[redacted]"));
+	assert(0 == strcmp(String_raw(s), "user=Bob hunter2 [redacted]"));
+
+	/* left to right, non overlapping */
+	String_cpy_str(s, "aaaaa");
+	assert(0 == String_replace_all_str(s, "aa", "b"));
+	assert(0 == strcmp(String_raw(s), "bba"));
+	assert(0 == String_replace_all_str(s, "b", "bb"));
+	assert(0 == strcmp(String_raw(s), "bbbba"));
+
+	/* needle and replacement can live in s */
+	String_cpy_str(s, "abcabc");
+	assert(0 == String_replace_all(s, String_raw(s), 1, String_raw(s) + 1, 5));
+	assert(0 == strcmp(String_raw(s), "bcabcbcbcabcbc"));
+
+	/* copies don't see it, frozen Strings can't be changed */
+	dup = String_dup(s);
+	assert(0 == String_replace_all_str(dup, "bc", ""));
+	assert(0 == strcmp(String_raw(dup), "aa"));
+	assert(0 == strcmp(String_raw(s), "bcabcbcbcabcbc"));
+	frozen = String_intern_buf("abc", 3);
+	assert(-1 == String_replace_all_str(frozen, "b", "x"));
+	assert(-1 == String_replace_str(frozen, "b", "x"));
+	assert(0 == strcmp(String_raw(frozen), "abc"));
+	String_free(&dup);
+
+	/* against a naive implementation */
+	srand(20);
+
+	for (round = 0; round < 5000; round++) {
+		n = rand() % sizeof(text);
+
+		for (i = 0; i < n; i++) {
+			text[i] = "ab"[rand() % 2];
+		}
+
+		text[n] = '\0';
+		needle = (const char *[]){"a", "ab", "aba", "bbb", "abababa"}[rand() % 5];
+		rep = (const char *[]){"", "x", "yz", "abc", "0123456789"}[rand() % 5];
+
+		for (i = 0, p = expected; i < n;) {
+			if (strncmp(text + i, needle, strlen(needle)) == 0) {
+				p += sprintf(p, "%s", rep);
+				i += strlen(needle);
+			} else {
+				*p++ = text[i++];
+			}
+		}
+
+		*p = '\0';
+		String_cpy_str(s, text);
+		assert(0 == String_replace_all_str(s, needle, rep));
+		assert(0 == strcmp(String_raw(s), expected));
+		assert(String_length(s) == strlen(expected) + 1);
+	}
+
+	String_free(&s);
+	printf("passed!\n");
+}
+
+void test_split(void)
+{
+	static String_span spans[600], expected[600];
+	const char *fields[] = {"a", "", "b", "", ""};
+	const long offsets[] = {0, 2, 3, 5, 6};
+	String_splitter it;
+	StringView token;
+	String s;
+	String_len n, i, j, start;
+	unsigned round, k;
+	char text[300];
+	const char *delims;
+
+	printf("%s: ", __func__);
+
+	s = String_new_str("a,,b,,");
+	String_split(&it, s, ',');
+
+	for (k = 0; String_splitter_next(&it, &token); k++) {
+		assert(k < 5);
+		assert(StringView_equal(token, StringView_str(fields[k])));
+		/* empty fields too */
+		assert(offsets[k] == token.ptr - String_raw(s));
+	}
+
+	assert(5 == k);
+	assert(!String_splitter_next(&it, &token));
+
+	/* an empty text is one empty field, and has no tokens */
+	String_cpy_str(s, "");
+	assert(1 == String_split_spans(s, ',', spans, 600));
+	assert(0 == spans[0].offset && 0 == spans[0].len);
+	assert(0 == String_tokenize_spans(s, " ", spans, 600));
+
+	String_cpy_str(s, "  GET\t/index.html  HTTP/1.1 \r\n");
+	String_tokenize(&it, s, " \t\r\n");
+	assert(String_splitter_next(&it, &token));
+	assert(StringView_equal(token, StringView_str("GET")));
+	assert(2 == token.ptr - String_raw(s));
+	assert(String_splitter_next(&it, &token));
+	assert(StringView_equal(token, StringView_str("/index.html")));
+	assert(String_splitter_next(&it, &token));
+	assert(StringView_equal(token, StringView_str("HTTP/1.1")));
+	assert(!String_splitter_next(&it, &token));
+
+	/* slices, and spans usable with String_dup_slice */
+	assert(2 == StringView_tokenize_spans(String_view_slice(s, 0, 10), " \t", spans, 600));
+	assert(6 == spans[1].offset && 5 == spans[1].len);
+	assert(3 == String_tokenize_spans(s, " \t\r\n", spans, 1));
+	assert(2 == spans[0].offset && 3 == spans[0].len);
+	String_free(&s);
+
+	/* against a naive implementation, with long texts so SIMD blocks are
+	 * used, and non-ASCII delimiters that aren't */
+	srand(21);
+
+	for (round = 0; round < 3000; round++) {
+		n = rand() % sizeof(text);
+		delims = (const char *[]){",", " \t", "\xe9", ";|\x80", "az"}[round % 5];
+
+		for (i = 0; i < n; i++) {
+			text[i] = rand() % 4 ? "abcz\t\x80 "[rand() % 7] : delims[rand() % strlen(delims)];
+		}
+
+		/* split on the first delimiter */
+		for (i = 0, j = 0, start = 0; i <= n; i++) {
+			if (i == n || text[i] == delims[0]) {
+				expected[j].offset = start;
+				expected[j++].len = i - start;
+				start = i + 1;
+			}
+		}
+
+		assert(j == StringView_split_spans(StringView_new(text, n), delims[0], spans, 600));
+		assert(0 == memcmp(spans, expected, j * sizeof(*spans)));
+
+		/* tokenize on all of them */
+		for (i = 0, j = 0; i < n;) {
+			while (i < n && strchr(delims, text[i])) {
+				i++;
+			}
+
+			if (i < n) {
+				expected[j].offset = i;
+
+				while (i < n && !strchr(delims, text[i])) {
+					i++;
+				}
+
+				expected[j].len = i - expected[j].offset;
+				j++;
+			}
+		}
+
+		assert(j == StringView_tokenize_spans(StringView_new(text, n), delims, spans, 600));
+		assert(0 == memcmp(spans, expected, j * sizeof(*spans)));
+	}
+
+	printf("passed!\n");
+}
+
+/* reference validator, one codepoint at a time */
+static int naive_utf8(const unsigned char *p, size_t n)
+{
+	size_t i = 0, k, j;
+	unsigned long cp;
+
+	while (i < n) {
+		if (p[i] < 0x80) {
+			i++;
+			continue;
+		}
+
+		if ((p[i] & 0xe0) == 0xc0) {
+			k = 1, cp = p[i] & 0x1f;
+		} else if ((p[i] & 0xf0) == 0xe0) {
+			k = 2, cp = p[i] & 0x0f;
+		} else if ((p[i] & 0xf8) == 0xf0) {
+			k = 3, cp = p[i] & 0x07;
+		} else {
+			return 0;
+		}
+
+		if (n - i <= k) {
+			return 0;
+		}
+
+		for (j = 1; j <= k; j++) {
+			if ((p[i + j] & 0xc0) != 0x80) {
+				return 0;
+			}
+
+			cp = cp << 6 | (p[i + j] & 0x3f);
+		}
+
+		if (cp < (unsigned long[]){0, 0x80, 0x800, 0x10000}[k] || cp > 0x10ffff ||
+		    (cp >= 0xd800 && cp <= 0xdfff)) {
+			return 0;
+		}
+
+		i += k + 1;
+	}
+
+	return 1;
+}
+
+void test_utf8(void)
+{
+	static const char *const invalid[] = {
+		"\x80", "\xbf", "\xc0\xaf", "\xc1\xbf", "\xc2", "\xe0\x80\xaf", "\xe0\x9f\xbf",
+		"\xed\xa0\x80", "\xed\xbf\xbf", "\xf0\x8f\xbf\xbf", "\xf4\x90\x80\x80",
+		"\xf5\x80\x80\x80", "\xff", "\xe2\x82", "\xf0\x9f\x98", "\xc3\xa9\xa9"
+	};
+	static const char *const valid[] = {
+		"", "a", "\xc2\x80", "\xdf\xbf", "\xe0\xa0\x80", "\xed\x9f\xbf", "\xee\x80\x80",
+		"\xef\xbf\xbf", "\xf0\x90\x80\x80", "\xf4\x8f\xbf\xbf", "h\xc3\xa9llo \xe2\x82\xac"
+	};
+	static const char *const seqs[] = {
+		"a", "z", "\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80", "\xed\x9f\xbf", "\xc2\x80"
+	};
+	uint16_t units[700], back[700];
+	char text[400], latin[256];
+	String s, t;
+	String_len n, i, j, k;
+	unsigned round, c;
+
+	printf("%s: ", __func__);
+
+	/* every sequence at every offset, so they straddle SIMD blocks */
+	for (k = 0; k < sizeof(invalid) / sizeof(*invalid) + sizeof(valid) / sizeof(*valid); k++) {
+		const char *seq = k < sizeof(invalid) / sizeof(*invalid) ? invalid[k] :
+		                  valid[k - sizeof(invalid) / sizeof(*invalid)];
+
+		for (i = 0; i < 70; i++) {
+			memset(text, 'x', sizeof(text));
+			memcpy(text + i, seq, strlen(seq));
+
+			for (n = i + strlen(seq); n < i + strlen(seq) + 40; n += 39) {
+				assert(StringView_utf8_validate(StringView_new(text, n)) ==
+				       (k >= sizeof(invalid) / sizeof(*invalid)));
+			}
+		}
+	}
+
+	srand(22);
+
+	for (round = 0; round < 20000; round++) {
+		for (n = 0, j = rand() % 100; j > 0; j--) {
+			const char *seq = seqs[rand() % 7];
+
+			memcpy(text + n, seq, strlen(seq));
+			n += strlen(seq);
+		}
+
+		/* corrupt some of them */
+		if (round % 2 && n > 0) {
+			text[rand() % n] = rand();
+		}
+
+		assert(!StringView_utf8_validate(StringView_new(text, n)) ==
+		       !naive_utf8((const unsigned char *)text, n));
+
+		for (i = 0, k = 1; i < n; i++) {
+			k &= !(text[i] & 0x80);
+		}
+
+		assert(!StringView_is_ascii(StringView_new(text, n)) == !k);
+
+		if (naive_utf8((const unsigned char *)text, n)) {
+			for (i = 0, k = 0; i < n; i++) {
+				k += (text[i] & 0xc0) != 0x80;
+			}
+
+			assert(k == StringView_utf8_length(StringView_new(text, n)));
+
+			/* to UTF-16 and back */
+			k = StringView_utf8_to_utf16(StringView_new(text, n), units, 700);
+			assert(k <= 700);
+			s = String_new_str("");
+			assert(0 == String_cat_utf16(s, units, k));
+			assert(StringView_equal(String_view(s), StringView_new(text, n)));
+			assert(String_utf8_validate(s));
+			String_free(&s);
+
+			/* only whole codepoints are stored */
+			j = rand() % (k + 1);
+			memset(back, 0, sizeof(back));
+			assert(k == StringView_utf8_to_utf16(StringView_new(text, n), back, j));
+			assert(j == 0 || j == k || memcmp(back, units, (j - 1) * 2) == 0);
+			assert(j == 0 || j == k || back[j - 1] == 0 || back[j - 1] == units[j - 1]);
+		}
+	}
+
+	/* cached until modified */
+	s = String_new_str("h\xc3\xa9llo");
+	assert(String_utf8_validate(s));
+	assert(!String_is_ascii(s));
+	assert(5 == String_utf8_length(s));
+	String_cat_str(s, "\xff");
+	assert(!String_utf8_validate(s));
+	String_cpy_str(s, "hello");
+	assert(String_is_ascii(s));
+	assert(String_utf8_validate(s));
+	assert(5 == String_utf8_length(s));
+	t = String_dup(s);
+	assert(String_is_ascii(t));
+	String_free(&t);
+
+	/* truncation never splits a codepoint */
+	String_cpy_str(s, "a\xe2\x82\xac" "b");
+	assert(0 == String_utf8_truncate(s, 10));
+	assert(6 == String_length(s));
+	assert(0 == String_utf8_truncate(s, 3));
+	assert(StringView_equal(String_view(s), StringView_str("a")));
+	String_cpy_str(s, "\xf0\x9f\x98\x80");
+	assert(0 == String_utf8_truncate(s, 3));
+	assert(1 == String_length(s));
+	String_cpy_str(s, "h\xc3\xa9");
+	assert(String_utf8_validate(s));
+	assert(0 == String_utf8_truncate(s, 2));
+	assert(String_is_ascii(s));
+	String_cpy_str(s, "hello");
+	assert(String_is_ascii(s));
+	assert(0 == String_utf8_truncate(s, 1));
+	assert(String_is_ascii(s));
+
+	/* unpaired surrogates leave dest alone */
+	units[0] = 'a', units[1] = 0xd83d, units[2] = 'b';
+	assert(-1 == String_cat_utf16(s, units, 3));
+	assert(-1 == String_cat_utf16(s, units + 1, 1));
+	units[0] = 0xde00;
+	assert(-1 == String_cat_utf16(s, units, 1));
+	assert(StringView_equal(String_view(s), StringView_str("h")));
+	units[0] = 0xd83d, units[1] = 0xde00, units[2] = 0x20ac;
+	assert(0 == String_cat_utf16(s, units, 3));
+	assert(StringView_equal(String_view(s), StringView_str("h\xf0\x9f\x98\x80\xe2\x82\xac")));
+	assert(STRING_NOT_FOUND == StringView_utf8_to_utf16(String_view_slice(s, 0, 3), units, 3));
+
+	/* Latin-1, every char and back */
+	for (c = 0; c < 256; c++) {
+		latin[c] = c;
+	}
+
+	String_cpy_str(s, "");
+	assert(0 == String_cat_latin1(s, latin, 256));
+	assert(128 + 2 * 128 + 1 == String_length(s));
+	assert(String_utf8_validate(s));
+	assert(StringView_starts_with(StringView_slice(String_view(s), 0xe9 * 2 - 128, 1000),
+	                              StringView_str("\xc3\xa9")));
+	memset(text, 0, sizeof(text));
+	assert(256 == String_utf8_to_latin1(s, text, 256));
+	assert(memcmp(text, latin, 256) == 0);
+	assert(256 == String_utf8_to_latin1(s, text, 10));
+	String_cpy_str(s, "caf\xc3\xa9 \xe2\x82\xac");
+	assert(STRING_NOT_FOUND == String_utf8_to_latin1(s, text, 256));
+	String_cpy_str(s, "\xc3");
+	assert(STRING_NOT_FOUND == String_utf8_to_latin1(s, text, 256));
+
+	/* src can be part of dest, even if dest has to move */
+	String_cpy_str(s, "");
+
+	for (c = 0; c < 8; c++) {
+		String_cat_str(s, "caf\xe9");
+	}
+
+	assert(0 == String_set_size(s, String_length(s)));
+	assert(0 == String_cat_latin1(s, String_raw(s) + 28, 4));
+	assert(0 == memcmp(String_raw(s) + 32, "caf\xc3\xa9", 6));
+	assert(38 == String_length(s));
+
+	for (c = 0; c < 32; c++) {
+		units[c] = 'a' + c % 26;
+	}
+
+	String_ncpy(s, (char *)units, 64);
+	assert(0 == String_set_size(s, String_length(s)));
+	assert(0 == String_cat_utf16(s, (const uint16_t *)String_raw(s), 32));
+	assert(97 == String_length(s));
+
+	for (c = 0; c < 32; c++) {
+		assert('a' + c % 26 == (unsigned char)String_raw(s)[64 + c]);
+	}
+
+	String_free(&s);
+
+	printf("passed!\n");
+}
+
+void test_case(void)
+{
+	char text[300], other[300], lowered[300];
+	String s, t;
+	StringView v;
+	String_len n, m, i, from, to;
+	unsigned round;
+	int expected;
+
+	printf("%s: ", __func__);
+
+	s = String_new_str("Content-Type: \xc3\x89" "COLE Stra\xc3\x9f" "e");
+	assert(0 == String_tolower(s));
+	assert(StringView_equal(String_view(s),
+	                        StringView_str("content-type: \xc3\x89" "cole stra\xc3\x9f" "e")));
+	assert(0 == String_toupper(s));
+	assert(StringView_equal(String_view(s),
+	                        StringView_str("CONTENT-TYPE: \xc3\x89" "COLE STRA\xc3\x9f" "E")));
+	assert(String_utf8_validate(s));
+	t = String_new_empty();
+	assert(0 == String_cpy_lower(t, StringView_str("@AZ[`az{")));
+	assert(StringView_equal(String_view(t), StringView_str("@az[`az{")));
+	assert(0 == String_cpy_upper(t, StringView_str("@AZ[`az{")));
+	assert(StringView_equal(String_view(t), StringView_str("@AZ[`AZ{")));
+
+	/* case insensitive compare and hash */
+	assert(String_case_equal(s, s));
+	String_cpy_str(t, "content-type: \xc3\x89" "cole stra\xc3\x9f" "e");
+	assert(String_case_equal(s, t));
+	assert(0 == String_casecmp(s, t));
+	assert(String_case_hash(s) == String_case_hash(t));
+	assert(String_case_hash(s) == String_hash(t));
+	assert(String_case_hash(s) != String_hash(s));
+	String_cpy_str(t, "content-typf");
+	assert(!String_case_equal(s, t));
+	assert(-1 == String_casecmp(s, t));
+	assert(1 == String_casecmp(t, s));
+	assert(-1 == StringView_casecmp(StringView_str("ABC"), StringView_str("abcd")));
+	assert(-1 == StringView_casecmp(StringView_str("_"), StringView_str("a")));
+	assert(1 == StringView_casecmp(StringView_str("\xe9"), StringView_str("z")));
+
+	/* trimming */
+	String_cpy_str(s, " \t\r\n\v\f hello world \n");
+	assert(0 == String_trim(s));
+	assert(StringView_equal(String_view(s), StringView_str("hello world")));
+	assert(0 == String_trim(s));
+	String_cpy_str(s, "  x  ");
+	assert(0 == String_ltrim(s));
+	assert(StringView_equal(String_view(s), StringView_str("x  ")));
+	assert(0 == String_rtrim(s));
+	assert(StringView_equal(String_view(s), StringView_str("x")));
+	String_cpy_str(s, " \n\t ");
+	assert(0 == String_trim(s));
+	assert(1 == String_length(s));
+	assert(0 == String_trim(s));
+	assert(0 == StringView_trim(StringView_str("   ")).len);
+	assert(StringView_equal(StringView_ltrim(StringView_str("\xa0 a ")), StringView_str("\xa0 a ")));
+	String_free(&s);
+
+	/* immutable Strings fail only if they'd change */
+	s = String_intern_buf("Hi", 2);
+	assert(-1 == String_tolower(s));
+	assert(0 == String_trim(s));
+	String_free(&s);
+
+	/* against naive implementations, long enough for the SIMD kernels */
+	srand(23);
+
+	for (round = 0; round < 5000; round++) {
+		n = rand() % sizeof(text);
+		m = round % 3 ? n : (String_len)rand() % sizeof(other);
+
+		for (i = 0; i < n; i++) {
+			text[i] = rand() % 2 ? "aAzZ@[`{\xc3\xa9 \t\r\n\v\f"[rand() % 16] : rand();
+			lowered[i] = text[i] >= 'A' && text[i] <= 'Z' ? text[i] + 32 : text[i];
+		}
+
+		for (i = 0; i < m; i++) {
+			other[i] = i < n && rand() % 16 ? (rand() % 2 ? text[i] : lowered[i]) : rand();
+		}
+
+		String_cpy_lower(t, StringView_new(text, n));
+		assert(StringView_equal(String_view(t), StringView_new(lowered, n)));
+		assert(StringView_case_hash(StringView_new(text, n)) ==
+		       StringView_hash(StringView_new(lowered, n)));
+		String_toupper(t);
+
+		for (i = 0; i < n; i++) {
+			assert(String_raw(t)[i] == (text[i] >= 'a' && text[i] <= 'z' ? text[i] - 32 :
+			                            text[i] >= 'A' && text[i] <= 'Z' ? text[i] : lowered[i]));
+		}
+
+		for (i = 0, expected = 0; i < n && i < m && expected == 0; i++) {
+			unsigned char c1 = lowered[i];
+			unsigned char c2 = other[i] >= 'A' && other[i] <= 'Z' ? other[i] + 32 : other[i];
+
+			expected = (c1 > c2) - (c1 < c2);
+		}
+
+		if (expected == 0) {
+			expected = (n > m) - (n < m);
+		}
+
+		assert(expected == StringView_casecmp(StringView_new(text, n), StringView_new(other, m)));
+		assert((expected == 0) ==
+		       StringView_case_equal(StringView_new(text, n), StringView_new(other, m)));
+
+		for (from = 0; from < n && strchr(" \t\r\n\v\f", text[from]) && text[from]; from++);
+		for (to = n; to > from && strchr(" \t\r\n\v\f", text[to - 1]) && text[to - 1]; to--);
+
+		v = StringView_trim(StringView_new(text, n));
+		assert(v.len == to - from && (v.len == 0 || v.ptr == text + from));
+		s = String_new_view(StringView_new(text, n));
+		assert(0 == String_ltrim(s));
+		assert(StringView_equal(String_view(s), StringView_new(text + from, n - from)));
+		assert(0 == String_rtrim(s));
+		assert(StringView_equal(String_view(s), v));
+		String_free(&s);
+	}
+
+	String_free(&t);
+	printf("passed!\n");
+}
+
+static size_t naive_base64(const unsigned char *p, size_t n, char *out)
+{
+	static const char digits[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	unsigned long bits = 0;
+	size_t i, o = 0;
+	int have = 0;
+
+	for (i = 0; i < n; i++) {
+		bits = bits << 8 | p[i];
+
+		for (have += 8; have >= 6; have -= 6) {
+			out[o++] = digits[bits >> (have - 6) & 0x3f];
+		}
+	}
+
+	if (have > 0) {
+		out[o++] = digits[bits << (6 - have) & 0x3f];
+	}
+
+	while (o % 4 != 0) {
+		out[o++] = '=';
+	}
+
+	return o;
+}
+
+static size_t naive_json(const unsigned char *p, size_t n, char *out)
+{
+	size_t i, o = 0;
+
+	for (i = 0; i < n; i++) {
+		switch (p[i]) {
+		case '"': o += sprintf(out + o, "\\\""); break;
+		case '\\': o += sprintf(out + o, "\\\\"); break;
+		case '\b': o += sprintf(out + o, "\\b"); break;
+		case '\f': o += sprintf(out + o, "\\f"); break;
+		case '\n': o += sprintf(out + o, "\\n"); break;
+		case '\r': o += sprintf(out + o, "\\r"); break;
+		case '\t': o += sprintf(out + o, "\\t"); break;
+		default:
+			if (p[i] < 0x20) {
+				o += sprintf(out + o, "\\u%04x", p[i]);
+			} else {
+				out[o++] = p[i];
+			}
+		}
+	}
+
+	return o;
+}
+
+void test_codec(void)
+{
+	unsigned char bytes[300];
+	char expected[2000];
+	String s, t, u;
+	String_len n, m, i;
+	unsigned round, c;
+
+	printf("%s: ", __func__);
+
+	/* RFC 4648's test vectors */
+	s = String_new_empty();
+	t = String_new_empty();
+	assert(0 == String_base64_encode(s, "foobar", 6));
+	assert(0 == strcmp(String_raw(s), "Zm9vYmFy"));
+	assert(0 == String_base64_encode(s, "fooba", 5));
+	assert(0 == strcmp(String_raw(s), "Zm9vYmE="));
+	assert(0 == String_base64_encode(s, "foob", 4));
+	assert(0 == strcmp(String_raw(s), "Zm9vYg=="));
+	assert(0 == String_base64_encode(s, "", 0));
+	assert(String_length(s) == 1);
+	assert(0 == String_base64_decode(s, "Zm9vYg==", 8));
+	assert(0 == strcmp(String_raw(s), "foob"));
+	assert(0 == String_base64_decode(s, "Zm9vYg", 6));
+	assert(0 == strcmp(String_raw(s), "foob"));
+	assert(0 == String_base64_decode(s, "Zm9vYmE", 7));
+	assert(0 == strcmp(String_raw(s), "fooba"));
+
+	/* same as String_ncpy_at: cut after what's written, pad any gap */
+	String_cpy_str(s, "key=");
+	assert(0 == String_append_base64(s, "\xff\xfe", 2));
+	assert(0 == strcmp(String_raw(s), "key=//4="));
+	assert(0 == String_hex_encode_at(s, 10, "\x01\xab", 2));
+	assert(String_length(s) == 15);
+	assert(0 == memcmp(String_raw(s), "key=//4=\0\0" "01ab", 15));
+	assert(0 == String_hex_encode_at(s, 4, "\xcd", 1));
+	assert(0 == strcmp(String_raw(s), "key=cd"));
+
+	/* bad input leaves dest ending at dest_offset */
+	assert(-1 == String_base64_decode_at(s, 4, "Zm9v=mFy", 8));
+	assert(0 == strcmp(String_raw(s), "key="));
+	assert(-1 == String_base64_decode(s, "Zm9vY", 5));
+	assert(-1 == String_base64_decode(s, "Zm9vY===", 8));
+	assert(-1 == String_hex_decode(s, "abc", 3));
+	assert(-1 == String_hex_decode(s, "0g", 2));
+	assert(0 == String_hex_decode(s, "4a4B", 4));
+	assert(0 == strcmp(String_raw(s), "JK"));
+
+	/* every byte at every position of a vector's worth of digits */
+	memset(expected, 'A', 128);
+
+	for (c = 0; c < 256; c++) {
+		for (i = 0; i < 64; i++) {
+			expected[i] = c;
+			assert((0 == String_base64_decode(s, expected, 128)) ==
+			       (strchr("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
+			               "0123456789+/", c) != NULL && c != 0));
+			assert((0 == String_hex_decode(s, expected, 128)) ==
+			       ((c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')));
+			expected[i] = 'A';
+		}
+	}
+
+	/* URLs */
+	assert(0 == String_url_encode(s, "a b/c?d=\xc3\xa9~-._", 14));
+	assert(0 == strcmp(String_raw(s), "a%20b%2Fc%3Fd%3D%C3%A9~-._"));
+	String_cpy(t, s);
+	assert(0 == String_url_decode(s, String_raw(t), String_length(t) - 1));
+	assert(0 == strcmp(String_raw(s), "a b/c?d=\xc3\xa9~-._"));
+	assert(0 == String_url_decode(s, "a+b%2b", 6));
+	assert(0 == strcmp(String_raw(s), "a+b+"));
+	assert(-1 == String_url_decode(s, "a%2", 3));
+	assert(-1 == String_url_decode(s, "%%%", 3));
+	assert(-1 == String_url_decode(s, "%zz", 3));
+
+	/* JSON */
+	assert(0 == String_json_escape(s, "say \"hi\"\\\n\x01\xc3\xa9", 13));
+	assert(0 == strcmp(String_raw(s), "say \\\"hi\\\"\\\\\\n\\u0001\xc3\xa9"));
+	String_cpy(t, s);
+	assert(0 == String_json_unescape(s, String_raw(t), String_length(t) - 1));
+	assert(0 == strcmp(String_raw(s), "say \"hi\"\\\n\x01\xc3\xa9"));
+	assert(0 == String_json_unescape(s, "\\u00e9\\/\\ud83d\\ude00", 20));
+	assert(0 == strcmp(String_raw(s), "\xc3\xa9/\xf0\x9f\x98\x80"));
+	assert(-1 == String_json_unescape(s, "\\ude00", 6));
+	assert(-1 == String_json_unescape(s, "\\ud83d", 6));
+	assert(-1 == String_json_unescape(s, "\\x", 2));
+	assert(-1 == String_json_unescape(s, "a\\", 2));
+	assert(-1 == String_json_unescape(s, "\\u12g4", 6));
+
+	/* immutable Strings can't be written */
+	u = String_intern_buf("Hi", 2);
+	assert(-1 == String_base64_encode(u, "x", 1));
+	assert(-1 == String_json_escape(u, "x", 1));
+	String_free(&u);
+
+	/* src can be part of dest, even if dest moves or is overwritten */
+	String_cpy_str(s, "foobar");
+	assert(0 == String_append_base64(s, String_raw(s), 6));
+	assert(0 == strcmp(String_raw(s), "foobarZm9vYmFy"));
+	assert(0 == String_base64_decode(s, String_raw(s) + 6, 8));
+	assert(0 == strcmp(String_raw(s), "foobar"));
+	assert(0 == String_append_hex_bytes(s, String_raw(s) + 4, 2));
+	assert(0 == strcmp(String_raw(s), "foobar6172"));
+	assert(0 == String_hex_decode_at(s, 6, String_raw(s) + 6, 4));
+	assert(0 == strcmp(String_raw(s), "foobarar"));
+	String_cpy_str(s, "a b&c");
+	assert(0 == String_url_encode(s, String_raw(s), 5));
+	assert(0 == strcmp(String_raw(s), "a%20b%26c"));
+	assert(0 == String_url_decode(s, String_raw(s), 9));
+	assert(0 == strcmp(String_raw(s), "a b&c"));
+	String_cpy_str(s, "\"q\"\n");
+	assert(0 == String_append_json_escaped(s, String_raw(s), 4));
+	assert(0 == strcmp(String_raw(s), "\"q\"\n\\\"q\\\"\\n"));
+	assert(0 == String_json_unescape(s, String_raw(s) + 4, 8));
+	assert(0 == strcmp(String_raw(s), "\"q\"\n"));
+
+	/* round trips against naive implementations */
+	srand(24);
+
+	for (round = 0; round < 5000; round++) {
+		n = rand() % sizeof(bytes);
+
+		for (i = 0; i < n; i++) {
+			bytes[i] = rand() % 2 ? "\"\\\n\t\x01 aZ%"[rand() % 9] : rand();
+		}
+
+		m = naive_base64(bytes, n, expected);
+		assert(0 == String_base64_encode(s, bytes, n));
+		assert(StringView_equal(String_view(s), StringView_new(expected, m)));
+		assert(0 == String_ncpy(t, (char *)bytes, n));
+		assert(0 == String_base64_encode(t, String_raw(t), n));
+		assert(StringView_equal(String_view(t), StringView_new(expected, m)));
+		assert(0 == String_base64_decode(t, String_raw(s), m));
+		assert(StringView_equal(String_view(t), StringView_new((char *)bytes, n)));
+
+		for (i = 0; i < n; i++) {
+			sprintf(expected + 2 * i, "%02x", bytes[i]);
+		}
+
+		assert(0 == String_hex_encode(s, bytes, n));
+		assert(StringView_equal(String_view(s), StringView_new(expected, 2 * n)));
+		assert(0 == String_hex_decode(t, String_raw(s), 2 * n));
+		assert(StringView_equal(String_view(t), StringView_new((char *)bytes, n)));
+
+		assert(0 == String_url_encode(s, bytes, n));
+		assert(0 == String_url_decode(t, String_raw(s), String_length(s) - 1));
+		assert(StringView_equal(String_view(t), StringView_new((char *)bytes, n)));
+
+		m = naive_json(bytes, n, expected);
+		assert(0 == String_json_escape(s, bytes, n));
+		assert(StringView_equal(String_view(s), StringView_new(expected, m)));
+		assert(0 == String_json_unescape(t, String_raw(s), m));
+		assert(StringView_equal(String_view(t), StringView_new((char *)bytes, n)));
+	}
+
+	String_free(&s);
+	String_free(&t);
+
+	printf("passed!\n");
+}
+
+#define BUILDER_THREADS 4
+#define BUILDER_RECORDS 2000
+
+struct build_job {
+	String_builder b;
+	unsigned id;
+};
+
+static void *build_records(void *arg)
+{
+	struct build_job *job = arg;
+	char record[32];
+	unsigned i;
+
+	for (i = 0; i < BUILDER_RECORDS; i++) {
+		sprintf(record, "t%u-%u\n", job->id, i);
+		assert(0 == String_builder_append_str(job->b, record));
+	}
+
+	return NULL;
+}
+
+void test_builder(void)
+{
+	String_builder b;
+	String s;
+	pthread_t threads[BUILDER_THREADS];
+	struct build_job jobs[BUILDER_THREADS];
+	unsigned next[BUILDER_THREADS] = {0};
+	char buf[8], *p, *end;
+	String_len n, mark;
+	unsigned i, id;
+
+	printf("%s: ", __func__);
+
+	/* empty */
+	b = String_builder_new(0);
+	assert(0 == String_builder_length(b));
+	s = String_builder_finish(&b);
+	assert(NULL == b);
+	assert(1 == String_length(s));
+	assert(0 == strcmp(String_raw(s), ""));
+	String_free(&s);
+
+	/* binary safe, straddles segments */
+	b = String_builder_new(3);
+	assert(0 == String_builder_append(b, "ab\0cd", 5));
+	assert(0 == String_builder_append(b, "x", 0));
+	assert(0 == String_builder_append_view(b, StringView_new("efghijklmn", 10)));
+	assert(15 == String_builder_length(b));
+	assert(4 == String_builder_read(b, 11, buf, sizeof(buf)));
+	assert(0 == memcmp(buf, "klmn", 4));
+	assert(5 == String_builder_read(b, 1, buf, 5));
+	assert(0 == memcmp(buf, "b\0cde", 5));
+	assert(0 == String_builder_read(b, 15, buf, 1));
+	s = String_builder_finish(&b);
+	assert(16 == String_length(s));
+	assert(0 == memcmp(String_raw(s), "ab\0cdefghijklmn", 16));
+	assert(0 == String_cat_str(s, "!"));
+	assert(0 == strcmp(String_raw(s) + 3, "cdefghijklmn!"));
+	String_free(&s);
+
+	String_builder_free(&b);
+	b = String_builder_new(1);
+	String_builder_free(&b);
+	assert(NULL == b);
+
+	/* small segments, so appends race to allocate them */
+	b = String_builder_new(16);
+
+	for (i = 0; i < BUILDER_THREADS; i++) {
+		jobs[i].b = b;
+		jobs[i].id = i;
+		pthread_create(&threads[i], NULL, build_records, &jobs[i]);
+	}
+
+	/*
+	 * The watermark never goes back, and what's below it has been copied.
+	 * It may split a record that straddles two segments.
+	 */
+	for (n = 0, i = 0; i < 1000; i++) {
+		mark = String_builder_length(b);
+		assert(mark >= n);
+		assert(mark == 0 || 1 == String_builder_read(b, mark - 1, buf, 1));
+		assert(mark == 0 || strchr("t0123456789-\n", buf[0]) != NULL);
+		n = mark;
+	}
+
+	for (i = 0; i < BUILDER_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	n = String_builder_length(b);
+	assert(n == String_builder_length(b));
+	s = String_builder_finish(&b);
+	assert(String_length(s) == n + 1);
+
+	/* every record once, whole, and each thread's in order */
+	for (p = String_raw(s); *p != '\0'; p = end + 1) {
+		assert('t' == *p);
+		id = strtoul(p + 1, &end, 10);
+		assert(id < BUILDER_THREADS && '-' == *end);
+		assert(next[id] == strtoul(end + 1, &end, 10));
+		assert('\n' == *end);
+		next[id]++;
+	}
+
+	for (i = 0; i < BUILDER_THREADS; i++) {
+		assert(BUILDER_RECORDS == next[i]);
+	}
+
+	String_free(&s);
+
+	printf("passed!\n");
+}
+
 #if 0
 void test_(void)
 {
@@ -286,11 +2465,35 @@ int main()
 	test_ncpy();
 	test_ncpy_overlapping();
 	test_ncpy_gap();
+	test_ncat_self();
 	test_ncat_with_initial_string_empty();
 	test_ncat_with_initial_string();
 	test_format();
 	test_format_offset_gt_size();
 	test_shrink();
+	test_short_strings();
+	test_arena();
+	test_allocator();
+	test_compare();
+	test_hash();
+	test_intern();
+	test_dup_cow();
+	test_view();
+	test_format_conversions();
+	test_append();
+	test_catv();
+	test_growth();
+	test_large();
+	test_mmap();
+	test_io();
+	test_search();
+	test_patterns();
+	test_replace();
+	test_split();
+	test_utf8();
+	test_case();
+	test_codec();
+	test_builder();
 
 	printf("All tests passed!\n");
 	return 0;
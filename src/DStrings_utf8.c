@@ -0,0 +1,853 @@
+/*
+ * File:    DStrings_utf8.c
+ * Author:  Eduardo Miravalls Sierra          <edu.miravalls@hotmail.com>
+ *
+ * Date:    2014-08-30 09:47
+ */
+
+/*
+ * Dynamic C Strings library.
+ * Copyright (C) 2014 Eduardo Miravalls Sierra
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+
+#include "DStrings_internal.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief returns the length of the ASCII run p starts with.
+ *
+ * @param p buffer.
+ * @param n p's length.
+ *
+ * @return the offset of the first non ASCII char, or n.
+ */
+static String_len ascii_prefix_scalar(const char *p, String_len n);
+
+/**
+ * @brief returns the length of the ASCII run of UTF-16 code units p starts
+ * with.
+ */
+static String_len ascii16_prefix_scalar(const uint16_t *p, String_len n);
+
+/**
+ * @brief converts the ASCII run p starts with to UTF-16.
+ *
+ * @param p buffer.
+ * @param n p's length.
+ * @param d where the code units go, room for n of them.
+ *
+ * @return the run's length.
+ */
+static String_len widen_ascii_scalar(const char *p, String_len n, uint16_t *d);
+
+/**
+ * @brief converts the ASCII run of UTF-16 code units p starts with to chars.
+ */
+static String_len narrow_ascii_scalar(const uint16_t *p, String_len n, char *d);
+
+/**
+ * @brief returns the number of chars in n bytes of p that aren't UTF-8
+ * continuation bytes.
+ */
+static String_len count_leads_scalar(const char *p, String_len n);
+
+/**
+ * @brief returns the number of chars in n bytes of p that aren't ASCII.
+ */
+static String_len count_high_scalar(const char *p, String_len n);
+
+/**
+ * @brief portable UTF-8 validator.
+ *
+ * @param p buffer.
+ * @param n p's length.
+ * @param ascii where whether p is ASCII is stored.
+ *
+ * @return != 0 if p is valid UTF-8.
+ * @return 0 otherwise.
+ */
+static int validate_scalar(const char *p, String_len n, int *ascii);
+
+/**
+ * @brief decodes a codepoint.
+ *
+ * @param p the codepoint's first byte, in valid UTF-8.
+ * @param cp where the codepoint is stored.
+ *
+ * @return the codepoint's length in bytes.
+ */
+static unsigned decode(const unsigned char *p, uint32_t *cp);
+
+/**
+ * @brief validates s, unless that was already done since s was modified.
+ *
+ * @param s String.
+ *
+ * @return s' flags, with CHECKED set.
+ */
+static unsigned char check(String s);
+
+/**
+ * @brief remembers that s is still valid UTF-8 after valid UTF-8 was
+ * appended to it.
+ *
+ * @param s String, already modified.
+ * @param before s' flags before it was modified.
+ * @param ascii whether what was appended is ASCII.
+ */
+static void keep_valid(String s, unsigned char before, int ascii);
+
+#ifdef HAVE_X86
+/*
+ * Validation is Keiser and Lemire's lookup algorithm ("Validating UTF-8 In
+ * Less Than One Instruction Per Byte", 2021), the one simdutf uses. Every
+ * error shows up in a pair of consecutive bytes: three pshufb lookups, on
+ * the high and low nibbles of the first one and the high nibble of the
+ * second, map each pair to the set of errors it could be, and errors are
+ * the bits the three sets share. The only pair that can't be told apart,
+ * two continuation bytes, is an error unless it's the third or fourth byte
+ * of a sequence, which prev2 and prev3 tell. Blocks of ASCII only check
+ * that the one before them didn't end in the middle of a sequence.
+ */
+enum {
+	TOO_SHORT = 1 << 0,      /* lead or ASCII after a lead */
+	TOO_LONG = 1 << 1,       /* continuation after ASCII */
+	OVERLONG_3 = 1 << 2,     /* E0 80..9F */
+	TOO_LARGE = 1 << 3,      /* F4 90..BF, F5..FF */
+	SURROGATE = 1 << 4,      /* ED A0..BF */
+	OVERLONG_2 = 1 << 5,     /* C0..C1 */
+	TOO_LARGE_1000 = 1 << 6, /* F5..FF 80..8F */
+	OVERLONG_4 = 1 << 6,     /* F0 80..8F */
+	TWO_CONTS = 1 << 7,      /* continuation after continuation */
+	CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS
+};
+
+/* errors the first byte's high nibble allows */
+static const unsigned char byte_1_high[16] = {
+	TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+	TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+	TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+	TOO_SHORT | OVERLONG_2,
+	TOO_SHORT,
+	TOO_SHORT | OVERLONG_3 | SURROGATE,
+	TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+};
+
+/* errors the first byte's low nibble allows */
+static const unsigned char byte_1_low[16] = {
+	CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+	CARRY | OVERLONG_2,
+	CARRY,
+	CARRY,
+	CARRY | TOO_LARGE,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000
+};
+
+/* errors the second byte's high nibble allows */
+static const unsigned char byte_2_high[16] = {
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+};
+
+/* the last 3 bytes of a block are incomplete if they're above these */
+static const unsigned char incomplete_max[32] = {
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xef, 0xdf, 0xbf
+};
+
+#define VALIDATE_KERNEL(isa, vec, W, table, loadu, set1, and, or, xor, shuffle, \
+                        srli16, subs, cmpeq, movemask, prev) \
+static __attribute__((target(#isa))) int \
+validate_##isa(const char *p, String_len n, int *ascii) \
+{ \
+	const vec nibble = set1(0x0f), zero = set1(0); \
+	const vec t1h = table(byte_1_high), t1l = table(byte_1_low), t2h = table(byte_2_high); \
+	const vec max = loadu((const vec *)(incomplete_max + sizeof(incomplete_max) - W)); \
+	vec in, prev1, special, must23, last = zero, error = zero, incomplete = zero; \
+	char tail[W]; \
+	String_len i; \
+\
+	*ascii = YES; \
+\
+	for (i = 0; i < n; i += W) { \
+		if (n - i >= W) { \
+			in = loadu((const vec *)(p + i)); \
+		} else { \
+			/* padded with ASCII, which ends whatever is left open */ \
+			memset(tail, 0, W); \
+			memcpy(tail, p + i, n - i); \
+			in = loadu((const vec *)tail); \
+		} \
+\
+		if (movemask(in) == 0) { \
+			error = or(error, incomplete); \
+			incomplete = zero; \
+			last = in; \
+			continue; \
+		} \
+\
+		*ascii = NO; \
+		prev1 = prev(in, last, 1); \
+		special = and(and(shuffle(t1h, and(srli16(prev1, 4), nibble)), \
+		                  shuffle(t1l, and(prev1, nibble))), \
+		              shuffle(t2h, and(srli16(in, 4), nibble))); \
+		/* high bit set where a 3 or 4 byte sequence needs a continuation */ \
+		must23 = and(or(subs(prev(in, last, 2), set1(0xe0 - 0x80)), \
+		                subs(prev(in, last, 3), set1(0xf0 - 0x80))), \
+		             set1((char)0x80)); \
+		error = or(error, xor(must23, special)); \
+		incomplete = subs(in, max); \
+		last = in; \
+	} \
+\
+	error = or(error, incomplete); \
+	return movemask(cmpeq(error, zero)) == (unsigned)((1ull << W) - 1); \
+}
+
+#define table_ssse3(t) _mm_loadu_si128((const __m128i *)(t))
+#define table_avx2(t) _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(t)))
+
+/* the block shifted k bytes right, with the previous block's last ones */
+#define prev_ssse3(in, last, k) _mm_alignr_epi8(in, last, 16 - (k))
+#define prev_avx2(in, last, k) \
+	_mm256_alignr_epi8(in, _mm256_permute2x128_si256(last, in, 0x21), 16 - (k))
+
+VALIDATE_KERNEL(ssse3, __m128i, 16, table_ssse3, _mm_loadu_si128, _mm_set1_epi8,
+                _mm_and_si128, _mm_or_si128, _mm_xor_si128, _mm_shuffle_epi8,
+                _mm_srli_epi16, _mm_subs_epu8, _mm_cmpeq_epi8,
+                (unsigned)_mm_movemask_epi8, prev_ssse3)
+VALIDATE_KERNEL(avx2, __m256i, 32, table_avx2, _mm256_loadu_si256, _mm256_set1_epi8,
+                _mm256_and_si256, _mm256_or_si256, _mm256_xor_si256, _mm256_shuffle_epi8,
+                _mm256_srli_epi16, _mm256_subs_epu8, _mm256_cmpeq_epi8,
+                (unsigned)_mm256_movemask_epi8, prev_avx2)
+
+#undef VALIDATE_KERNEL
+#undef table_ssse3
+#undef table_avx2
+#undef prev_ssse3
+#undef prev_avx2
+
+/*
+ * The rest are plain scans: ASCII runs end at the first byte with its high
+ * bit set, or code unit above 0x7f, and codepoints are the bytes that
+ * aren't continuations, above 0xbf as signed chars.
+ */
+#define SCAN_KERNELS(isa, vec, W, loadu, set1_8, set1_16, and, cmpeq16, cmpgt8, \
+                     movemask) \
+static __attribute__((target(#isa))) String_len \
+ascii_prefix_##isa(const char *p, String_len n) \
+{ \
+	String_len i; \
+	unsigned mask; \
+\
+	for (i = 0; n - i >= W; i += W) { \
+		if ((mask = movemask(loadu((const vec *)(p + i)))) != 0) { \
+			return i + __builtin_ctz(mask); \
+		} \
+	} \
+\
+	return i + ascii_prefix_scalar(p + i, n - i); \
+} \
+\
+static __attribute__((target(#isa))) String_len \
+ascii16_prefix_##isa(const uint16_t *p, String_len n) \
+{ \
+	const vec high = set1_16((short)0xff80), zero = set1_8(0); \
+	String_len i; \
+	unsigned mask; \
+\
+	/* two mask bits per code unit */ \
+	for (i = 0; n - i >= W / 2; i += W / 2) { \
+		mask = ~movemask(cmpeq16(and(loadu((const vec *)(p + i)), high), zero)); \
+		if ((mask &= (unsigned)((1ull << W) - 1)) != 0) { \
+			return i + __builtin_ctz(mask) / 2; \
+		} \
+	} \
+\
+	return i + ascii16_prefix_scalar(p + i, n - i); \
+} \
+\
+static __attribute__((target(#isa))) String_len \
+count_leads_##isa(const char *p, String_len n) \
+{ \
+	const vec cont = set1_8((char)0xbf); \
+	String_len i, count = 0; \
+\
+	for (i = 0; n - i >= W; i += W) { \
+		count += __builtin_popcount(movemask(cmpgt8(loadu((const vec *)(p + i)), cont))); \
+	} \
+\
+	return count + count_leads_scalar(p + i, n - i); \
+} \
+\
+static __attribute__((target(#isa))) String_len \
+count_high_##isa(const char *p, String_len n) \
+{ \
+	String_len i, count = 0; \
+\
+	for (i = 0; n - i >= W; i += W) { \
+		count += __builtin_popcount(movemask(loadu((const vec *)(p + i)))); \
+	} \
+\
+	return count + count_high_scalar(p + i, n - i); \
+}
+
+SCAN_KERNELS(sse2, __m128i, 16, _mm_loadu_si128, _mm_set1_epi8, _mm_set1_epi16,
+             _mm_and_si128, _mm_cmpeq_epi16, _mm_cmpgt_epi8, (unsigned)_mm_movemask_epi8)
+SCAN_KERNELS(avx2, __m256i, 32, _mm256_loadu_si256, _mm256_set1_epi8, _mm256_set1_epi16,
+             _mm256_and_si256, _mm256_cmpeq_epi16, _mm256_cmpgt_epi8,
+             (unsigned)_mm256_movemask_epi8)
+
+#undef SCAN_KERNELS
+
+/* AVX2's packs and unpacks work within lanes, SSE2 is as fast here */
+static __attribute__((target("sse2"))) String_len
+widen_ascii_sse2(const char *p, String_len n, uint16_t *d)
+{
+	const __m128i zero = _mm_setzero_si128();
+	String_len i;
+	__m128i v;
+
+	for (i = 0; n - i >= 16; i += 16) {
+		v = _mm_loadu_si128((const __m128i *)(p + i));
+
+		if (_mm_movemask_epi8(v) != 0) {
+			break;
+		}
+
+		_mm_storeu_si128((__m128i *)(d + i), _mm_unpacklo_epi8(v, zero));
+		_mm_storeu_si128((__m128i *)(d + i + 8), _mm_unpackhi_epi8(v, zero));
+	}
+
+	return i + widen_ascii_scalar(p + i, n - i, d + i);
+}
+
+static __attribute__((target("sse2"))) String_len
+narrow_ascii_sse2(const uint16_t *p, String_len n, char *d)
+{
+	const __m128i high = _mm_set1_epi16((short)0xff80), zero = _mm_setzero_si128();
+	String_len i;
+	__m128i a, b;
+
+	for (i = 0; n - i >= 16; i += 16) {
+		a = _mm_loadu_si128((const __m128i *)(p + i));
+		b = _mm_loadu_si128((const __m128i *)(p + i + 8));
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(a, b), high),
+		                                      zero)) != 0xffff) {
+			break;
+		}
+
+		_mm_storeu_si128((__m128i *)(d + i), _mm_packus_epi16(a, b));
+	}
+
+	return i + narrow_ascii_scalar(p + i, n - i, d + i);
+}
+
+#define dispatch(name) \
+	(__builtin_cpu_supports("avx2") ? name##_avx2 : \
+	 __builtin_cpu_supports("sse2") ? name##_sse2 : name##_scalar)
+#define dispatch_sse2(name) \
+	(__builtin_cpu_supports("sse2") ? name##_sse2 : name##_scalar)
+#define validate \
+	(__builtin_cpu_supports("avx2") ? validate_avx2 : \
+	 __builtin_cpu_supports("ssse3") ? validate_ssse3 : validate_scalar)
+#else
+#define dispatch(name) name##_scalar
+#define dispatch_sse2(name) name##_scalar
+#define validate validate_scalar
+#endif
+
+int StringView_utf8_validate(StringView v)
+{
+	int ascii;
+
+	assert(v.ptr != NULL || v.len == 0);
+	return validate(v.ptr, v.len, &ascii);
+}
+
+int String_utf8_validate(String s)
+{
+	assert(s != NULL);
+	return (check(s) & UTF8) != 0;
+}
+
+int StringView_is_ascii(StringView v)
+{
+	assert(v.ptr != NULL || v.len == 0);
+	return dispatch(ascii_prefix)(v.ptr, v.len) == v.len;
+}
+
+int String_is_ascii(String s)
+{
+	assert(s != NULL);
+	return (check(s) & ASCII) != 0;
+}
+
+String_len StringView_utf8_length(StringView v)
+{
+	assert(v.ptr != NULL || v.len == 0);
+	return dispatch(count_leads)(v.ptr, v.len);
+}
+
+String_len String_utf8_length(String s)
+{
+	assert(s != NULL);
+
+	if ((s->flags & (CHECKED | ASCII)) == (CHECKED | ASCII)) {
+		return used(s);
+	}
+
+	return dispatch(count_leads)(s->raw, used(s));
+}
+
+int String_utf8_truncate(String s, String_len max)
+{
+	unsigned char before;
+
+	assert(s != NULL);
+
+	if (max >= used(s)) {
+		return 0;
+	}
+
+	/* the first char cut off mustn't be a continuation */
+	while (max > 0 && (s->raw[max] & 0xc0) == 0x80) {
+		max--;
+	}
+
+	before = s->flags;
+
+	if (string_prepare_write(s)) {
+		return -1;
+	}
+
+	s->raw[max] = '\0';
+	s->len = max + 1;
+
+	/* cutting at a codepoint keeps ASCII as it is, anything else may become it */
+	if (before & ASCII) {
+		s->flags |= CHECKED | UTF8 | ASCII;
+	}
+
+	return 0;
+}
+
+String_len StringView_utf8_to_utf16(StringView v, uint16_t *dest, String_len max)
+{
+	const unsigned char *p = (const unsigned char *)v.ptr;
+	String_len i, o, run;
+	uint32_t cp;
+	int ascii;
+
+	assert(v.ptr != NULL || v.len == 0);
+	assert(dest != NULL || max == 0);
+
+	if (!validate(v.ptr, v.len, &ascii)) {
+		return STRING_NOT_FOUND;
+	}
+
+	for (i = 0, o = 0; i < v.len; ) {
+		if (p[i] < 0x80) {
+			/* once dest is full the rest of the run is only measured */
+			if (o < max) {
+				run = dispatch_sse2(widen_ascii)(v.ptr + i, v.len - i < max - o ?
+				                                 v.len - i : max - o, dest + o);
+			} else {
+				run = dispatch(ascii_prefix)(v.ptr + i, v.len - i);
+			}
+
+			i += run;
+			o += run;
+			continue;
+		}
+
+		i += decode(p + i, &cp);
+
+		if (cp < 0x10000) {
+			if (o < max) {
+				dest[o] = cp;
+			}
+
+			o += 1;
+		} else {
+			if (o < max && max - o >= 2) {
+				cp -= 0x10000;
+				dest[o] = 0xd800 | cp >> 10;
+				dest[o + 1] = 0xdc00 | (cp & 0x3ff);
+			}
+
+			o += 2;
+		}
+	}
+
+	return o;
+}
+
+int String_cat_utf16(String dest, const uint16_t *src, String_len n)
+{
+	String_len i = 0, run, offset;
+	uint64_t len = 0;
+	uintptr_t old;
+	unsigned char before;
+	uint32_t cp;
+	char *w;
+
+	assert(dest != NULL);
+	assert(src != NULL || n == 0);
+
+	/* sized first, so dest grows once and is left alone on errors */
+	while (i < n) {
+		cp = src[i++];
+
+		if (cp < 0x80) {
+			run = dispatch(ascii16_prefix)(src + i, n - i);
+			len += 1 + run;
+			i += run;
+		} else if (cp < 0x800) {
+			len += 2;
+		} else if (cp < 0xd800 || cp > 0xdfff) {
+			len += 3;
+		} else if (cp < 0xdc00 && i < n && (src[i] & 0xfc00) == 0xdc00) {
+			len += 4;
+			i++;
+		} else {
+			return -1;
+		}
+	}
+
+	offset = used(dest);
+	before = offset == 0 ? CHECKED | UTF8 | ASCII : dest->flags;
+	old = (uintptr_t)dest->raw;
+
+	if (!fits(offset, len) || string_prepare_write(dest) ||
+	    string_reserve_at(dest, offset, len)) {
+		return -1;
+	}
+
+	/* src may be part of dest */
+	src = (const uint16_t *)string_rebase(dest, old, offset, (const char *)src);
+
+	for (i = 0, w = dest->raw + offset; i < n; ) {
+		if (src[i] < 0x80) {
+			run = dispatch_sse2(narrow_ascii)(src + i, n - i, w);
+			w += run;
+			i += run;
+			continue;
+		}
+
+		cp = src[i++];
+
+		if (cp < 0x800) {
+			*w++ = 0xc0 | cp >> 6;
+			*w++ = 0x80 | (cp & 0x3f);
+		} else if (cp < 0xd800 || cp > 0xdfff) {
+			*w++ = 0xe0 | cp >> 12;
+			*w++ = 0x80 | (cp >> 6 & 0x3f);
+			*w++ = 0x80 | (cp & 0x3f);
+		} else {
+			cp = 0x10000 + ((cp - 0xd800) << 10 | (src[i++] - 0xdc00));
+			*w++ = 0xf0 | cp >> 18;
+			*w++ = 0x80 | (cp >> 12 & 0x3f);
+			*w++ = 0x80 | (cp >> 6 & 0x3f);
+			*w++ = 0x80 | (cp & 0x3f);
+		}
+	}
+
+	*w = '\0';
+	dest->len = offset + len + 1;
+	keep_valid(dest, before, len == n);
+	return 0;
+}
+
+String_len StringView_utf8_to_latin1(StringView v, char *dest, String_len max)
+{
+	const unsigned char *p = (const unsigned char *)v.ptr;
+	String_len i, o, run;
+	int ascii;
+
+	assert(v.ptr != NULL || v.len == 0);
+	assert(dest != NULL || max == 0);
+
+	if (!validate(v.ptr, v.len, &ascii)) {
+		return STRING_NOT_FOUND;
+	}
+
+	for (i = 0, o = 0; i < v.len; ) {
+		if (p[i] < 0x80) {
+			run = dispatch(ascii_prefix)(v.ptr + i, v.len - i);
+
+			if (o < max) {
+				memcpy(dest + o, p + i, run < max - o ? run : max - o);
+			}
+
+			i += run;
+			o += run;
+		} else if (p[i] <= 0xc3) {
+			/* C2 and C3 lead U+0080 to U+00FF */
+			if (o < max) {
+				dest[o] = (p[i] & 0x03) << 6 | (p[i + 1] & 0x3f);
+			}
+
+			i += 2;
+			o += 1;
+		} else {
+			return STRING_NOT_FOUND;
+		}
+	}
+
+	return o;
+}
+
+int String_cat_latin1(String dest, const char *src, String_len n)
+{
+	const unsigned char *p;
+	String_len i, run, offset, high;
+	uintptr_t old;
+	unsigned char before;
+	char *w;
+
+	assert(dest != NULL);
+	assert(src != NULL || n == 0);
+
+	offset = used(dest);
+	high = dispatch(count_high)(src, n);
+	before = offset == 0 ? CHECKED | UTF8 | ASCII : dest->flags;
+	old = (uintptr_t)dest->raw;
+
+	if (!fits(offset, n) || !fits(offset + n, high) || string_prepare_write(dest) ||
+	    string_reserve_at(dest, offset, n + high)) {
+		return -1;
+	}
+
+	/* src may be part of dest */
+	src = string_rebase(dest, old, offset, src);
+	p = (const unsigned char *)src;
+
+	for (i = 0, w = dest->raw + offset; i < n; ) {
+		if (p[i] < 0x80) {
+			run = dispatch(ascii_prefix)(src + i, n - i);
+			memcpy(w, p + i, run);
+			w += run;
+			i += run;
+		} else {
+			*w++ = 0xc0 | p[i] >> 6;
+			*w++ = 0x80 | (p[i] & 0x3f);
+			i++;
+		}
+	}
+
+	*w = '\0';
+	dest->len = offset + n + high + 1;
+	keep_valid(dest, before, high == 0);
+	return 0;
+}
+
+static String_len ascii_prefix_scalar(const char *p, String_len n)
+{
+	String_len i;
+	uint64_t w;
+
+	/* a word at a time, then the byte that ended the run */
+	for (i = 0; n - i >= 8; i += 8) {
+		memcpy(&w, p + i, 8);
+
+		if (w & 0x8080808080808080ull) {
+			break;
+		}
+	}
+
+	while (i < n && !(p[i] & 0x80)) {
+		i++;
+	}
+
+	return i;
+}
+
+static String_len ascii16_prefix_scalar(const uint16_t *p, String_len n)
+{
+	String_len i = 0;
+
+	while (i < n && p[i] < 0x80) {
+		i++;
+	}
+
+	return i;
+}
+
+static String_len widen_ascii_scalar(const char *p, String_len n, uint16_t *d)
+{
+	String_len i = 0;
+
+	while (i < n && !(p[i] & 0x80)) {
+		d[i] = p[i];
+		i++;
+	}
+
+	return i;
+}
+
+static String_len narrow_ascii_scalar(const uint16_t *p, String_len n, char *d)
+{
+	String_len i = 0;
+
+	while (i < n && p[i] < 0x80) {
+		d[i] = p[i];
+		i++;
+	}
+
+	return i;
+}
+
+static String_len count_leads_scalar(const char *p, String_len n)
+{
+	String_len i, count = 0;
+
+	for (i = 0; i < n; i++) {
+		count += (p[i] & 0xc0) != 0x80;
+	}
+
+	return count;
+}
+
+static String_len count_high_scalar(const char *p, String_len n)
+{
+	String_len i, count = 0;
+
+	for (i = 0; i < n; i++) {
+		count += (p[i] & 0x80) != 0;
+	}
+
+	return count;
+}
+
+static int validate_scalar(const char *p, String_len n, int *ascii)
+{
+	const unsigned char *u = (const unsigned char *)p;
+	unsigned char lo, hi;
+	String_len i = 0;
+	unsigned k, j;
+
+	*ascii = YES;
+
+	while ((i += ascii_prefix_scalar(p + i, n - i)) < n) {
+		*ascii = NO;
+		lo = 0x80;
+		hi = 0xbf;
+
+		/* the second byte's range is what rules out overlongs and surrogates */
+		if (u[i] < 0xc2) {
+			return 0;
+		} else if (u[i] < 0xe0) {
+			k = 1;
+		} else if (u[i] < 0xf0) {
+			k = 2;
+			lo = u[i] == 0xe0 ? 0xa0 : lo;
+			hi = u[i] == 0xed ? 0x9f : hi;
+		} else if (u[i] < 0xf5) {
+			k = 3;
+			lo = u[i] == 0xf0 ? 0x90 : lo;
+			hi = u[i] == 0xf4 ? 0x8f : hi;
+		} else {
+			return 0;
+		}
+
+		if (n - i <= k || u[i + 1] < lo || u[i + 1] > hi) {
+			return 0;
+		}
+
+		for (j = 2; j <= k; j++) {
+			if ((u[i + j] & 0xc0) != 0x80) {
+				return 0;
+			}
+		}
+
+		i += k + 1;
+	}
+
+	return 1;
+}
+
+static unsigned decode(const unsigned char *p, uint32_t *cp)
+{
+	if (p[0] < 0x80) {
+		*cp = p[0];
+		return 1;
+	}
+
+	if (p[0] < 0xe0) {
+		*cp = (uint32_t)(p[0] & 0x1f) << 6 | (p[1] & 0x3f);
+		return 2;
+	}
+
+	if (p[0] < 0xf0) {
+		*cp = (uint32_t)(p[0] & 0x0f) << 12 | (uint32_t)(p[1] & 0x3f) << 6 | (p[2] & 0x3f);
+		return 3;
+	}
+
+	*cp = (uint32_t)(p[0] & 0x07) << 18 | (uint32_t)(p[1] & 0x3f) << 12 |
+	      (uint32_t)(p[2] & 0x3f) << 6 | (p[3] & 0x3f);
+	return 4;
+}
+
+static unsigned char check(String s)
+{
+	int ascii;
+
+	if (!(s->flags & CHECKED)) {
+		if (validate(s->raw, used(s), &ascii)) {
+			s->flags |= ascii ? UTF8 | ASCII : UTF8;
+		}
+
+		s->flags |= CHECKED;
+	}
+
+	return s->flags;
+}
+
+static void keep_valid(String s, unsigned char before, int ascii)
+{
+	if ((before & (CHECKED | UTF8)) == (CHECKED | UTF8)) {
+		s->flags |= CHECKED | UTF8;
+
+		if ((before & ASCII) && ascii) {
+			s->flags |= ASCII;
+		}
+	}
+}